@@ -0,0 +1,555 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "aot.h"
+#include "block.h"
+#include "constants.h"
+#include "datatypes_em.h"
+#include "decoders.h"
+#include "flags.h"
+#include "memory_em.h"
+#include "pipeline.h"
+
+// Ahead-of-time Translation
+// Writes a C program with one function per basic block reachable from address 0.
+// Inside a block, guest registers live in locals; flags and memory go through
+// execute.c, so the compiled program ends in the same state as the interpreter.
+// Code the walk cannot see (br targets, words overwritten at run time) is left
+// to the interpreter bundled in libaot.a.
+
+#define NUM_LOCALS (NUM_OF_REGISTERS + 2)
+#define LOCAL_ZR NUM_OF_REGISTERS       // R[31] as the register instructions index it
+#define LOCAL_SP (NUM_OF_REGISTERS + 1) // register 31 of DPI and SDT base registers
+
+static _Thread_local FILE *out;
+
+static void emitLine(int indent, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    fprintf(out, "%*s", indent * 4, "");
+    vfprintf(out, format, args);
+    fprintf(out, "\n");
+    va_end(args);
+}
+
+//
+// Locals
+//
+static const char *localName(int local)
+{
+    static char names[NUM_LOCALS][4];
+    if (local == LOCAL_ZR) {
+        return "zr";
+    }
+    if (local == LOCAL_SP) {
+        return "sp";
+    }
+    sprintf(names[local], "x%d", local);
+    return names[local];
+}
+
+static const char *stateName(int local)
+{
+    static char names[NUM_LOCALS][16];
+    if (local == LOCAL_ZR) {
+        return "state->ZR";
+    }
+    if (local == LOCAL_SP) {
+        return "state->SP";
+    }
+    sprintf(names[local], "state->R[%d]", local);
+    return names[local];
+}
+
+// Register 31 means SP for DPI operands and SDT base registers...
+static int spLocal(uint8_t reg)
+{
+    return (reg == ZR_SP) ? LOCAL_SP : reg;
+}
+
+// ...and R[31], the zero register slot, everywhere else
+static const char *sp(uint8_t reg)
+{
+    return localName(spLocal(reg));
+}
+
+static const char *zr(uint8_t reg)
+{
+    return localName(reg);
+}
+
+static void markRegisters(Instruction *instruction, bool used[NUM_LOCALS])
+{
+    switch (instruction->instructionType) {
+        case isDPI:
+            used[spLocal(instruction->dpi.rd)] = true;
+            if (instruction->dpi.opi == ARITHMETIC) {
+                used[spLocal(instruction->dpi.rn)] = true;
+            }
+            break;
+        case isDPR:
+            used[instruction->dpr.rd] = used[instruction->dpr.rn] = used[instruction->dpr.rm] = true;
+            if (instruction->dpr.m == 1) {
+                used[instruction->dpr.ra] = true;
+            }
+            break;
+        case isSDT:
+            used[instruction->sdt.rt] = true;
+            if (instruction->sdt.mode == 1) {
+                used[spLocal(instruction->sdt.xn)] = true;
+            }
+            if (instruction->sdt.mode == 1 && instruction->sdt.u == 0 && instruction->sdt.offmode == 1) {
+                used[instruction->sdt.xm] = true;
+            }
+            break;
+        case isB:
+            if (instruction->b.type == BRANCH_REGISTER) {
+                used[instruction->b.xn] = true;
+            }
+            break;
+    }
+}
+
+static void emitWriteBack(int indent, bool used[NUM_LOCALS])
+{
+    for (int i = 0; i < NUM_LOCALS; i++) {
+        if (used[i]) {
+            emitLine(indent, "%s = (int64_t)%s;", stateName(i), localName(i));
+        }
+    }
+}
+
+static void emitMask(int indent, bool sf, const char *local)
+{
+    if (sf == 0) {
+        emitLine(indent, "%s &= MASK32;", local);
+    }
+}
+
+//
+// Instructions
+//
+static void emitArithmetic(int indent, uint8_t opc, uint8_t rd, bool sf, const char *Rd, const char *op2)
+{
+    bool setFlags = (opc == ADD_SETFLAGS || opc == SUB_SETFLAGS);
+    bool isAdd = (opc == ADD || opc == ADD_SETFLAGS);
+
+    if (!setFlags || rd != ZR_SP) {
+        emitLine(indent, "%s = n %c %s;", Rd, isAdd ? '+' : '-', op2);
+    }
+    if (setFlags) {
+        emitLine(indent, "updateFlagsArithmetic((int64_t)n, (int64_t)%s, %d, %s);", op2, sf, isAdd ? "true" : "false");
+    }
+}
+
+static bool emitDPI(struct DPI dpi)
+{
+    uint64_t widthMask = (dpi.sf) ? UINT64_MAX : MASK32;
+
+    if (dpi.opi == ARITHMETIC) {
+        uint64_t imm = ((uint64_t)dpi.imm12) << (ARITHMETIC_SHIFT * dpi.sh);
+        char op2[24];
+        sprintf(op2, "0x%llxULL", (unsigned long long)imm);
+        emitLine(1, "{");
+        emitLine(2, "uint64_t n = %s;", sp(dpi.rn));
+        emitMask(2, dpi.sf, "n");
+        emitArithmetic(2, dpi.opc, dpi.rd, dpi.sf, sp(dpi.rd), op2);
+        emitLine(1, "}");
+        emitMask(1, dpi.sf, sp(dpi.rd));
+        return true;
+    }
+
+    // Wide Move
+    uint64_t imm16 = ((uint64_t)dpi.imm16) << (dpi.hw * WIDEMOVE_SHIFT);
+    if (dpi.rd == ZR_SP) {
+        emitMask(1, dpi.sf, "sp");
+        return true;
+    }
+    switch (dpi.opc) {
+        case MOVE_WITH_NOT:
+            emitLine(1, "%s = 0x%llxULL;", sp(dpi.rd), (unsigned long long)(~imm16 & widthMask));
+            return true;
+        case MOVE_WITH_ZERO:
+            emitLine(1, "%s = 0x%llxULL;", sp(dpi.rd), (unsigned long long)(imm16 & widthMask));
+            return true;
+        case MOVE_WITH_KEEP: {
+            uint64_t mask = MASK16 << (dpi.hw * WIDEMOVE_SHIFT);
+            emitLine(1, "%s = (%s & 0x%llxULL) | 0x%llxULL;", sp(dpi.rd), sp(dpi.rd),
+                     (unsigned long long)(~mask & widthMask), (unsigned long long)(imm16 & widthMask));
+            return true;
+        }
+    }
+    return false;
+}
+
+// The same values shift() computes, with the mode and amount fixed
+static void emitShift(int indent, struct DPR dpr)
+{
+    int bits = (dpr.sf) ? MODE64 : MODE32;
+    int amount = dpr.operand % bits;
+
+    switch (dpr.shift) {
+        case LOGICAL_SHIFT_LEFT:
+            emitLine(indent, (dpr.sf) ? "uint64_t op2 = m << %d;"
+                                      : "uint64_t op2 = (uint32_t)((uint32_t)m << %d);", amount);
+            break;
+        case LOGICAL_SHIFT_RIGHT:
+            emitLine(indent, (dpr.sf) ? "uint64_t op2 = m >> %d;"
+                                      : "uint64_t op2 = (uint32_t)m >> %d;", amount);
+            break;
+        case ARITHMETIC_SHIFT_RIGHT:
+            emitLine(indent, (dpr.sf) ? "uint64_t op2 = (uint64_t)((int64_t)m >> %d);"
+                                      : "uint64_t op2 = (uint32_t)((int32_t)m >> %d);", amount);
+            break;
+        case ROTATE_RIGHT:
+            if (amount == 0) {
+                emitLine(indent, "uint64_t op2 = m;");
+            } else if (dpr.sf) {
+                emitLine(indent, "uint64_t op2 = (m >> %d) | (m << %d);", amount, MODE64 - amount);
+            } else {
+                emitLine(indent, "uint64_t op2 = ((uint32_t)m >> %d | m << %d) & MASK32;", amount, MODE32 - amount);
+            }
+            break;
+    }
+}
+
+static void emitDPR(struct DPR dpr)
+{
+    // Both operands read the zero register slot when rm is 31
+    emitLine(1, "{");
+    emitLine(2, "uint64_t m = %s;", zr(dpr.rm));
+    emitLine(2, "uint64_t n = %s;", (dpr.rm != ZR_SP) ? zr(dpr.rn) : "zr");
+    emitMask(2, dpr.sf, "m");
+    emitMask(2, dpr.sf, "n");
+
+    if (dpr.m == 1) { // Multiply
+        if (dpr.rd != ZR_SP) {
+            emitLine(2, "%s = %s %c n * m;", zr(dpr.rd), zr(dpr.ra), (dpr.x == 0) ? '+' : '-');
+        }
+    } else if (dpr.armOrLog == 1) { // Arithmetic
+        emitShift(2, dpr);
+        emitArithmetic(2, dpr.opc, dpr.rd, dpr.sf, zr(dpr.rd), "op2");
+    } else { // Logical
+        emitShift(2, dpr);
+        if (dpr.n == 1) {
+            emitLine(2, "op2 = ~op2;");
+        }
+        switch (dpr.opc) {
+            case BITWISE_AND:
+                emitLine(2, "%s = n & op2;", zr(dpr.rd));
+                break;
+            case BITWISE_OR:
+                emitLine(2, "%s = n | op2;", zr(dpr.rd));
+                break;
+            case BITWISE_XOR:
+                emitLine(2, "%s = n ^ op2;", zr(dpr.rd));
+                break;
+            case BITWISE_AND_SETFLAGS:
+                if (dpr.rd != ZR_SP) {
+                    emitLine(2, "%s = n & op2;", zr(dpr.rd));
+                }
+                emitLine(2, "updateFlagsAnd((int64_t)n, (int64_t)op2, %d);", dpr.sf);
+                break;
+        }
+    }
+    emitLine(1, "}");
+    emitMask(1, dpr.sf, zr(dpr.rd));
+}
+
+static void emitSDT(struct SDT sdt, uint32_t pc, bool used[NUM_LOCALS])
+{
+    // A fault reports the PC of the access
+    emitLine(1, "state->PC = 0x%x;", pc);
+    emitMask(1, sdt.sf, zr(sdt.rt));
+
+    if (sdt.mode == 0) { // Load Literal
+        uint64_t target = pc + ((int64_t)sdt.simm19) * INSTR_BYTES;
+        emitLine(1, "loadFromMemory(0x%lxULL, (int64_t *)&%s, %d);", (unsigned long)target, zr(sdt.rt), sdt.sf);
+        return;
+    }
+
+    emitLine(1, "{");
+    emitLine(2, "uint64_t addr = (uint64_t)%s;", sp(sdt.xn));
+    if (sdt.u == 1) { // Unsigned Immediate Offset
+        uint16_t uoffset = sdt.imm12 * ((sdt.sf) ? MODE64_BYTES : MODE32_BYTES);
+        emitLine(2, "addr += %u;", uoffset);
+    } else if (sdt.offmode == 0) { // Pre/Post - Index
+        if (sdt.i) {
+            emitLine(2, "addr += (uint64_t)(int64_t)%d;", sdt.simm9);
+        }
+        emitLine(2, "%s += (uint64_t)(int64_t)%d;", sp(sdt.xn), sdt.simm9);
+    } else { // Register Offset
+        emitLine(2, "addr += (uint64_t)%s;", (sdt.xn == ZR_SP) ? "sp" : zr(sdt.xm));
+    }
+
+    if (sdt.l == 1) {
+        emitLine(2, "loadFromMemory(addr, (int64_t *)&%s, %d);", zr(sdt.rt), sdt.sf);
+    } else {
+        emitLine(2, "storeToMemory(addr, (int64_t)%s, %d);", zr(sdt.rt), sdt.sf);
+        // Overwritten code is no longer what was translated
+        emitLine(2, "if (blocksModified) {");
+        emitWriteBack(3, used);
+        emitLine(3, "state->PC = 0x%x;", pc + INSTR_BYTES);
+        emitLine(3, "return AOT_NEXT;");
+        emitLine(2, "}");
+    }
+    emitLine(1, "}");
+}
+
+static const char *conditionOf(struct B b)
+{
+    static char condition[64];
+    if (!isValidCondition(b.cond.tag)) {
+        return NULL;
+    }
+    sprintf(condition, "%sconditionHolds(currentFlags(), %d)", (b.cond.neg) ? "!" : "", b.cond.tag);
+    return condition;
+}
+
+// Every way out of a block writes the locals back and sets PC
+static bool emitBranch(struct B b, uint32_t pc, bool used[NUM_LOCALS])
+{
+    switch (b.type) {
+        case BRANCH_UNCONDITIONAL:
+            emitWriteBack(1, used);
+            emitLine(1, "state->PC = %lld;", (long long)(pc + ((int64_t)b.simm26) * INSTR_BYTES));
+            return true;
+        case BRANCH_CONDITIONAL: {
+            const char *condition = conditionOf(b);
+            if (condition == NULL) {
+                return false;
+            }
+            emitWriteBack(1, used);
+            emitLine(1, "state->PC = %s ? %lld : %lld;", condition,
+                     (long long)(pc + ((int64_t)b.simm19) * INSTR_BYTES), (long long)(pc + INSTR_BYTES));
+            return true;
+        }
+        case BRANCH_REGISTER:
+            emitWriteBack(1, used);
+            emitLine(1, "state->PC = (int64_t)%s;", zr(b.xn));
+            return true;
+    }
+    return false;
+}
+
+static void emitBlock(Block *block)
+{
+    bool used[NUM_LOCALS] = {false};
+    for (int i = 0; i < block->length; i++) {
+        markRegisters(&(block->ops[i].instruction), used);
+    }
+
+    emitLine(0, "static int block_%08x(void)", block->start);
+    emitLine(0, "{");
+    for (int i = 0; i < NUM_LOCALS; i++) {
+        if (used[i]) {
+            emitLine(1, "uint64_t %s = (uint64_t)%s;", localName(i), stateName(i));
+        }
+    }
+
+    uint32_t pc = block->start;
+    for (int i = 0; i < block->length; i++, pc += INSTR_BYTES) {
+        Instruction instruction = block->ops[i].instruction;
+        bool translated = true;
+        switch (instruction.instructionType) {
+            case isDPI:
+                translated = emitDPI(instruction.dpi);
+                break;
+            case isDPR:
+                emitDPR(instruction.dpr);
+                break;
+            case isSDT:
+                emitSDT(instruction.sdt, pc, used);
+                break;
+            case isB:
+                if (emitBranch(instruction.b, pc, used)) {
+                    emitLine(1, "return AOT_NEXT;");
+                    emitLine(0, "}");
+                    return;
+                }
+                translated = false;
+                break;
+        }
+        if (!translated) {
+            // Leave the instruction to the interpreter
+            emitWriteBack(1, used);
+            emitLine(1, "state->PC = 0x%x;", pc);
+            emitLine(1, "return AOT_MISS;");
+            emitLine(0, "}");
+            return;
+        }
+    }
+
+    emitWriteBack(1, used);
+    emitLine(1, "state->PC = 0x%x;", pc);
+    emitLine(1, "return %s;", (block->halts) ? "AOT_HALT" : "AOT_NEXT");
+    emitLine(0, "}");
+}
+
+//
+// Code Discovery
+//
+// Successors of a block that are known before running it
+static int successorsOf(Block *block, uint32_t successors[2])
+{
+    uint32_t end = block->start + block->length * INSTR_BYTES;
+    if (block->halts) {
+        return 0;
+    }
+    if (block->length == 0 || block->ops[block->length - 1].instruction.instructionType != isB) {
+        successors[0] = end;
+        return 1;
+    }
+
+    uint32_t pc = end - INSTR_BYTES;
+    struct B b = block->ops[block->length - 1].instruction.b;
+    switch (b.type) {
+        case BRANCH_UNCONDITIONAL:
+            successors[0] = pc + ((int64_t)b.simm26) * INSTR_BYTES;
+            return 1;
+        case BRANCH_CONDITIONAL:
+            successors[0] = pc + ((int64_t)b.simm19) * INSTR_BYTES;
+            successors[1] = end;
+            return 2;
+    }
+    return 0;
+}
+
+// Whether a block can start at addr, checked without reporting a bad word
+static bool decodes(uint32_t addr)
+{
+    Instruction instruction;
+    uint32_t instr = fetch(addr);
+    return instr == HALT_INSTR || decodeInstructionQuietly(instr, &instruction) == EXIT_SUCCESS;
+}
+
+// Collect the blocks reachable from address 0 in address order
+static int discoverBlocks(Block **found)
+{
+    bool *seen = (bool *)calloc(MEMORY_SIZE / INSTR_BYTES, sizeof(bool));
+    uint32_t *worklist = (uint32_t *)malloc(MEMORY_SIZE / INSTR_BYTES * sizeof(uint32_t));
+    if (seen == NULL || worklist == NULL) {
+        perror("Failed to allocate space for the AOT walk.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int pending = 0;
+    worklist[pending++] = 0;
+    while (pending > 0) {
+        uint32_t addr = worklist[--pending];
+        if (addr >= MEMORY_SIZE || addr % INSTR_BYTES != 0 || seen[addr / INSTR_BYTES]) {
+            continue;
+        }
+
+        // The interpreter reports the bad instruction if it is reached
+        Block *block;
+        if (!decodes(addr) || lookupBlock(addr, &block) != EXIT_SUCCESS) {
+            continue;
+        }
+        seen[addr / INSTR_BYTES] = true;
+        uint32_t successors[2];
+        int count = successorsOf(block, successors);
+        for (int i = 0; i < count; i++) {
+            worklist[pending++] = successors[i];
+        }
+    }
+
+    int numBlocks = 0;
+    for (uint32_t word = 0; word < MEMORY_SIZE / INSTR_BYTES; word++) {
+        if (seen[word] && lookupBlock(word * INSTR_BYTES, &found[numBlocks]) == EXIT_SUCCESS) {
+            numBlocks++;
+        }
+    }
+    free(seen);
+    free(worklist);
+    return numBlocks;
+}
+
+//
+// Output
+//
+// The image covers the code window, where the loaded program lives
+static void emitImage(void)
+{
+    uint32_t size = MEMORY_SIZE;
+    uint8_t *image = (uint8_t *)malloc(size);
+    if (image == NULL) {
+        perror("Failed to allocate space for the AOT image.\n");
+        exit(EXIT_FAILURE);
+    }
+    copyFromMemory(0, image, size);
+    while (size > 0 && image[size - 1] == 0) {
+        size--;
+    }
+    emitLine(0, "const uint8_t aotImage[] = {");
+    for (uint32_t i = 0; i < size; i += 16) {
+        fprintf(out, "   ");
+        for (uint32_t j = i; j < i + 16 && j < size; j++) {
+            fprintf(out, " 0x%02x,", image[j]);
+        }
+        fprintf(out, "\n");
+    }
+    emitLine(0, "    0};");
+    emitLine(0, "const size_t aotImageSize = %u;", size);
+    emitLine(0, "const uint64_t aotMemorySize = %luULL;", (unsigned long)state->memory.size);
+    emitLine(0, "");
+    free(image);
+}
+
+int writeAot(FILE *file, const char *inputFile)
+{
+    out = file;
+    initializeBlocks();
+
+    Block **blocks = (Block **)malloc(MEMORY_SIZE / INSTR_BYTES * sizeof(Block *));
+    if (blocks == NULL) {
+        perror("Failed to allocate space for the AOT blocks.\n");
+        exit(EXIT_FAILURE);
+    }
+    int numBlocks = discoverBlocks(blocks);
+
+    emitLine(0, "// Generated by emulate --aot from %s", inputFile);
+    emitLine(0, "// Build with: gcc -std=c17 -O2 -I<emulator src> <this file> <emulator src>/libaot.a -lm -pthread -o <program>");
+    emitLine(0, "#include \"aot_runtime.h\"");
+    emitLine(0, "");
+    emitImage();
+
+    for (int i = 0; i < numBlocks; i++) {
+        emitBlock(blocks[i]);
+        emitLine(0, "");
+    }
+
+    emitLine(0, "const uint32_t aotBlockStarts[] = {");
+    for (int i = 0; i < numBlocks; i++) {
+        emitLine(1, "0x%08x,", blocks[i]->start);
+    }
+    emitLine(0, "    0};");
+    emitLine(0, "const int aotNumBlocks = %d;", numBlocks);
+    emitLine(0, "");
+
+    emitLine(0, "int aotDispatch(int64_t pc)");
+    emitLine(0, "{");
+    emitLine(1, "switch (pc) {");
+    for (int i = 0; i < numBlocks; i++) {
+        emitLine(2, "case 0x%08x:", blocks[i]->start);
+        emitLine(3, "return block_%08x();", blocks[i]->start);
+    }
+    emitLine(2, "default:");
+    emitLine(3, "return AOT_MISS;");
+    emitLine(1, "}");
+    emitLine(0, "}");
+    emitLine(0, "");
+
+    emitLine(0, "int main(int argc, char **argv)");
+    emitLine(0, "{");
+    emitLine(1, "return aotMain(argc, argv);");
+    emitLine(0, "}");
+
+    free(blocks);
+    freeBlocks();
+    return EXIT_SUCCESS;
+}
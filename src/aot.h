@@ -0,0 +1,9 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdio.h>
+
+// Prototypes
+extern int writeAot(FILE *file, const char *inputFile);
+
+#endif
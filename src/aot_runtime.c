@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "aot_runtime.h"
+#include "decoders.h"
+#include "io.h"
+#include "io_em.h"
+#include "memory_em.h"
+#include "pipeline.h"
+#include "utils_em.h"
+
+// The only guest of the translated program
+static struct EmulatorState aotState;
+
+// Run translated blocks, interpreting whatever was not translated
+static int runAot(void)
+{
+    Instruction instruction;
+
+    while (true) {
+        // Translated code is abandoned for good once any of it is overwritten
+        if (!blocksModified) {
+            int result = aotDispatch(state->PC);
+            if (result == AOT_HALT) {
+                return EXIT_SUCCESS;
+            }
+            if (result == AOT_NEXT) {
+                continue;
+            }
+            // AOT_MISS falls through to interpret one instruction
+        }
+
+        uint32_t instr = fetch(state->PC);
+        if (instr == HALT_INSTR) {
+            return EXIT_SUCCESS;
+        }
+        if (decodeInstruction(instr, &instruction) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+        if (execute(instruction) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+}
+
+int aotMain(int argc, char **argv)
+{
+    char *outputFile = (argc > 1) ? argv[1] : STDOUT;
+
+    state = &aotState;
+    initializeState(aotMemorySize);
+    copyToMemory(0, aotImage, aotImageSize);
+
+    // Register the translated code so stores into it are noticed
+    Block *block;
+    initializeBlocks();
+    for (int i = 0; i < aotNumBlocks; i++) {
+        checkError(lookupBlock(aotBlockStarts[i], &block));
+    }
+
+    checkError(runAot());
+    freeBlocks();
+
+    FILE *output = openOutputFile(outputFile, "out", "w");
+    writeFinalState(output);
+    checkErrorOutput(output);
+    fclose(output);
+    freeMemory();
+
+    return EXIT_SUCCESS;
+}
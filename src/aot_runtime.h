@@ -0,0 +1,34 @@
+#ifndef AOT_RUNTIME_H
+#define AOT_RUNTIME_H
+
+// Runtime for programs generated by emulate --aot
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "block.h"
+#include "constants.h"
+#include "datatypes_em.h"
+#include "execute.h"
+#include "flags.h"
+
+// Results of a generated block
+#define AOT_NEXT 0 // PC holds the next guest address
+#define AOT_HALT 1 // PC holds the address of the halt instruction
+#define AOT_MISS 2 // no translated code at PC, the interpreter runs the instruction there
+
+// Defined by the generated program
+extern const uint8_t aotImage[];
+extern const size_t aotImageSize;
+extern const uint64_t aotMemorySize;
+extern const uint32_t aotBlockStarts[];
+extern const int aotNumBlocks;
+extern int aotDispatch(int64_t pc);
+
+// Prototypes
+extern int aotMain(int argc, char **argv);
+
+#endif
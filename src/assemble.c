@@ -1,7 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
 
+#include "constants.h"
 #include "datatypes_as.h"
 #include "decoders.h"
 #include "disassembler.h"
@@ -11,15 +14,15 @@
 #include "utils_as.h"
 #include "vector.h"
 
-#define SPACE " "
-#define SPACECOMMA ", "
+#define SPACE " \t"
+#define SPACECOMMA ", \t"
 
 #define END_OF_FILE 0
 #define IN_FILE 1
 
-extern uint32_t binaryInstr;
+uint32_t binaryInstr[MAX_INSTR];
 // Keep track of address of instruction executed
-extern int PC;
+int PC;
 
 // symtable stores symbolTables as elements
 vector *symtable;
@@ -40,10 +43,10 @@ void updateSymbolTable(InstructionParse *instr)
     char *p = strchr(instr->instrname, ':');
     if (p != NULL) { // Label case
         *p = '\0';
-		struct symbolTable *symtableEntry = (struct symbolTable *)malloc(sizeof(struct symbolTable));
-		strcpy(symtableEntry->label, instr->instrname);
-		symtableEntry->address = PC * 4;
-		addToVector(symtable, symtableEntry);
+		struct symbolTable symtableEntry;
+		strcpy(symtableEntry.label, instr->instrname);
+		symtableEntry.address = PC * 4;
+		addToVector(symtable, &symtableEntry);
 	}
 }
 
@@ -84,12 +87,16 @@ int decompose(InstructionParse *instr, FILE *input)
     if (!fgets(instr->buff, BUFFER_LENGTH, input)) {
         return END_OF_FILE;
     }
-    instr->buff[strlen(instr->buff) - 1] = '\0';
+    instr->buff[strcspn(instr->buff, "\r\n")] = '\0';
 
     char *instrSavePntr = NULL; // Save pointer for instruction
 
     // Break down an instruction into its tokens
     char *token = strtok_r(instr->buff, SPACE, &instrSavePntr); // ignores any indent at start
+    if (token == NULL) { // Blank line
+        instr->buff[0] = '\0';
+        return IN_FILE;
+    }
     // Take the mnemonic of the instruction
     strcpy(instr->instrname, token);
     instr->type = identifyType(instr->instrname);
@@ -98,6 +105,10 @@ int decompose(InstructionParse *instr, FILE *input)
     token = strtok_r(NULL, SPACECOMMA, &instrSavePntr);
     instr->numTokens = 0;
     while (token != NULL) {
+        if (instr->numTokens == NUM_TOKENS || strlen(token) > MAX_TOKEN_LENGTH) {
+            fprintf(stderr, "Unsupported operands: %s\n", token);
+            exit(EXIT_FAILURE);
+        }
         strcpy(instr->tokens[instr->numTokens++], token);
         token = strtok_r(NULL, SPACECOMMA, &instrSavePntr);
     }
@@ -107,38 +118,74 @@ int decompose(InstructionParse *instr, FILE *input)
 // Construct a specific data structure out of the tokens based on instruction type
 int disassemble(InstructionParse *instr, Instruction *instruction, bool *disassembled)
 {
+    *disassembled = false;
     if (*(instr->buff) == '\0') {
         return EXIT_SUCCESS;
     }
     // Sends instruction to corresponding disassembler
-    *disassembled = false;
+    int result = EXIT_SUCCESS;
     switch (instr->type) {
         case lb:
             updateSymbolTable(instr);
-            return;
+            return EXIT_SUCCESS;
         case dir:
             updateBinaryInstr(getInt(instr->tokens[0]));
-            return;
+            return EXIT_SUCCESS;
         case als:
             disassembleAlias(instr, instruction);
-            disassemble(instr, instruction, disassembled);
-            break;
+            return disassemble(instr, instruction, disassembled);
         case b:
-            disassembleB(instr, instruction);
+            result = disassembleB(instr, instruction);
             break;
         case ls:
-            disassembleSDT(instr, instruction);
+            result = disassembleSDT(instr, instruction);
             break;
         case dp:
-            if (getOpType(instr->tokens) == imm) {
-                disassembleDPI(instr, instruction);
+            if (getOpType(instr->tokens, instr->numTokens) == imm) {
+                result = disassembleDPI(instr, instruction);
             } else {
-                disassembleDPR(instr, instruction);
+                result = disassembleDPR(instr, instruction);
             }
             break;
     }
     *disassembled = true;
-    return EXIT_SUCCESS;
+    return result;
+}
+
+// Encode an instruction: its fields through the decoders, writing with putBits,
+// then the bits fixed for its class
+int encode(uint32_t *instr, Instruction *instruction)
+{
+    *instr = 0;
+    switch (instruction->instructionType) {
+        case isDPI:
+            setOnes(instr, dpiOnes, SIZE_DPI1);
+            return decodeDPI(instr, instruction, putBits);
+        case isDPR:
+            setOnes(instr, dprOnes, SIZE_DPR1);
+            if (instruction->dpr.m) {
+                setOnes(instr, mulOnes, SIZE_MUL1);
+            }
+            return decodeDPR(instr, instruction, putBits);
+        case isSDT:
+            setOnes(instr, lsOnes, SIZE_LS1);
+            if (instruction->sdt.mode) {
+                setOnes(instr, sdtOnes, SIZE_SDT1);
+                if (!instruction->sdt.u && instruction->sdt.offmode) {
+                    setOnes(instr, sdtRegOnes, SIZE_SDTREG1);
+                } else if (!instruction->sdt.u) {
+                    setOnes(instr, sdtIndexOnes, SIZE_SDTINDEX1);
+                }
+            }
+            return decodeSDT(instr, instruction, putBits);
+        case isB:
+            setOnes(instr, bOnes, SIZE_B1);
+            if (instruction->b.type == BRANCH_REGISTER) {
+                setOnes(instr, brOnes, SIZE_BR1);
+            }
+            return decodeB(instr, instruction, putBits);
+    }
+    return EXIT_FAILURE;
 }
 
 //
@@ -149,6 +196,15 @@ void writeBinaryInstr(FILE *file)
     fwrite(binaryInstr, sizeof(int), PC, file);
 }
 
+// One line per label, its address then its name, for emulate --labels
+void writeSymbolTable(FILE *file)
+{
+    for (size_t i = 0; i < symtable->currentSize; i++) {
+        struct symbolTable *entry = (struct symbolTable *)getFromVector(symtable, i);
+        fprintf(file, "0x%08x %s\n", entry->address, entry->label);
+    }
+}
+
 //
 // Main Program
 //
@@ -156,16 +212,17 @@ int main(int argc, char **argv)
 {	
     char *inputFile;
     char *outputFile;
+    char *mapFile;
     if (argc >= 2) {
         inputFile = argv[1];
         outputFile = (argc > 2) ? argv[2] : STDOUT;
+        mapFile = (argc > 3) ? argv[3] : NULL;
     } else {
         perror("Provide at least an input file.\n");
         exit(EXIT_FAILURE);
     }
 
 	// Initializing data types
-    uint32_t *instr = &binaryInstr[PC];
     Instruction *instruction = initializeInstruction();
     InstructionParse *instructionParse = initializeInstructionParse();
 	symtable = initializeVector(MAX_INSTRS, sizeof(struct symbolTable));
@@ -178,14 +235,27 @@ int main(int argc, char **argv)
     FILE *output = openOutputFile(outputFile, "bin", "wb");
 
     while(decompose(instructionParse, input) != END_OF_FILE) {
+        memset(instruction, 0, sizeof(Instruction));
         int disassembleError = disassemble(instructionParse, instruction, &disassembled);
         checkError(disassembleError);
-        int decodeError = (disassembled) ? decode(instr, instruction, putBits) : EXIT_SUCCESS;
-        checkError(decodeError);
+        if (disassembled) {
+            uint32_t instr;
+            int encodeError = encode(&instr, instruction);
+            checkError(encodeError);
+            updateBinaryInstr(instr);
+        }
     }
 
     // One-pass: Compute previous undefined instructions
-    handleUndefTable(outputFile);
+    checkError(handleUndefTable());
+
+    // Write the labels for the emulator's profiler
+    if (mapFile != NULL) {
+        FILE *map = openOutputFile(mapFile, "map", "w");
+        writeSymbolTable(map);
+        checkErrorOutput(map);
+        fclose(map);
+    }
 
     // Freeing data types
     freeInstructionParse(instructionParse);
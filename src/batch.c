@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "batch.h"
+#include "emulator.h"
+
+// Batch Runner
+// Runs every .bin of a directory, or every path listed one per line in a file,
+// on a fixed pool of worker threads. Each worker owns one Emulator and resets
+// it between programs, so only the pages the last program touched are cleared.
+// Workers take the next program from a shared counter and share nothing else.
+// With more than one lane a worker takes that many programs at once and runs
+// them in lockstep, see lanes.c.
+
+#define BATCH_EXTENSION ".bin"
+#define OUTPUT_EXTENSION ".out"
+#define PATH_LENGTH 4096
+
+typedef struct {
+    char **paths;
+    size_t numPaths;
+    const char *outputDir; // NULL to write each .out next to its .bin
+    const struct EmulatorConfig *config;
+    int lanes;             // programs a worker runs in lockstep
+    atomic_size_t next;    // index of the next program to run
+} Batch;
+
+typedef struct {
+    Batch *batch;
+    pthread_t thread;
+    uint8_t *image; // the file being loaded, kept between programs
+    size_t imageCapacity;
+    uint64_t failed;
+    uint64_t instructions;
+} Worker;
+
+//
+// Inputs
+//
+static void addPath(char ***paths, size_t *numPaths, size_t *capacity, const char *path)
+{
+    if (*numPaths == *capacity) {
+        *capacity = (*capacity == 0) ? 64 : *capacity * 2;
+        *paths = (char **)realloc(*paths, *capacity * sizeof(char *));
+        if (*paths == NULL) {
+            perror("Failed to allocate space for the batch.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    char *copy = strdup(path);
+    if (copy == NULL) {
+        perror("Failed to allocate space for the batch.\n");
+        exit(EXIT_FAILURE);
+    }
+    (*paths)[(*numPaths)++] = copy;
+}
+
+static bool hasExtension(const char *name, const char *extension)
+{
+    size_t length = strlen(name);
+    size_t extensionLength = strlen(extension);
+    return length > extensionLength && !strcmp(name + length - extensionLength, extension);
+}
+
+static int comparePaths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Every .bin in a directory, in name order, or every line of a list file
+static size_t readInputs(const char *inputs, char ***paths)
+{
+    size_t numPaths = 0;
+    size_t capacity = 0;
+    char path[PATH_LENGTH];
+    *paths = NULL;
+
+    DIR *dir = opendir(inputs);
+    if (dir != NULL) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (hasExtension(entry->d_name, BATCH_EXTENSION)) {
+                snprintf(path, sizeof(path), "%s/%s", inputs, entry->d_name);
+                addPath(paths, &numPaths, &capacity, path);
+            }
+        }
+        closedir(dir);
+        qsort(*paths, numPaths, sizeof(char *), comparePaths);
+        return numPaths;
+    }
+
+    FILE *list = fopen(inputs, "r");
+    if (list == NULL) {
+        perror("Could not open the batch list.");
+        exit(EXIT_FAILURE);
+    }
+    while (fgets(path, sizeof(path), list) != NULL) {
+        path[strcspn(path, "\r\n")] = '\0';
+        if (path[0] != '\0') {
+            addPath(paths, &numPaths, &capacity, path);
+        }
+    }
+    fclose(list);
+    return numPaths;
+}
+
+// name.bin becomes name.out, in the output directory if there is one
+static void outputPath(const char *input, const char *outputDir, char *path, size_t size)
+{
+    const char *name = input;
+    if (outputDir != NULL) {
+        const char *slash = strrchr(input, '/');
+        name = (slash != NULL) ? slash + 1 : input;
+    }
+    size_t length = strlen(name);
+    if (hasExtension(name, BATCH_EXTENSION)) {
+        length -= strlen(BATCH_EXTENSION);
+    }
+    if (outputDir != NULL) {
+        snprintf(path, size, "%s/%.*s%s", outputDir, (int)length, name, OUTPUT_EXTENSION);
+    } else {
+        snprintf(path, size, "%.*s%s", (int)length, name, OUTPUT_EXTENSION);
+    }
+}
+
+//
+// Workers
+//
+// Read a whole file into the worker's buffer, which is kept for the next program
+static int readImage(Worker *worker, const char *path, size_t *length)
+{
+    FILE *file = fopen(path, "rb");
+    struct stat status;
+    if (file == NULL || fstat(fileno(file), &status) != 0 || status.st_size == 0) {
+        if (file != NULL) {
+            fclose(file);
+        }
+        return EXIT_FAILURE;
+    }
+
+    if ((size_t)status.st_size > worker->imageCapacity) {
+        free(worker->image);
+        worker->imageCapacity = status.st_size;
+        worker->image = (uint8_t *)malloc(worker->imageCapacity);
+        if (worker->image == NULL) {
+            perror("Failed to allocate space for a batch image.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    *length = fread(worker->image, 1, status.st_size, file);
+    fclose(file);
+    return (*length == (size_t)status.st_size) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int loadProgram(Worker *worker, Emulator *emulator, const char *path)
+{
+    size_t length;
+    if (readImage(worker, path, &length) != EXIT_SUCCESS
+        || loadImage(emulator, worker->image, length) != EXIT_SUCCESS) {
+        fprintf(stderr, "Could not load %s\n", path);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int writeOutput(Worker *worker, Emulator *emulator, const char *path)
+{
+    char outPath[PATH_LENGTH];
+    worker->instructions += readInstructionCount(emulator);
+    outputPath(path, worker->batch->outputDir, outPath, sizeof(outPath));
+    FILE *output = fopen(outPath, "w");
+    if (output == NULL) {
+        fprintf(stderr, "Could not open output file %s\n", outPath);
+        return EXIT_FAILURE;
+    }
+    writeEmulatorState(emulator, output);
+    return (fclose(output) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int runProgram(Worker *worker, Emulator *emulator, const char *path)
+{
+    if (loadProgram(worker, emulator, path) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    if (runEmulator(emulator) != EXIT_SUCCESS) {
+        fprintf(stderr, "Failed to run %s\n", path);
+        return EXIT_FAILURE;
+    }
+    return writeOutput(worker, emulator, path);
+}
+
+// Run count programs from first in lockstep, one emulator to a lane
+static void runLaneGroup(Worker *worker, Emulator **emulators, size_t first, int count)
+{
+    Emulator *loaded[MAX_LANES];
+    const char *paths[MAX_LANES];
+    int results[MAX_LANES];
+    int numLoaded = 0;
+    for (int i = 0; i < count; i++) {
+        const char *path = worker->batch->paths[first + i];
+        if (loadProgram(worker, emulators[i], path) != EXIT_SUCCESS) {
+            worker->failed++;
+            continue;
+        }
+        loaded[numLoaded] = emulators[i];
+        paths[numLoaded++] = path;
+    }
+
+    runEmulatorLanes(loaded, numLoaded, results);
+    for (int i = 0; i < numLoaded; i++) {
+        if (results[i] != EXIT_SUCCESS) {
+            fprintf(stderr, "Failed to run %s\n", paths[i]);
+            worker->failed++;
+        } else if (writeOutput(worker, loaded[i], paths[i]) != EXIT_SUCCESS) {
+            worker->failed++;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        resetEmulator(emulators[i]);
+    }
+}
+
+static void *runWorker(void *arg)
+{
+    Worker *worker = (Worker *)arg;
+    Batch *batch = worker->batch;
+    Emulator *emulators[MAX_LANES];
+    for (int i = 0; i < batch->lanes; i++) {
+        emulators[i] = createEmulator(batch->config);
+        if (emulators[i] == NULL) {
+            fprintf(stderr, "Invalid emulator configuration.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    size_t index;
+    while ((index = atomic_fetch_add(&batch->next, batch->lanes)) < batch->numPaths) {
+        if (batch->lanes > 1) {
+            size_t remaining = batch->numPaths - index;
+            runLaneGroup(worker, emulators, index, (remaining < (size_t)batch->lanes) ? (int)remaining : batch->lanes);
+            continue;
+        }
+        if (runProgram(worker, emulators[0], batch->paths[index]) != EXIT_SUCCESS) {
+            worker->failed++;
+        }
+        resetEmulator(emulators[0]);
+    }
+
+    for (int i = 0; i < batch->lanes; i++) {
+        freeEmulator(emulators[i]);
+    }
+    freeEngineTables();
+    free(worker->image);
+    return NULL;
+}
+
+static double secondsSince(struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+//
+// Batch
+//
+// Run every input on jobs workers, lanes programs at a time each, and report the throughput to stdout
+int runBatch(const char *inputs, const char *outputDir, const struct EmulatorConfig *config, int jobs, int lanes)
+{
+    Batch batch = {.outputDir = outputDir, .config = config, .lanes = lanes};
+    batch.numPaths = readInputs(inputs, &batch.paths);
+    atomic_init(&batch.next, 0);
+    if (batch.numPaths == 0) {
+        fprintf(stderr, "No programs to run in %s\n", inputs);
+        return EXIT_FAILURE;
+    }
+    size_t groups = (batch.numPaths + lanes - 1) / lanes;
+    if ((size_t)jobs > groups) {
+        jobs = (int)groups;
+    }
+
+    Worker *workers = (Worker *)calloc(jobs, sizeof(Worker));
+    if (workers == NULL) {
+        perror("Failed to allocate space for the workers.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < jobs; i++) {
+        workers[i].batch = &batch;
+        if (pthread_create(&workers[i].thread, NULL, runWorker, &workers[i]) != 0) {
+            perror("Failed to start a worker thread.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    uint64_t failed = 0;
+    uint64_t instructions = 0;
+    for (int i = 0; i < jobs; i++) {
+        pthread_join(workers[i].thread, NULL);
+        failed += workers[i].failed;
+        instructions += workers[i].instructions;
+    }
+    double seconds = secondsSince(&start);
+
+    printf("Programs: %zu on %d workers, %lu failed\n", batch.numPaths, jobs, (unsigned long)failed);
+    printf("Time: %.3f s, %.1f programs/s, %.2f M guest instructions/s\n",
+           seconds, batch.numPaths / seconds, instructions / seconds / 1e6);
+
+    for (size_t i = 0; i < batch.numPaths; i++) {
+        free(batch.paths[i]);
+    }
+    free(batch.paths);
+    free(workers);
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,9 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "emulator.h"
+
+// Prototypes
+extern int runBatch(const char *inputs, const char *outputDir, const struct EmulatorConfig *config, int jobs, int lanes);
+
+#endif
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "constants.h"
+#include "decoders.h"
+#include "structs.h"
+#include "utils_em.h"
+
+// Decode Throughput Benchmark
+// Decodes a corpus of random valid encodings with decode(getBits) and with the
+// table-driven decodeInstruction, checks that both produce identical
+// Instructions and reports how many instructions per second each one decodes.
+// Usage: bench_decode [corpus size] [rounds]
+
+#define DEFAULT_CORPUS_SIZE (1 << 20)
+#define DEFAULT_ROUNDS 20
+#define FILL_BYTE 0xA5 // both decoders start from the same garbage
+
+// xorshift32, fixed seed so every run decodes the same corpus
+static uint32_t nextRandom(uint32_t *seed)
+{
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x;
+}
+
+// Random word with its class bits forced to a valid encoding
+static uint32_t randomEncoding(uint32_t *seed)
+{
+    uint32_t instr = nextRandom(seed);
+    switch (nextRandom(seed) % 4) {
+        case 0: { // DPI: op0 100x with opi 010 or 101
+            uint32_t opi = (nextRandom(seed) & 1) ? ARITHMETIC : WIDEMOVE;
+            instr = (instr & ~(0x3Fu << 23)) | (0x4u << 26) | (opi << 23);
+            break;
+        }
+        case 1: // DPR: op0 x101
+            instr = (instr & ~(0x7u << 25)) | (0x5u << 25);
+            break;
+        case 2: // SDT: op0 x1x0
+            instr = (instr & ~(0x5u << 25)) | (0x4u << 25);
+            break;
+        default: { // B: op0 101x with type 00, 01 or 11
+            static const uint32_t types[] = {BRANCH_UNCONDITIONAL, BRANCH_CONDITIONAL, BRANCH_REGISTER};
+            instr = (instr & ~((0x7u << 26) | (0x3u << 30))) | (0x5u << 26)
+                    | (types[nextRandom(seed) % 3] << 30);
+            break;
+        }
+    }
+    return instr;
+}
+
+static double secondsSince(struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    size_t corpusSize = (argc > 1) ? strtoul(argv[1], NULL, 10) : DEFAULT_CORPUS_SIZE;
+    int rounds = (argc > 2) ? atoi(argv[2]) : DEFAULT_ROUNDS;
+    if (corpusSize == 0 || rounds <= 0) {
+        fprintf(stderr, "Usage: bench_decode [corpus size] [rounds]\n");
+        return EXIT_FAILURE;
+    }
+
+    uint32_t *corpus = (uint32_t *)malloc(corpusSize * sizeof(uint32_t));
+    Instruction *expected = (Instruction *)malloc(corpusSize * sizeof(Instruction));
+    Instruction *actual = (Instruction *)malloc(corpusSize * sizeof(Instruction));
+    if (corpus == NULL || expected == NULL || actual == NULL) {
+        perror("Failed to allocate space for the corpus.\n");
+        return EXIT_FAILURE;
+    }
+
+    uint32_t seed = 0x2545F491;
+    for (size_t i = 0; i < corpusSize; i++) {
+        corpus[i] = randomEncoding(&seed);
+    }
+
+    // Both decoders must agree on every byte of every Instruction
+    memset(expected, FILL_BYTE, corpusSize * sizeof(Instruction));
+    memset(actual, FILL_BYTE, corpusSize * sizeof(Instruction));
+    for (size_t i = 0; i < corpusSize; i++) {
+        int expectedError = decode(&corpus[i], &expected[i], getBits);
+        int actualError = decodeInstruction(corpus[i], &actual[i]);
+        if (expectedError != actualError || memcmp(&expected[i], &actual[i], sizeof(Instruction)) != 0) {
+            fprintf(stderr, "Decoders disagree on %08x\n", corpus[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Sum a field so the decodes cannot be optimised away
+    uint64_t checksum = 0;
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < corpusSize; i++) {
+            decode(&corpus[i], &expected[i], getBits);
+            checksum += expected[i].instructionType;
+        }
+    }
+    double bitFuncSeconds = secondsSince(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < corpusSize; i++) {
+            decodeInstruction(corpus[i], &actual[i]);
+            checksum -= actual[i].instructionType;
+        }
+    }
+    double tableSeconds = secondsSince(&start);
+
+    double decodes = (double)corpusSize * rounds;
+    printf("Corpus: %zu encodings x %d rounds (checksum %lu)\n", corpusSize, rounds, (unsigned long)checksum);
+    printf("%-20s %10.2f Minstr/s %8.2f ns/instr\n", "decode (BitFunc)",
+           decodes / bitFuncSeconds / 1e6, bitFuncSeconds / decodes * 1e9);
+    printf("%-20s %10.2f Minstr/s %8.2f ns/instr\n", "decodeInstruction",
+           decodes / tableSeconds / 1e6, tableSeconds / decodes * 1e9);
+    printf("Speedup: %.2fx\n", bitFuncSeconds / tableSeconds);
+
+    free(corpus);
+    free(expected);
+    free(actual);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "block.h"
+#include "constants.h"
+#include "datatypes_em.h"
+#include "decoders.h"
+#include "execute.h"
+#include "flags.h"
+#include "specialize.h"
+#include "structs.h"
+#include "threaded.h"
+
+// Execute Handler Benchmark
+// Runs a block made of one data processing instruction repeated, once through
+// the generic threaded handler of its class and once through the variant
+// specialized for its width and opcode, checks that both leave the same
+// registers and reports the time per instruction of each.
+// Usage: bench_execute [rounds]
+
+#define DEFAULT_ROUNDS 200000
+#define BLOCK_INSTRS 64
+
+typedef struct {
+    const char *name;
+    uint32_t instr;
+} Benchmark;
+
+static const Benchmark benchmarks[] = {
+    {"add w (imm)", 0x11001441},      // add w1, w2, #5
+    {"add x (imm)", 0x91001441},      // add x1, x2, #5
+    {"adds w (imm)", 0x31001441},     // adds w1, w2, #5
+    {"adds x (imm)", 0xB1001441},     // adds x1, x2, #5
+    {"movk w", 0x72A24683},           // movk w3, #0x1234, lsl #16
+    {"movk x", 0xF2A24683},           // movk x3, #0x1234, lsl #16
+    {"add w (reg lsl)", 0x0B060CA4},  // add w4, w5, w6, lsl #3
+    {"add x (reg lsl)", 0x8B060CA4},  // add x4, x5, x6, lsl #3
+    {"and w (reg lsr)", 0x0A4608A4},  // and w4, w5, w6, lsr #2
+    {"and x (reg lsr)", 0x8A4608A4},  // and x4, x5, x6, lsr #2
+    {"madd w", 0x1B092907},           // madd w7, w8, w9, w10
+    {"madd x", 0x9B092907}};          // madd x7, x8, x9, x10
+
+#define NUM_BENCHMARKS (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static double secondsSince(struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// The guest every benchmark runs on
+static struct EmulatorState benchState;
+
+// Same starting registers for every run
+static void resetState(void)
+{
+    memset(state, 0, sizeof(*state));
+    for (int i = 0; i < NUM_OF_REGISTERS; i++) {
+        state->R[i] = 0x0123456789ABCDEFLL * (i + 1);
+    }
+}
+
+// Time rounds of the block, leaving the registers of the last round in state
+static double runBlock(Op *ops, int rounds)
+{
+    struct timespec start;
+    resetState();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int round = 0; round < rounds; round++) {
+        state->PC = 0;
+        ops[0].handler(ops);
+    }
+    return secondsSince(&start);
+}
+
+int main(int argc, char **argv)
+{
+    int rounds = (argc > 1) ? atoi(argv[1]) : DEFAULT_ROUNDS;
+    if (rounds <= 0) {
+        fprintf(stderr, "Usage: bench_execute [rounds]\n");
+        return EXIT_FAILURE;
+    }
+    state = &benchState;
+
+    Op generic[BLOCK_INSTRS + 1];
+    Op specialized[BLOCK_INSTRS + 1];
+    int64_t expectedR[NUM_OF_REGISTERS];
+    struct PSTATE expectedFlags;
+    double instrs = (double)rounds * BLOCK_INSTRS;
+
+    printf("Block: %d instructions x %d rounds\n", BLOCK_INSTRS, rounds);
+    printf("%-18s %10s %12s %8s\n", "Instruction", "generic", "specialized", "speedup");
+    for (size_t b = 0; b < NUM_BENCHMARKS; b++) {
+        Instruction instruction;
+        if (decodeInstruction(benchmarks[b].instr, &instruction) != EXIT_SUCCESS) {
+            fprintf(stderr, "Failed to decode %08x\n", benchmarks[b].instr);
+            return EXIT_FAILURE;
+        }
+        Handler handler = selectSpecializedHandler(&instruction);
+        if (handler == NULL) {
+            fprintf(stderr, "No specialized handler for %s\n", benchmarks[b].name);
+            return EXIT_FAILURE;
+        }
+
+        for (int i = 0; i < BLOCK_INSTRS; i++) {
+            generic[i] = (Op){.instruction = instruction, .handler = selectGenericHandler(&instruction)};
+            specialized[i] = (Op){.instruction = instruction, .handler = handler};
+        }
+        generic[BLOCK_INSTRS] = (Op){.handler = selectExitHandler(false)};
+        specialized[BLOCK_INSTRS] = (Op){.handler = selectExitHandler(false)};
+
+        double genericSeconds = runBlock(generic, rounds);
+        evaluateFlags();
+        memcpy(expectedR, state->R, sizeof(state->R));
+        expectedFlags = state->pstate;
+        double specializedSeconds = runBlock(specialized, rounds);
+        evaluateFlags();
+        if (memcmp(expectedR, state->R, sizeof(state->R)) != 0
+            || memcmp(&expectedFlags, &state->pstate, sizeof(state->pstate)) != 0) {
+            fprintf(stderr, "Handlers disagree on %s\n", benchmarks[b].name);
+            return EXIT_FAILURE;
+        }
+
+        printf("%-18s %7.2f ns %9.2f ns %7.2fx\n", benchmarks[b].name,
+               genericSeconds / instrs * 1e9, specializedSeconds / instrs * 1e9,
+               genericSeconds / specializedSeconds);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// Server Latency Benchmark
+// Runs one program many times, first by executing emulate once per run and
+// then through a single emulate --server over pipes, checks that both return
+// the same final state and reports the latency of a run each way, from
+// starting the request to having read the whole final state.
+// Usage: bench_server <emulate> <file.bin> [requests]
+
+#define DEFAULT_REQUESTS 1000
+#define HEADER_LENGTH 128
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} Buffer;
+
+static double secondsSince(struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void fail(const char *message)
+{
+    perror(message);
+    exit(EXIT_FAILURE);
+}
+
+static void reserve(Buffer *buffer, size_t length)
+{
+    if (length > buffer->capacity) {
+        buffer->capacity = (length > 2 * buffer->capacity) ? length : 2 * buffer->capacity;
+        buffer->data = (char *)realloc(buffer->data, buffer->capacity);
+        if (buffer->data == NULL) {
+            fail("Failed to allocate space for a response.\n");
+        }
+    }
+}
+
+static uint8_t *readFile(const char *path, size_t *length)
+{
+    FILE *file = fopen(path, "rb");
+    struct stat status;
+    if (file == NULL || fstat(fileno(file), &status) != 0 || status.st_size == 0) {
+        fail("Could not read the program.");
+    }
+    uint8_t *image = (uint8_t *)malloc(status.st_size);
+    if (image == NULL || fread(image, 1, status.st_size, file) != (size_t)status.st_size) {
+        fail("Could not read the program.");
+    }
+    fclose(file);
+    *length = status.st_size;
+    return image;
+}
+
+//
+// Executing emulate
+//
+// Run emulate on the program and collect what it writes to stdout
+static void execRequest(const char *emulate, const char *program, Buffer *output)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        fail("Could not create a pipe.");
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        fail("Could not start emulate.");
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl(emulate, emulate, program, (char *)NULL);
+        _exit(EXIT_FAILURE);
+    }
+    close(fds[1]);
+
+    output->length = 0;
+    ssize_t bytes;
+    do {
+        reserve(output, output->length + BUFSIZ);
+        bytes = read(fds[0], output->data + output->length, BUFSIZ);
+        if (bytes > 0) {
+            output->length += bytes;
+        }
+    } while (bytes > 0);
+    close(fds[0]);
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        fprintf(stderr, "emulate failed on %s\n", program);
+        exit(EXIT_FAILURE);
+    }
+}
+
+//
+// Server
+//
+typedef struct {
+    pid_t pid;
+    FILE *requests;
+    FILE *responses;
+} Server;
+
+static void startServer(Server *server, const char *emulate)
+{
+    int requestFds[2];
+    int responseFds[2];
+    if (pipe(requestFds) != 0 || pipe(responseFds) != 0) {
+        fail("Could not create a pipe.");
+    }
+    server->pid = fork();
+    if (server->pid < 0) {
+        fail("Could not start the server.");
+    }
+    if (server->pid == 0) {
+        dup2(requestFds[0], STDIN_FILENO);
+        dup2(responseFds[1], STDOUT_FILENO);
+        close(requestFds[0]);
+        close(requestFds[1]);
+        close(responseFds[0]);
+        close(responseFds[1]);
+        execl(emulate, emulate, "--server", (char *)NULL);
+        _exit(EXIT_FAILURE);
+    }
+    close(requestFds[0]);
+    close(responseFds[1]);
+    server->requests = fdopen(requestFds[1], "wb");
+    server->responses = fdopen(responseFds[0], "rb");
+    if (server->requests == NULL || server->responses == NULL) {
+        fail("Could not open the server pipes.");
+    }
+}
+
+static void serverRequest(Server *server, const uint8_t *image, size_t length, Buffer *output)
+{
+    char header[HEADER_LENGTH];
+    unsigned long instructions;
+    size_t stateLength;
+    fprintf(server->requests, "RUN %zu 0\n", length);
+    fwrite(image, 1, length, server->requests);
+    fflush(server->requests);
+
+    if (fgets(header, sizeof(header), server->responses) == NULL
+        || sscanf(header, "OK %lu %zu", &instructions, &stateLength) != 2) {
+        fprintf(stderr, "The server failed: %s", header);
+        exit(EXIT_FAILURE);
+    }
+    reserve(output, stateLength);
+    if (fread(output->data, 1, stateLength, server->responses) != stateLength) {
+        fail("The server response was cut short.");
+    }
+    output->length = stateLength;
+}
+
+static void stopServer(Server *server)
+{
+    fprintf(server->requests, "QUIT\n");
+    fclose(server->requests);
+    fclose(server->responses);
+    waitpid(server->pid, NULL, 0);
+}
+
+//
+// Statistics
+//
+static int compareLatencies(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *name, double *latencies, int requests)
+{
+    double total = 0;
+    for (int i = 0; i < requests; i++) {
+        total += latencies[i];
+    }
+    qsort(latencies, requests, sizeof(double), compareLatencies);
+    printf("%-8s mean %9.1f us   p50 %9.1f us   p99 %9.1f us\n", name, total / requests * 1e6,
+           latencies[requests / 2] * 1e6, latencies[requests * 99 / 100] * 1e6);
+}
+
+//
+// Main Program
+//
+int main(int argc, char **argv)
+{
+    if (argc < 3 || argc > 4) {
+        fprintf(stderr, "Usage: bench_server <emulate> <file.bin> [requests]\n");
+        return EXIT_FAILURE;
+    }
+    const char *emulate = argv[1];
+    const char *program = argv[2];
+    int requests = (argc > 3) ? atoi(argv[3]) : DEFAULT_REQUESTS;
+    if (requests <= 0) {
+        fprintf(stderr, "Invalid number of requests: %s\n", argv[3]);
+        return EXIT_FAILURE;
+    }
+
+    size_t length;
+    uint8_t *image = readFile(program, &length);
+    double *latencies = (double *)malloc(requests * sizeof(double));
+    Buffer execOutput = {0};
+    Buffer serverOutput = {0};
+    if (latencies == NULL) {
+        fail("Failed to allocate space for the latencies.\n");
+    }
+    struct timespec start;
+
+    for (int i = 0; i < requests; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        execRequest(emulate, program, &execOutput);
+        latencies[i] = secondsSince(&start);
+    }
+    report("exec", latencies, requests);
+
+    Server server;
+    startServer(&server, emulate);
+    for (int i = 0; i < requests; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        serverRequest(&server, image, length, &serverOutput);
+        latencies[i] = secondsSince(&start);
+    }
+    stopServer(&server);
+    report("server", latencies, requests);
+
+    bool same = execOutput.length == serverOutput.length
+                && memcmp(execOutput.data, serverOutput.data, execOutput.length) == 0;
+    if (!same) {
+        fprintf(stderr, "The server returned a different final state\n");
+    }
+
+    free(image);
+    free(latencies);
+    free(execOutput.data);
+    free(serverOutput.data);
+    return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
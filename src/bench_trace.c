@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "emulator.h"
+
+// Trace Overhead Benchmark
+// Runs a loop of adds, a store, a load and a conditional branch, first on the
+// cached reference engine and then again recording a trace to a temporary
+// file, checks that both runs end with the same registers and reports the
+// guest MIPS of each and the trace bytes per instruction.
+// Usage: bench_trace [iterations]
+
+#define DEFAULT_ITERATIONS 4000000
+#define LOOP_INSTRS 8
+#define MOVZ_X2 0xD2800002 // movz x2, #imm16
+#define MOVK_X2 0xF2A00002 // movk x2, #imm16, lsl #16
+#define IMM16_SHIFT 5
+#define NUM_REGISTERS_CHECKED 8 // X0-X7, all the loop writes
+
+static const uint32_t workload[] = {
+    0xD2800001, // movz x1, #0
+    MOVZ_X2,    // movz x2, #iterations
+    MOVK_X2,    // movk x2, #iterations >> 16, lsl #16
+    0xD2840003, // movz x3, #0x2000
+    0x91000C21, // loop: add x1, x1, #3
+    0xD28000E4, // movz x4, #7
+    0xF9000461, // str x1, [x3, #8]
+    0xF9400465, // ldr x5, [x3, #8]
+    0x910004A6, // add x6, x5, #1
+    0xD10008C7, // sub x7, x6, #2
+    0xF1000442, // subs x2, x2, #1
+    0x54FFFF21, // b.ne loop
+    0x8A000000}; // halt
+
+#define WORKLOAD_INSTRS (sizeof(workload) / sizeof(workload[0]))
+
+static double secondsSince(struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void loadWorkload(Emulator *emulator, uint32_t iterations)
+{
+    uint8_t image[WORKLOAD_INSTRS * 4];
+    for (size_t i = 0; i < WORKLOAD_INSTRS; i++) {
+        uint32_t word = workload[i];
+        if (i == 1 || i == 2) {
+            word |= ((i == 1 ? iterations : iterations >> 16) & 0xFFFF) << IMM16_SHIFT;
+        }
+        for (int byte = 0; byte < 4; byte++) {
+            image[i * 4 + byte] = (uint8_t)(word >> (8 * byte));
+        }
+    }
+    resetEmulator(emulator);
+    loadImage(emulator, image, sizeof(image));
+}
+
+static void report(const char *name, Emulator *emulator, double seconds)
+{
+    printf("%-9s %8.3f s %8.1f MIPS", name, seconds, readInstructionCount(emulator) / seconds / 1e6);
+}
+
+//
+// Main Program
+//
+int main(int argc, char **argv)
+{
+    if (argc > 2) {
+        fprintf(stderr, "Usage: bench_trace [iterations]\n");
+        return EXIT_FAILURE;
+    }
+    long iterations = (argc > 1) ? atol(argv[1]) : DEFAULT_ITERATIONS;
+    if (iterations <= 0 || iterations > UINT32_MAX) {
+        fprintf(stderr, "Invalid number of iterations: %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    struct EmulatorConfig config;
+    initializeConfig(&config);
+    config.cache = true;
+    config.flagLiveness = false;
+    Emulator *emulator = createEmulator(&config);
+    FILE *trace = tmpfile();
+    if (emulator == NULL || trace == NULL) {
+        perror("Could not set up the benchmark.\n");
+        return EXIT_FAILURE;
+    }
+    printf("Workload: %d instruction loop x %ld iterations\n", LOOP_INSTRS, iterations);
+    struct timespec start;
+
+    loadWorkload(emulator, (uint32_t)iterations);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int result = runEmulator(emulator);
+    report("untraced", emulator, secondsSince(&start));
+    printf("\n");
+    int64_t untraced[NUM_REGISTERS_CHECKED];
+    for (int reg = 0; reg < NUM_REGISTERS_CHECKED; reg++) {
+        untraced[reg] = readRegister(emulator, reg);
+    }
+
+    loadWorkload(emulator, (uint32_t)iterations);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    result |= traceEmulator(emulator, trace);
+    report("traced", emulator, secondsSince(&start));
+    printf(" %8.1f bytes/instruction\n", (double)ftell(trace) / readInstructionCount(emulator));
+
+    bool same = result == EXIT_SUCCESS;
+    for (int reg = 0; reg < NUM_REGISTERS_CHECKED; reg++) {
+        same = same && readRegister(emulator, reg) == untraced[reg];
+    }
+    if (!same) {
+        fprintf(stderr, "The traced run ended differently\n");
+    }
+
+    fclose(trace);
+    freeEmulator(emulator);
+    freeEngineTables();
+    return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "block.h"
+#include "constants.h"
+#include "datatypes_em.h"
+#include "decoders.h"
+#include "fusion.h"
+#include "liveness.h"
+#include "pipeline.h"
+#include "threaded.h"
+#include "utils_em.h"
+
+#define BLOCK_ENTRIES (MEMORY_SIZE / INSTR_BYTES)
+
+_Thread_local bool blocksModified = false;
+
+static _Thread_local Block **blocks = NULL;    // block starting at each word, indexed by addr / 4
+static _Thread_local bool *codeWords = NULL;   // words covered by at least one live block
+static _Thread_local Block *liveBlocks = NULL; // every allocated block
+
+// The tables stay allocated between runs on a thread, flushBlocks leaves them empty
+void initializeBlocks(void)
+{
+    if (blocks != NULL) {
+        return;
+    }
+    blocks = (Block **)calloc(BLOCK_ENTRIES, sizeof(Block *));
+    codeWords = (bool *)calloc(BLOCK_ENTRIES, sizeof(bool));
+    if (blocks == NULL || codeWords == NULL) {
+        perror("Failed to allocate space for the block cache.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void freeBlocks(void)
+{
+    flushBlocks();
+    free(blocks);
+    free(codeWords);
+    blocks = NULL;
+    codeWords = NULL;
+}
+
+// Drop every block, they are rebuilt from memory on their next lookup
+void flushBlocks(void)
+{
+    while (liveBlocks != NULL) {
+        Block *block = liveBlocks;
+        liveBlocks = block->next;
+
+        uint32_t first = block->start / INSTR_BYTES;
+        for (uint32_t word = first; word < first + block->length + block->halts; word++) {
+            codeWords[word] = false;
+        }
+        blocks[first] = NULL;
+        free(block);
+    }
+    blocksModified = false;
+}
+
+// Decode the straight-line code starting at addr
+static int buildBlock(uint32_t addr, Block **block)
+{
+    Op ops[MAX_BLOCK_INSTRS];
+    int length = 0;
+    bool halts = false;
+    int deadFlags = 0;
+
+    for (uint32_t pc = addr; length < MAX_BLOCK_INSTRS && pc < MEMORY_SIZE; pc += INSTR_BYTES) {
+        uint32_t instr = fetch(pc);
+        if (instr == HALT_INSTR) {
+            halts = true;
+            break;
+        }
+        if (decodeInstructionQuietly(instr, &(ops[length].instruction)) != EXIT_SUCCESS) {
+            if (length == 0) {
+                decodeInstruction(instr, &(ops[length].instruction)); // report the word execution reached
+                return EXIT_FAILURE;
+            }
+            // Only fail once execution actually reaches the bad word
+            break;
+        }
+        deadFlags += eliminateDeadFlags(pc, &(ops[length].instruction));
+        ops[length].handler = selectHandler(&(ops[length].instruction));
+        ops[length].fused = 0;
+        ops[length].value = 0;
+        if (ops[length++].instruction.instructionType == isB) {
+            break;
+        }
+    }
+
+    if (fusionEnabled) {
+        fuseOps(ops, length);
+    }
+
+    Block *b = (Block *)malloc(sizeof(Block) + (length + 1) * sizeof(Op));
+    if (b == NULL) {
+        perror("Failed to allocate space for a block.\n");
+        exit(EXIT_FAILURE);
+    }
+    b->start = addr;
+    b->length = length;
+    b->halts = halts;
+    b->deadFlags = deadFlags;
+    b->code = NULL;
+    for (int i = 0; i < length; i++) {
+        b->ops[i] = ops[i];
+    }
+    b->ops[length].handler = selectExitHandler(halts);
+    b->ops[length].fused = 0;
+    b->ops[length].value = 0;
+
+    // Remember which words the block was built from
+    for (uint32_t word = addr / INSTR_BYTES; word < addr / INSTR_BYTES + length + halts; word++) {
+        codeWords[word] = true;
+    }
+    b->next = liveBlocks;
+    liveBlocks = b;
+
+    *block = b;
+    return EXIT_SUCCESS;
+}
+
+// Only the first MEMORY_SIZE bytes are indexed by the decoded caches
+bool inCodeWindow(uint64_t addr)
+{
+    if (addr >= MEMORY_SIZE) {
+        fprintf(stderr, "PC 0x%08lx is outside the first %d bytes, where code can run\n",
+                (unsigned long)addr, MEMORY_SIZE);
+        return false;
+    }
+    return true;
+}
+
+// Find the block starting at addr, building it on first use
+int lookupBlock(uint64_t addr, Block **block)
+{
+    if (!inCodeWindow(addr)) {
+        return EXIT_FAILURE;
+    }
+    Block **slot = &blocks[addr / INSTR_BYTES];
+    if (*slot == NULL && buildBlock(addr, slot) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    *block = *slot;
+    return EXIT_SUCCESS;
+}
+
+// Flag a store to [addr, addr + bytes) that overwrites code of a live block
+void invalidateBlocks(uint32_t addr, int bytes)
+{
+    if (codeWords == NULL) {
+        return;
+    }
+    for (uint32_t word = addr / INSTR_BYTES; word <= (addr + bytes - 1) / INSTR_BYTES && word < BLOCK_ENTRIES; word++) {
+        blocksModified |= codeWords[word];
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "structs.h"
+
+#define MAX_BLOCK_INSTRS 64
+
+// Ways a block can finish
+enum BlockExit {
+    BLOCK_NEXT,  // PC holds the address of the next block
+    BLOCK_HALT,  // PC holds the address of the halt instruction
+    BLOCK_ERROR, // an instruction failed to execute
+};
+
+typedef struct Op Op;
+
+// Handlers run their own op and pass control straight to the next one
+typedef enum BlockExit (*Handler)(Op *op);
+
+// Handlers pass control with a tail call, which the compiler is made to keep
+// where it supports musttail and otherwise keeps at -O2 (-foptimize-sibling-calls)
+#if defined(__has_attribute)
+#if __has_attribute(musttail)
+#define TAIL_CALL __attribute__((musttail))
+#endif
+#endif
+#ifndef TAIL_CALL
+#define TAIL_CALL
+#endif
+
+struct Op {
+    Handler handler;
+    Instruction instruction;
+    int fused;     // following ops folded into this one, skipped by its handler
+    int64_t value; // constant precomputed by the fusion stage
+};
+
+// Basic Block
+// Straight-line guest code ending at a branch, the halt instruction or MAX_BLOCK_INSTRS
+typedef struct Block {
+    uint32_t start;     // address of the first instruction
+    int length;         // number of guest instructions, excluding the halt
+    bool halts;         // block ends at the halt instruction
+    int deadFlags;      // ops whose flag update the flag liveness analysis eliminated
+    struct Block *next; // all live blocks, for flushing
+    void *code;         // native translation, NULL until compiled
+    Op ops[];           // length ops followed by the exit op
+} Block;
+
+// Set by a store into the code of a live block, blocks are flushed at the next boundary
+extern _Thread_local bool blocksModified;
+
+// Prototypes
+extern void initializeBlocks(void);
+extern void freeBlocks(void);
+extern void flushBlocks(void);
+extern bool inCodeWindow(uint64_t addr);
+extern int lookupBlock(uint64_t addr, Block **block);
+extern void invalidateBlocks(uint32_t addr, int bytes);
+
+#endif
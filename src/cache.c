@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "block.h"
+#include "cache.h"
+#include "constants.h"
+#include "datatypes_em.h"
+#include "decoders.h"
+#include "liveness.h"
+#include "pipeline.h"
+#include "utils_em.h"
+
+#define CACHE_ENTRIES (MEMORY_SIZE / INSTR_BYTES)
+
+// Decoded entries indexed by PC / 4, NULL while the cache is disabled
+static _Thread_local CacheEntry *cache = NULL;
+static _Thread_local bool cacheEnabled = false;
+// Words decoded since the cache was last flushed, so a flush only clears those
+static _Thread_local uint32_t *decodedWords = NULL;
+static _Thread_local size_t numDecoded = 0;
+static _Thread_local size_t decodedCapacity = 0;
+
+// The table stays allocated between runs on a thread, flushCache leaves it empty
+void initializeCache(void)
+{
+    cacheEnabled = true;
+    if (cache != NULL) {
+        return;
+    }
+    // calloc leaves untouched entries on zero pages, so only executed code costs memory
+    cache = (CacheEntry *)calloc(CACHE_ENTRIES, sizeof(CacheEntry));
+    if (cache == NULL) {
+        perror("Failed to allocate space for the predecode cache.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Empty the cache and disable it until the next run
+void finishCache(void)
+{
+    flushCache();
+    cacheEnabled = false;
+}
+
+void freeCache(void)
+{
+    free(cache);
+    free(decodedWords);
+    cache = NULL;
+    cacheEnabled = false;
+    decodedWords = NULL;
+    numDecoded = 0;
+    decodedCapacity = 0;
+}
+
+static void recordDecoded(uint32_t word)
+{
+    if (numDecoded == decodedCapacity) {
+        decodedCapacity = (decodedCapacity == 0) ? 1024 : decodedCapacity * 2;
+        decodedWords = (uint32_t *)realloc(decodedWords, decodedCapacity * sizeof(uint32_t));
+        if (decodedWords == NULL) {
+            perror("Failed to allocate space for the predecode cache.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    decodedWords[numDecoded++] = word;
+}
+
+// Find the decoded instruction at addr, decoding it if this is the first visit
+int lookupCache(uint64_t addr, CacheEntry **entry)
+{
+    if (!inCodeWindow(addr)) {
+        return EXIT_FAILURE;
+    }
+    CacheEntry *e = &cache[addr / INSTR_BYTES];
+    if (!e->valid) {
+        if (!e->recorded) {
+            recordDecoded(addr / INSTR_BYTES);
+            e->recorded = true;
+        }
+        uint32_t instr = fetch(addr);
+        e->halt = (instr == HALT_INSTR);
+        if (!e->halt && decodeInstruction(instr, &(e->instruction)) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+        e->deadFlags = !e->halt && eliminateDeadFlags(addr, &(e->instruction));
+        e->valid = true;
+    }
+    *entry = e;
+    return EXIT_SUCCESS;
+}
+
+// Drop the entries of every word overlapping [addr, addr + bytes)
+void invalidateCache(uint32_t addr, int bytes)
+{
+    if (!cacheEnabled) {
+        return;
+    }
+    for (uint32_t word = addr / INSTR_BYTES; word <= (addr + bytes - 1) / INSTR_BYTES && word < CACHE_ENTRIES; word++) {
+        cache[word].valid = false;
+    }
+}
+
+// Drop every entry
+void flushCache(void)
+{
+    for (size_t i = 0; i < numDecoded; i++) {
+        memset(&cache[decodedWords[i]], 0, sizeof(CacheEntry));
+    }
+    numDecoded = 0;
+}
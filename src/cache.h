@@ -0,0 +1,27 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "structs.h"
+
+// Predecode Cache
+// One entry per instruction word, decoded on first execution of that word
+typedef struct {
+    bool valid; // entry has been decoded since the last write to its word
+    bool halt;  // word is the halt instruction
+    bool deadFlags; // flag update eliminated by the flag liveness analysis
+    bool recorded;  // listed for clearing by the next flush
+    Instruction instruction;
+} CacheEntry;
+
+// Prototypes
+extern void initializeCache(void);
+extern void finishCache(void);
+extern void freeCache(void);
+extern int lookupCache(uint64_t addr, CacheEntry **entry);
+extern void invalidateCache(uint32_t addr, int bytes);
+extern void flushCache(void);
+
+#endif
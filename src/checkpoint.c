@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "checkpoint.h"
+#include "datatypes_em.h"
+#include "flags.h"
+#include "memory_em.h"
+
+// Checkpoints
+// A recording keeps checkpoints of the guest in state every interval
+// instructions, so going back to any earlier instruction costs restoring the
+// last checkpoint before it and running at most an interval forward again.
+// A checkpoint holds the registers and a copy of every non-zero page, but a
+// page that has not changed since the previous checkpoint shares its copy, so
+// each checkpoint only adds the pages written since. Whenever the copies and
+// page lists outgrow the budget, every other checkpoint is dropped and the
+// interval doubles, which halves their number while going back still costs at
+// most an interval. The first checkpoint always stays.
+
+struct PageCopy {
+    int references; // checkpoints sharing the copy
+    uint8_t bytes[GUEST_PAGE_SIZE];
+};
+
+typedef struct {
+    uint64_t page;
+    struct PageCopy *copy;
+} CheckpointPage;
+
+typedef struct {
+    uint64_t instructions;
+    int64_t R[NUM_OF_REGISTERS];
+    int64_t ZR;
+    int64_t PC;
+    int64_t SP;
+    struct PSTATE pstate;
+    CheckpointPage *pages; // the non-zero pages in increasing order
+    size_t numPages;
+} Checkpoint;
+
+struct Recording {
+    uint64_t interval;
+    uint64_t budget;
+    uint64_t used;           // bytes of page copies and page lists
+    Checkpoint *checkpoints; // in increasing instruction order
+    size_t numCheckpoints;
+    size_t capacity;
+};
+
+static void releaseCheckpoint(Recording *recording, Checkpoint *checkpoint)
+{
+    for (size_t i = 0; i < checkpoint->numPages; i++) {
+        struct PageCopy *copy = checkpoint->pages[i].copy;
+        if (--copy->references == 0) {
+            free(copy);
+            recording->used -= sizeof(struct PageCopy);
+        }
+    }
+    recording->used -= checkpoint->numPages * sizeof(CheckpointPage);
+    free(checkpoint->pages);
+}
+
+// Copy a page, or share the copy of the previous checkpoint if it still holds the same bytes
+static struct PageCopy *copyPage(Recording *recording, const uint8_t *host, struct PageCopy *previous)
+{
+    if (previous != NULL && memcmp(previous->bytes, host, GUEST_PAGE_SIZE) == 0) {
+        previous->references++;
+        return previous;
+    }
+    struct PageCopy *copy = (struct PageCopy *)malloc(sizeof(struct PageCopy));
+    if (copy == NULL) {
+        perror("Failed to allocate space for a checkpoint.\n");
+        exit(EXIT_FAILURE);
+    }
+    copy->references = 1;
+    memcpy(copy->bytes, host, GUEST_PAGE_SIZE);
+    recording->used += sizeof(struct PageCopy);
+    return copy;
+}
+
+// Drop every other checkpoint after the first and double the interval
+static void thinCheckpoints(Recording *recording)
+{
+    uint64_t start = recording->checkpoints[0].instructions;
+    size_t kept = 0;
+    for (size_t i = 0; i < recording->numCheckpoints; i++) {
+        Checkpoint *checkpoint = &recording->checkpoints[i];
+        if ((checkpoint->instructions - start) / recording->interval % 2 == 0) {
+            recording->checkpoints[kept++] = *checkpoint;
+        } else {
+            releaseCheckpoint(recording, checkpoint);
+        }
+    }
+    recording->numCheckpoints = kept;
+    recording->interval *= 2;
+}
+
+// Record the guest in state as it is now, after the last checkpoint
+void takeCheckpoint(Recording *recording)
+{
+    if (recording->numCheckpoints == recording->capacity) {
+        recording->capacity = (recording->capacity == 0) ? 16 : recording->capacity * 2;
+        recording->checkpoints = (Checkpoint *)realloc(recording->checkpoints,
+                                                       recording->capacity * sizeof(Checkpoint));
+        if (recording->checkpoints == NULL) {
+            perror("Failed to allocate space for a checkpoint.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    const Checkpoint *previous = (recording->numCheckpoints > 0)
+                                     ? &recording->checkpoints[recording->numCheckpoints - 1]
+                                     : NULL;
+    Checkpoint *checkpoint = &recording->checkpoints[recording->numCheckpoints];
+
+    evaluateFlags();
+    *checkpoint = (Checkpoint){
+        .instructions = state->instructions,
+        .ZR = state->ZR,
+        .PC = state->PC,
+        .SP = state->SP,
+        .pstate = state->pstate,
+    };
+    memcpy(checkpoint->R, state->R, sizeof(state->R));
+
+    // Both page lists are in increasing order, so the previous copy of each page is found in one pass
+    struct DirtyPage *pages;
+    size_t numDirty = sortDirtyPages(&pages);
+    size_t match = 0;
+    checkpoint->pages = (CheckpointPage *)malloc((numDirty + 1) * sizeof(CheckpointPage));
+    if (checkpoint->pages == NULL) {
+        perror("Failed to allocate space for a checkpoint.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < numDirty; i++) {
+        while (previous != NULL && match < previous->numPages && previous->pages[match].page < pages[i].page) {
+            match++;
+        }
+        struct PageCopy *previousCopy = (previous != NULL && match < previous->numPages
+                                         && previous->pages[match].page == pages[i].page)
+                                            ? previous->pages[match].copy
+                                            : NULL;
+        if (previousCopy == NULL && isZeroPage(pages[i].host)) {
+            continue;
+        }
+        checkpoint->pages[checkpoint->numPages++] = (CheckpointPage){
+            .page = pages[i].page,
+            .copy = copyPage(recording, pages[i].host, previousCopy),
+        };
+    }
+    recording->used += checkpoint->numPages * sizeof(CheckpointPage);
+    recording->numCheckpoints++;
+
+    while (recording->used > recording->budget && recording->numCheckpoints > 1) {
+        thinCheckpoints(recording);
+    }
+}
+
+// A recording of the guest in state, with its first checkpoint taken now
+Recording *createRecording(uint64_t interval, uint64_t budget)
+{
+    Recording *recording = (Recording *)calloc(1, sizeof(Recording));
+    if (recording == NULL) {
+        perror("Failed to allocate space for the recording.\n");
+        exit(EXIT_FAILURE);
+    }
+    recording->interval = interval;
+    recording->budget = budget;
+    takeCheckpoint(recording);
+    return recording;
+}
+
+void freeRecording(Recording *recording)
+{
+    if (recording == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < recording->numCheckpoints; i++) {
+        releaseCheckpoint(recording, &recording->checkpoints[i]);
+    }
+    free(recording->checkpoints);
+    free(recording);
+}
+
+// Instruction count at which the next checkpoint is due
+uint64_t nextCheckpoint(const Recording *recording)
+{
+    return recording->checkpoints[recording->numCheckpoints - 1].instructions + recording->interval;
+}
+
+// Put the guest in state back to the last checkpoint at or before count,
+// failing if count is before the recording started
+int restoreCheckpoint(Recording *recording, uint64_t count)
+{
+    size_t low = 0;
+    size_t high = recording->numCheckpoints;
+    if (count < recording->checkpoints[0].instructions) {
+        return EXIT_FAILURE;
+    }
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+        if (recording->checkpoints[middle].instructions <= count) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+
+    const Checkpoint *checkpoint = &recording->checkpoints[low];
+    resetMemory();
+    for (size_t i = 0; i < checkpoint->numPages; i++) {
+        copyToMemory(checkpoint->pages[i].page << GUEST_PAGE_SHIFT, checkpoint->pages[i].copy->bytes,
+                     GUEST_PAGE_SIZE);
+    }
+    memcpy(state->R, checkpoint->R, sizeof(state->R));
+    state->ZR = checkpoint->ZR;
+    state->PC = checkpoint->PC;
+    state->SP = checkpoint->SP;
+    state->instructions = checkpoint->instructions;
+    state->pstate = checkpoint->pstate;
+    state->pendingFlags.op = FLAGS_EVALUATED;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,15 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+
+typedef struct Recording Recording;
+
+// Prototypes
+extern Recording *createRecording(uint64_t interval, uint64_t budget);
+extern void freeRecording(Recording *recording);
+extern void takeCheckpoint(Recording *recording);
+extern uint64_t nextCheckpoint(const Recording *recording);
+extern int restoreCheckpoint(Recording *recording, uint64_t count);
+
+#endif
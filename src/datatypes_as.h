@@ -1,3 +1,8 @@
+#ifndef DATATYPES_AS_H
+#define DATATYPES_AS_H
+
+#include <stdint.h>
+
 #include "onepass.h"
 
 #define SIZE_DP (sizeof(dataProcessing) / sizeof(char *))
@@ -14,10 +19,13 @@
 
 #define SIZE_DPI1 (sizeof(dpiOnes) / sizeof(int))
 #define SIZE_DPR1 (sizeof(dprOnes) / sizeof(int))
+#define SIZE_MUL1 (sizeof(mulOnes) / sizeof(int))
 #define SIZE_LS1 (sizeof(lsOnes) / sizeof(int))
 #define SIZE_SDT1 (sizeof(sdtOnes) / sizeof(int))
 #define SIZE_SDTREG1 (sizeof(sdtRegOnes) / sizeof(int))
+#define SIZE_SDTINDEX1 (sizeof(sdtIndexOnes) / sizeof(int))
 #define SIZE_B1 (sizeof(bOnes) / sizeof(int))
+#define SIZE_BR1 (sizeof(brOnes) / sizeof(int))
 
 #define MAX_INSTR (2 * 1024 * 1024) // 2MB
 
@@ -27,34 +35,32 @@ extern uint32_t binaryInstr[MAX_INSTR];
 extern int PC;
 
 // Mnemonic keywords
-const char *dataProcessing[] = {
+static const char *const dataProcessing[] = {
     "add", "adds", "sub", "subs",
     "and", "ands", "bic", "bics", "eor", "orr", "eon", "orn",
     "movk", "movn", "movz",
     "madd", "msub"};
-const char *loadAndStore[] = {
+static const char *const loadAndStore[] = {
     "str", "ldr"};
-const char *branching[] = {
+static const char *const branching[] = {
     "b", "br", "b.eq", "b.ne", "b.ge", "b.lt", "b.gt", "b.le", "b.al"};
-const char *aliases[] = {
-    "cmp", "cmn", "neg", "negs", "tst", "mvn", "mov", "mul", "mneg"};
-const char *aliasesName[] = {
-    "subs", "adds", "sub", "subs", "ands", "orn", "orr", "madd", "msub"};
+static const char *const aliases[] = {
+    "cmp", "cmn", "neg", "negs", "tst", "mvn", "mov", "mul", "mneg", "halt"};
+static const char *const aliasesName[] = {
+    "subs", "adds", "sub", "subs", "ands", "orn", "orr", "madd", "msub", "and"};
 
-const char *directive[] = {
+static const char *const directive[] = {
     ".int"};
-const char *shifts[] = {
+static const char *const shifts[] = {
     "lsl", "lsr", "asr", "ror"};
 
-const char *arithmetics[] = {
+static const char *const arithmetics[] = {
     "add", "adds", "sub", "subs"};
-const char *logical[] = {
+static const char *const logical[] = {
     "and", "bic", "orr", "orn", "eor", "eon", "ands", "bics"};
-const char *wideMoves[] = {
+static const char *const wideMoves[] = {
     "movn", "", "movz", "movk"};
-const char *multiply[] = {
-    "madd", "msub"};
-const char *multiply[] = {
+static const char *const multiply[] = {
     "madd", "msub"};
 
 // Specific 1 patterns in instructions
@@ -63,8 +69,11 @@ static const int dprOnes[] = {25, 27};
 static const int lsOnes[] = {27, 28};
 static const int bOnes[] = {26, 28};
 
+static const int mulOnes[] = {24};
 static const int sdtOnes[] = {29};
 static const int sdtRegOnes[] = {11, 13, 14};
+static const int sdtIndexOnes[] = {10};
+static const int brOnes[] = {16, 17, 18, 19, 20, 25};
 
 
 // Type declarations
@@ -86,4 +95,16 @@ enum dpType {
 struct symbolTable {
     char label[MAX_TOKEN_LENGTH];
     int address;
-};
\ No newline at end of file
+};
+
+// A line of assembly broken into its mnemonic and operands
+typedef struct
+{
+    enum type type;
+    int numTokens;
+    char *tokens[NUM_TOKENS];
+    char instrname[MAX_TOKEN_LENGTH];
+    char buff[BUFFER_LENGTH];
+} InstructionParse;
+
+#endif
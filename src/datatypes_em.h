@@ -1,6 +1,17 @@
+#ifndef DATATYPES_EM_H
+#define DATATYPES_EM_H
+
+#include <stdbool.h>
 #include <stdint.h>
 
-#define MEMORY_SIZE (2 * 1024 * 1024) // 2MB
+#define MEMORY_SIZE (2 * 1024 * 1024) // 2MB, default address space and the code window of the decoded caches
+#define GUEST_PAGE_SHIFT 12
+#define GUEST_PAGE_SIZE (1ULL << GUEST_PAGE_SHIFT) // 4KB
+#define PAGE_TABLE_BITS 9                          // each level of the page table holds 512 entries
+#define PAGE_TABLE_LEVELS 3
+#define MAX_MEMORY_SIZE (1ULL << (GUEST_PAGE_SHIFT + PAGE_TABLE_LEVELS * PAGE_TABLE_BITS)) // 512GB
+#define TLB_ENTRIES 256
+#define CORE_ID_ADDRESS 0xFFFFFFFFFFFFFFF8ULL // read-only doubleword holding the number of the core reading it
 #define BYTE_SIZE 8
 #define MODE32 32
 #define MODE64 64
@@ -23,12 +34,43 @@ struct EmulatorState {
     int64_t ZR; // Zero Register
     int64_t PC; // Program Counter
     int64_t SP; // Stack Pointer
+    uint64_t instructions; // Executed since the last reset, a block counts in full once entered
+    uint64_t instructionLimit; // Runs stop before the next instruction or block once instructions reaches it, 0 for none
+    uint64_t coreId; // Read at CORE_ID_ADDRESS, 0 but for the other cores of an SMP guest
     struct PSTATE { // Processor State
         bool N; // Negative flag
         bool Z; // Zero flag
         bool C; // Carry flag
         bool V; // oVerflow flag
     } pstate;
-    uint8_t mem[MEMORY_SIZE]; // Memory
+    struct PendingFlags { // Last flag-setting operation, pstate is stale until it is evaluated
+        uint8_t op; // FLAGS_EVALUATED once pstate is up to date
+        bool sf;
+        int64_t a;
+        int64_t b;
+    } pendingFlags;
+    struct GuestMemory { // Memory, pages are allocated on first store
+        uint64_t size;   // bytes in the address space, a multiple of GUEST_PAGE_SIZE
+        void **root;     // first level of the page table
+        struct DirtyPage {
+            uint64_t page;
+            uint8_t *host;
+        } *dirty;        // every page in the page table, each loaded or written since the last reset
+        size_t numDirty;
+        size_t dirtyCapacity;
+        uint8_t **spare; // zeroed pages kept by a reset for reuse
+        size_t numSpare;
+        size_t spareCapacity;
+        uint8_t *image;  // private mapping of the loaded file, its pages sit in the table in place
+        size_t imageLength;
+        struct SharedMemory *shared; // set while the cores of an SMP guest share the table, pages are allocated through it
+        struct TlbEntry {
+            uint64_t page; // guest address >> GUEST_PAGE_SHIFT, UINT64_MAX when empty
+            uint8_t *host;
+        } tlb[TLB_ENTRIES];
+    } memory;
 };
-extern struct EmulatorState state;
\ No newline at end of file
+// State of the guest running on this thread, emulator.c points it at a context for each call
+extern _Thread_local struct EmulatorState *state;
+
+#endif
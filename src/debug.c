@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "debug.h"
+#include "emulator.h"
+#include "io.h"
+
+// Time-Travel Debugger
+// Records a run of the program, see startRecording, and moves it to any
+// instruction the commands on stdin ask for, one command per line:
+//   seek <n>          to just after instruction n, 0 being the start
+//   step [n]          n instructions forward, 1 by default
+//   reverse-step [n]  n instructions back, 1 by default
+//   registers         the registers and flags in the format of the .out files
+//   memory <addr> [n] the n doublewords from addr, 1 by default
+//   quit, or the end of the input, ends the session
+// Moves answer with where they stopped, ending in " halted" if the program
+// halted first:
+//   at <instructions> PC <pc>
+// Commands that cannot be carried out answer ERROR <reason>. Numbers are
+// decimal, or hexadecimal with a 0x prefix.
+
+#define COMMAND_LENGTH 128
+#define DOUBLEWORD_BYTES 8
+#define MAX_DOUBLEWORDS 4096
+
+static void writePosition(Emulator *emulator, FILE *out, bool halted)
+{
+    fprintf(out, "at %lu PC 0x%08lx%s\n", (unsigned long)readInstructionCount(emulator),
+            (unsigned long)readRegister(emulator, REGISTER_PC), halted ? " halted" : "");
+}
+
+static void seek(Emulator *emulator, FILE *out, uint64_t count)
+{
+    bool halted;
+    if (seekEmulator(emulator, count, &halted) != EXIT_SUCCESS) {
+        fprintf(out, "ERROR stopped at %lu\n", (unsigned long)readInstructionCount(emulator));
+        return;
+    }
+    writePosition(emulator, out, halted);
+}
+
+static void writeDoublewords(Emulator *emulator, FILE *out, uint64_t addr, uint64_t count)
+{
+    for (uint64_t i = 0; i < count; i++) {
+        uint8_t bytes[DOUBLEWORD_BYTES];
+        uint64_t at = addr + i * DOUBLEWORD_BYTES;
+        if (readGuestMemory(emulator, at, bytes, sizeof(bytes)) != EXIT_SUCCESS) {
+            fprintf(out, "ERROR 0x%08lx is outside memory\n", (unsigned long)at);
+            return;
+        }
+        uint64_t value = 0;
+        for (int byte = DOUBLEWORD_BYTES - 1; byte >= 0; byte--) {
+            value = value << 8 | bytes[byte];
+        }
+        fprintf(out, "0x%08lx : %016lx\n", (unsigned long)at, (unsigned long)value);
+    }
+}
+
+// Whether text is a whole number, decimal or with a 0x prefix hexadecimal
+static bool parseNumber(const char *text, uint64_t *number)
+{
+    char *end;
+    *number = strtoull(text, &end, 0);
+    return *text != '\0' && *text != '-' && *end == '\0';
+}
+
+// Answer commands until quit or the end of the input
+static void debug(Emulator *emulator, FILE *in, FILE *out)
+{
+    char command[COMMAND_LENGTH];
+    while (fgets(command, sizeof(command), in) != NULL) {
+        char name[COMMAND_LENGTH];
+        char arguments[2][COMMAND_LENGTH];
+        uint64_t numbers[2] = {1, 1};
+        int count = sscanf(command, "%127s %127s %127s", name, arguments[0], arguments[1]) - 1;
+        if (count < 0) {
+            continue;
+        }
+        bool valid = true;
+        for (int i = 0; i < count; i++) {
+            valid = valid && parseNumber(arguments[i], &numbers[i]);
+        }
+
+        uint64_t position = readInstructionCount(emulator);
+        if (!strcmp(name, "quit")) {
+            break;
+        } else if (!valid) {
+            fprintf(out, "ERROR malformed number\n");
+        } else if (!strcmp(name, "seek") && count == 1) {
+            seek(emulator, out, numbers[0]);
+        } else if (!strcmp(name, "step") && count <= 1) {
+            seek(emulator, out, (numbers[0] < UINT64_MAX - position) ? position + numbers[0] : UINT64_MAX);
+        } else if (!strcmp(name, "reverse-step") && count <= 1) {
+            seek(emulator, out, (numbers[0] < position) ? position - numbers[0] : 0);
+        } else if (!strcmp(name, "registers") && count == 0) {
+            writeEmulatorRegisters(emulator, out);
+        } else if (!strcmp(name, "memory") && count >= 1 && numbers[1] <= MAX_DOUBLEWORDS) {
+            writeDoublewords(emulator, out, numbers[0], numbers[1]);
+        } else {
+            fprintf(out, "ERROR unknown command\n");
+        }
+        fflush(out);
+    }
+}
+
+//
+// Debugger
+//
+// Record the program in inputFile with a checkpoint every interval instructions, within budget bytes
+int runDebugger(const char *inputFile, const struct EmulatorConfig *config, uint64_t interval, uint64_t budget)
+{
+    Emulator *emulator = createEmulator(config);
+    if (emulator == NULL) {
+        fprintf(stderr, "Invalid emulator configuration.\n");
+        return EXIT_FAILURE;
+    }
+    FILE *input = loadInputFile(inputFile, "bin", "rb");
+    int result = loadImageFile(emulator, input);
+    fclose(input);
+    if (result == EXIT_SUCCESS) {
+        result = startRecording(emulator, interval, budget);
+    }
+    if (result == EXIT_SUCCESS) {
+        debug(emulator, stdin, stdout);
+    }
+    freeEmulator(emulator);
+    freeEngineTables();
+    return result;
+}
@@ -0,0 +1,12 @@
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include <stdint.h>
+
+#include "emulator.h"
+
+// Prototypes
+extern int runDebugger(const char *inputFile, const struct EmulatorConfig *config, uint64_t interval,
+                       uint64_t budget);
+
+#endif
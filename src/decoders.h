@@ -11,3 +11,5 @@ extern int decodeDPR(uint32_t *instr, Instruction *instruction, BitFunc bitFunc)
 extern int decodeSDT(uint32_t *instr, Instruction *instruction, BitFunc bitFunc);
 extern int decodeB(uint32_t *instr, Instruction *instruction, BitFunc bitFunc);
 extern int decode(uint32_t *instr, Instruction *instruction, BitFunc bitFunc);
+extern int decodeInstruction(uint32_t instr, Instruction *instruction);
+extern int decodeInstructionQuietly(uint32_t instr, Instruction *instruction);
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -20,10 +21,12 @@
 #define MOV 6
 #define MUL 7
 #define MNEG 8
+#define HALT 9
 
 int disassembleDPI(InstructionParse *instr, Instruction *instruction)
 {
     struct DPI *dpi = &(instruction->dpi);
+    instruction->instructionType = isDPI;
 
     dpi->sf = getMode(instr->tokens[0]);
     dpi->rd = getRegister(instr->tokens[0]);
@@ -47,6 +50,7 @@ int disassembleDPI(InstructionParse *instr, Instruction *instruction)
 int disassembleDPR(InstructionParse *instr, Instruction *instruction)
 {
     struct DPR *dpr = &(instruction->dpr);
+    instruction->instructionType = isDPR;
 
     dpr->sf = getMode(instr->tokens[0]);
     dpr->rm = getRegister(instr->tokens[2]);
@@ -55,11 +59,10 @@ int disassembleDPR(InstructionParse *instr, Instruction *instruction)
 
     int mulPos = getPositionInArray(instr->instrname, multiply, SIZE_MULTIPLY);
     if (mulPos != NOT_FOUND) { // Multiply
-        dpr->m = 1;
-        dpr->opr = DPR_MUL; // only this supported
+        dpr->m = 1; // opr is always DPR_MUL, its bits come from mulOnes
         dpr->x = mulPos;
         dpr->ra = getRegister(instr->tokens[3]);
-        return;
+        return EXIT_SUCCESS;
     }
 
     // Arithmetic / Bit-logic
@@ -81,9 +84,10 @@ int disassembleDPR(InstructionParse *instr, Instruction *instruction)
 }
 
 // 2.3.2 Single Data Transfer Instructions
-int disassembleSDT(InstructionParse *instr, Instruction *instruction, FILE *outputFile, int PC)
+int disassembleSDT(InstructionParse *instr, Instruction *instruction)
 {
     struct SDT *sdt = &(instruction->sdt);
+    instruction->instructionType = isSDT;
 
     sdt->sf = getMode(instr->tokens[0]);
     sdt->rt = getRegister(instr->tokens[0]);
@@ -97,7 +101,7 @@ int disassembleSDT(InstructionParse *instr, Instruction *instruction, FILE *outp
 
         if (instr->numTokens == 2) { // Zero Unsigned Offset
             sdt->u = 1;
-            return;
+            return EXIT_SUCCESS;
         }
 
         // There is an immediate value or register provided
@@ -106,27 +110,22 @@ int disassembleSDT(InstructionParse *instr, Instruction *instruction, FILE *outp
         if (cb2 != NULL && exM == NULL) {
             if (strchr(instr->tokens[2], '#') != NULL) { // Unsigned Immediate Offset
                 sdt->u = 1;
-                sdt->imm12 = getImmediate(instr->tokens[2]) / (sdt->mode ?  8 : 4);
+                sdt->imm12 = getImmediate(instr->tokens[2]) / (sdt->sf ? 8 : 4);
             } else { // Register Offset
                 sdt->offmode = 1;
-
-                // Set 1s
-                // TODO
                 sdt->xm = getRegister(instr->tokens[2]);
             }
-            return;
+            return EXIT_SUCCESS;
         }
         // Pre-Indexed & Post-Indexed
         sdt->offmode = 0;
-
-        // Set 1s
-        // TODO
         sdt->i = (cb2 != NULL);
         sdt->simm9 = getImmediate(instr->tokens[2]);
     } else { // Load Literal
         int literal = getLiteral(instr->tokens[1]);
-        if (literal == INT32_MIN) {
+        if (literal == INT32_MIN) { // patched by handleUndefTable once the label is known
             updateUndefTable(ll, instr->tokens[1]);
+            literal = PC * INSTR_BYTES;
         }
         sdt->simm19 = (literal - PC * INSTR_BYTES) >> 2;
     }
@@ -134,28 +133,25 @@ int disassembleSDT(InstructionParse *instr, Instruction *instruction, FILE *outp
 }
 
 // 2.3.3 Branching Instructions
-int disassembleB(InstructionParse *instr, Instruction *instruction, FILE *outputFile, int PC)
+int disassembleB(InstructionParse *instr, Instruction *instruction)
 {
     struct B *b = &(instruction->b);
+    instruction->instructionType = isB;
 
     if (!strcmp(instr->instrname, "b")) { // Unconditional
         b->type = 0;
         int literal = getLiteral(instr->tokens[0]);
         if (literal == INT32_MIN) {
             updateUndefTable(bu, instr->tokens[0]);
+            literal = PC * INSTR_BYTES;
         }
         b->simm26 = (literal - PC * INSTR_BYTES) >> 2;
     } else if (!strcmp(instr->instrname, "br")) { // Register
         b->type = 3;
-        // Set 1s
-        // TODO
         b->xn = getRegister(instr->tokens[0]);
     } else { // Conditional
         b->type = 1;
 
-        // Set 1s
-        // TODO
-
         // Take by cases regarding the mnemonic
         char *p = instr->instrname + 2;
         switch (*p) {
@@ -186,6 +182,7 @@ int disassembleB(InstructionParse *instr, Instruction *instruction, FILE *output
         int literal = getLiteral(instr->tokens[0]);
         if (literal == INT32_MIN) {
             updateUndefTable(bc, instr->tokens[0]);
+            literal = PC * INSTR_BYTES;
         }
         b->simm19 = (literal - PC * INSTR_BYTES) >> 2;
     }
@@ -196,8 +193,6 @@ int disassembleB(InstructionParse *instr, Instruction *instruction, FILE *output
 // Rephrase the instruction and delegate behaviour to the corresponding disassembler
 int disassembleAlias(InstructionParse *instr, Instruction *instruction)
 {
-    // Get mode: 0 - w, 1 - x
-    int mode = getMode(instr->tokens[0]);
     int idx = getPositionInArray(instr->instrname, aliases, SIZE_ALS);
 
     // Change type to dp
@@ -205,6 +200,18 @@ int disassembleAlias(InstructionParse *instr, Instruction *instruction)
     
     strcpy(instr->instrname, aliasesName[idx]);
 
+    if (idx == HALT) {
+        // halt is and x0, x0, x0
+        for (int i = 0; i < 3; i++) {
+            strcpy(instr->tokens[i], "x0");
+        }
+        instr->numTokens = 3;
+        return EXIT_SUCCESS;
+    }
+
+    // Get mode: 0 - w, 1 - x
+    int mode = getMode(instr->tokens[0]);
+
     if (idx == CMP || idx == CMN || idx == TST) {
         // Add rzr as 1st token - cmp, cmn, tst
         insertNewToken(instr->tokens, mode ? "xzr" : "wzr", instr->numTokens, 0);
@@ -213,7 +220,8 @@ int disassembleAlias(InstructionParse *instr, Instruction *instruction)
         insertNewToken(instr->tokens, mode ? "xzr" : "wzr", instr->numTokens, 1);
     } else {
         // Add rzr as 4th token - mul, mneg
-        insertNewToken(instr->tokens, mode ? "xzr" : "wzr", instr->numTokens, 4);
+        insertNewToken(instr->tokens, mode ? "xzr" : "wzr", instr->numTokens, 3);
     }
+    instr->numTokens++;
     return EXIT_SUCCESS;
 }
@@ -1,17 +1,18 @@
 #ifndef DISASSEMBLER_H
 #define DISASSEMBLER_H
 
+#include "datatypes_as.h"
 #include "structs.h"
 
 // Function Prototypes
-extern void disassembleDPI(InstructionParse *instr, Instruction *instruction);
+extern int disassembleDPI(InstructionParse *instr, Instruction *instruction);
 
-extern void disassembleDPR(InstructionParse *instr, Instruction *instruction);
+extern int disassembleDPR(InstructionParse *instr, Instruction *instruction);
 
-extern void disassembleSDT(InstructionParse *instr, Instruction *instruction);
+extern int disassembleSDT(InstructionParse *instr, Instruction *instruction);
 
-extern void disassembleB(InstructionParse *instr, Instruction *instruction);
+extern int disassembleB(InstructionParse *instr, Instruction *instruction);
 
-extern void disassembleAlias(InstructionParse *instr, Instruction *instruction);
+extern int disassembleAlias(InstructionParse *instr, Instruction *instruction);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,785 @@
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "aot.h"
+#include "cache.h"
+#include "checkpoint.h"
+#include "constants.h"
+#include "datatypes_em.h"
+#include "decoders.h"
+#include "emulator.h"
+#include "flags.h"
+#include "fusion.h"
+#include "io_em.h"
+#include "jit.h"
+#include "lanes.h"
+#include "liveness.h"
+#include "memory_em.h"
+#include "pipeline.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "threaded.h"
+#include "tiered.h"
+#include "trace.h"
+
+// Emulator Contexts
+// The engines work on the state the calling thread points at, so every call
+// points it at the state of its Emulator first. Everything else the engines
+// keep is thread-local as well, so guests on different threads never share
+// anything. Their tables outlive a run and are emptied for the next one
+// on the same thread, clearing only the entries the run used.
+// The other cores of an SMP guest keep states of their own, sharing the memory
+// of the first core's state for the length of a run.
+
+struct Emulator {
+    struct EmulatorState state;
+    struct EmulatorConfig config;
+    bool halted;                 // the last step reached the halt instruction
+    uint64_t pausePC;            // where runEmulatorToPC stops
+    struct EmulatorState *cores; // cores 1 and up of an SMP guest, state is core 0
+    Recording *recording;        // checkpoints for seekEmulator, NULL until startRecording
+    Trace *trace;                // where runTraced records, for the length of traceEmulator
+    uint64_t *profile;           // where runProfiled counts, for the length of profileEmulator
+};
+
+//
+// Execution Loops
+//
+// Fetch, decode and execute every instruction until the halt instruction
+static int runPipeline(void)
+{
+    uint32_t instr;
+    Instruction instruction;
+
+    while ((instr = fetch(state->PC)) != HALT_INSTR) {
+        if (limitReached()) {
+            return EXIT_FAILURE;
+        }
+        if (decodeInstruction(instr, &instruction) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+        flagUpdatesEliminated += eliminateDeadFlags(state->PC, &instruction);
+        if (execute(instruction) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+        state->instructions++;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Same as runPipeline, but each instruction word is only decoded once
+static int runCached(void)
+{
+    CacheEntry *entry;
+    int result = EXIT_SUCCESS;
+    initializeCache();
+
+    while (result == EXIT_SUCCESS) {
+        result = lookupCache(state->PC, &entry);
+        if (result != EXIT_SUCCESS || entry->halt) {
+            break;
+        }
+        if (limitReached()) {
+            result = EXIT_FAILURE;
+            break;
+        }
+        flagUpdatesEliminated += entry->deadFlags;
+        result = execute(entry->instruction);
+        state->instructions++;
+    }
+
+    finishCache();
+    return result;
+}
+
+static int runEngine(const struct EmulatorConfig *config)
+{
+    fusionEnabled = config->fusion;
+    switch (config->engine) {
+        case ENGINE_REFERENCE:
+            return config->cache ? runCached() : runPipeline();
+        case ENGINE_THREADED:
+            return runThreaded();
+        case ENGINE_JIT:
+            return runJit();
+        case ENGINE_TIERED:
+            return runTiered(config->tierThreshold);
+    }
+    return EXIT_FAILURE;
+}
+
+//
+// Calls
+//
+
+// Run body on a core of the emulator, a guest fault inside it fails the call
+static int callCore(Emulator *emulator, struct EmulatorState *core, int (*body)(Emulator *emulator))
+{
+    jmp_buf handler;
+    volatile int result = EXIT_FAILURE; // set between setjmp and a longjmp back to it
+    state = core;
+
+    if (setjmp(handler) == 0) {
+        faultHandler = &handler;
+        result = body(emulator);
+    } else {
+        freeEngineTables(); // a run abandoned by a fault leaves them half used
+    }
+    faultHandler = NULL;
+    resetFlagLiveness();
+    return result;
+}
+
+static int callEmulator(Emulator *emulator, int (*body)(Emulator *emulator))
+{
+    return callCore(emulator, &emulator->state, body);
+}
+
+static void reportLimit(void)
+{
+    fprintf(stderr, "Stopped at PC 0x%08lx after the limit of %lu instructions\n",
+            (unsigned long)state->PC, (unsigned long)state->instructionLimit);
+}
+
+static int run(Emulator *emulator)
+{
+    const struct EmulatorConfig *config = &emulator->config;
+    // A run stopped by the limit shows the flags of whatever instruction it stopped after
+    if (config->flagLiveness && state->instructionLimit == 0) {
+        analyzeFlagLiveness();
+    }
+    if (runEngine(config) != EXIT_SUCCESS) {
+        if (limitReached()) {
+            reportLimit();
+        }
+        return EXIT_FAILURE;
+    }
+
+    if (config->fusionStats) {
+        writeFusionReport(stderr);
+    }
+    if (config->tierStats && config->engine == ENGINE_TIERED) {
+        writeTierReport(stderr);
+    }
+    if (config->flagStats) {
+        writeFlagLivenessReport(stderr);
+    }
+    return EXIT_SUCCESS;
+}
+
+static int step(Emulator *emulator)
+{
+    Instruction instruction;
+    uint32_t instr = fetch(state->PC);
+    emulator->halted = (instr == HALT_INSTR);
+    if (emulator->halted) {
+        return EXIT_SUCCESS;
+    }
+    if (decodeInstruction(instr, &instruction) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    state->instructions++;
+    return execute(instruction);
+}
+
+// step, failing instead once the instruction limit is reached
+static int stepWithinLimit(Emulator *emulator)
+{
+    if (limitReached() && fetch(state->PC) != HALT_INSTR) {
+        reportLimit();
+        return EXIT_FAILURE;
+    }
+    return step(emulator);
+}
+
+// Step until PC reaches pausePC or the halt instruction
+static int runToPC(Emulator *emulator)
+{
+    while (state->PC != (int64_t)emulator->pausePC) {
+        int result = stepWithinLimit(emulator);
+        if (result != EXIT_SUCCESS || emulator->halted) {
+            return result;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+// The reference engine alone, which stops exactly at the instruction limit
+static int runReference(Emulator *emulator)
+{
+    return emulator->config.cache ? runCached() : runPipeline();
+}
+
+// Same as runCached, recording every instruction that runs into the trace
+static int runTraced(Emulator *emulator)
+{
+    CacheEntry *entry;
+    int result = EXIT_SUCCESS;
+    initializeCache();
+
+    while (result == EXIT_SUCCESS) {
+        uint64_t pc = state->PC;
+        result = lookupCache(pc, &entry);
+        if (result != EXIT_SUCCESS || entry->halt) {
+            break;
+        }
+        if (limitReached()) {
+            reportLimit();
+            result = EXIT_FAILURE;
+            break;
+        }
+        uint32_t word = fetch(pc);
+        result = execute(entry->instruction);
+        state->instructions++;
+        traceInstruction(emulator->trace, pc, word, &entry->instruction);
+    }
+
+    finishCache();
+    return result;
+}
+
+// Same as runCached, counting the runs of every instruction in the profile
+static int runProfiled(Emulator *emulator)
+{
+    CacheEntry *entry;
+    uint64_t *counts = emulator->profile;
+    int result = EXIT_SUCCESS;
+    initializeCache();
+
+    while (result == EXIT_SUCCESS) {
+        result = lookupCache(state->PC, &entry);
+        if (result != EXIT_SUCCESS || entry->halt) {
+            break;
+        }
+        if (limitReached()) {
+            reportLimit();
+            result = EXIT_FAILURE;
+            break;
+        }
+        counts[state->PC / INSTR_BYTES]++;
+        result = execute(entry->instruction);
+        state->instructions++;
+    }
+
+    finishCache();
+    return result;
+}
+
+// Checkpoints of another guest are of no use once it is replaced
+static void stopRecording(Emulator *emulator)
+{
+    freeRecording(emulator->recording);
+    emulator->recording = NULL;
+}
+
+//
+// Cores
+//
+// Step the core in state for up to config.roundRobin instructions, stopping at the halt instruction
+static int takeTurn(Emulator *emulator)
+{
+    for (uint64_t i = 0; i < emulator->config.roundRobin; i++) {
+        int result = stepWithinLimit(emulator);
+        if (result != EXIT_SUCCESS || emulator->halted) {
+            return result;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+typedef struct {
+    Emulator *emulator;
+    struct EmulatorState *core;
+    pthread_t thread;
+    int result;
+} CoreRun;
+
+static struct EmulatorState *coreState(Emulator *emulator, int core)
+{
+    return (core == 0) ? &emulator->state : &emulator->cores[core - 1];
+}
+
+static void *runCoreThread(void *argument)
+{
+    CoreRun *coreRun = (CoreRun *)argument;
+    coreRun->result = callCore(coreRun->emulator, coreRun->core, run);
+    freeEngineTables(); // they end with the thread
+    return NULL;
+}
+
+// Every core on a thread of its own, the first one on the calling thread
+static int runThreads(Emulator *emulator)
+{
+    CoreRun coreRuns[MAX_CORES];
+    for (int core = 1; core < emulator->config.cores; core++) {
+        coreRuns[core] = (CoreRun){.emulator = emulator, .core = coreState(emulator, core)};
+        if (pthread_create(&coreRuns[core].thread, NULL, runCoreThread, &coreRuns[core]) != 0) {
+            perror("Failed to start a core thread.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int result = callEmulator(emulator, run);
+    for (int core = 1; core < emulator->config.cores; core++) {
+        pthread_join(coreRuns[core].thread, NULL);
+        if (coreRuns[core].result != EXIT_SUCCESS) {
+            result = EXIT_FAILURE;
+        }
+    }
+    return result;
+}
+
+// The cores take turns on the calling thread until each has halted or failed
+static int runRoundRobin(Emulator *emulator)
+{
+    bool running[MAX_CORES];
+    int numRunning = emulator->config.cores;
+    int result = EXIT_SUCCESS;
+    for (int core = 0; core < numRunning; core++) {
+        running[core] = true;
+    }
+
+    while (numRunning > 0) {
+        for (int core = 0; core < emulator->config.cores; core++) {
+            if (!running[core]) {
+                continue;
+            }
+            emulator->halted = false;
+            int turn = callCore(emulator, coreState(emulator, core), takeTurn);
+            if (turn != EXIT_SUCCESS || emulator->halted) {
+                running[core] = false;
+                numRunning--;
+            }
+            if (turn != EXIT_SUCCESS) {
+                result = EXIT_FAILURE;
+            }
+        }
+    }
+    emulator->halted = false;
+    return result;
+}
+
+// Run all cores of an SMP guest on the memory of the first
+static int runCores(Emulator *emulator)
+{
+    struct SharedMemory *shared = shareMemory(&emulator->state.memory);
+    for (int core = 1; core < emulator->config.cores; core++) {
+        attachMemory(&coreState(emulator, core)->memory, shared);
+    }
+
+    int result = (emulator->config.roundRobin != 0) ? runRoundRobin(emulator) : runThreads(emulator);
+
+    for (int core = 1; core < emulator->config.cores; core++) {
+        coreState(emulator, core)->memory = (struct GuestMemory){0};
+    }
+    unshareMemory(&emulator->state.memory, shared);
+    return result;
+}
+
+//
+// Library Interface
+//
+void initializeConfig(struct EmulatorConfig *config)
+{
+    memset(config, 0, sizeof(struct EmulatorConfig));
+    config->engine = ENGINE_REFERENCE;
+    config->tierThreshold = DEFAULT_TIER_THRESHOLD;
+    config->memorySize = MEMORY_SIZE;
+    config->cores = 1;
+    config->fusion = true;
+    config->flagLiveness = true;
+}
+
+// A new machine with zeroed registers and memory, NULL if the memory size or the number of cores is invalid
+Emulator *createEmulator(const struct EmulatorConfig *config)
+{
+    Emulator *emulator = (Emulator *)malloc(sizeof(Emulator));
+    if (emulator == NULL) {
+        perror("Failed to allocate space for the emulator.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config != NULL) {
+        emulator->config = *config;
+    } else {
+        initializeConfig(&emulator->config);
+    }
+    emulator->halted = false;
+    emulator->cores = NULL;
+    emulator->recording = NULL;
+    emulator->trace = NULL;
+    emulator->profile = NULL;
+
+    uint64_t size = emulator->config.memorySize;
+    int numCores = emulator->config.cores;
+    if (size < MEMORY_SIZE || size > MAX_MEMORY_SIZE || size % GUEST_PAGE_SIZE != 0
+        || numCores < 1 || numCores > MAX_CORES) {
+        free(emulator);
+        return NULL;
+    }
+    state = &emulator->state;
+    initializeState(size);
+    state->instructionLimit = emulator->config.instructionLimit;
+
+    if (numCores > 1) {
+        emulator->cores = (struct EmulatorState *)calloc(numCores - 1, sizeof(struct EmulatorState));
+        if (emulator->cores == NULL) {
+            perror("Failed to allocate space for the cores.\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int core = 1; core < numCores; core++) {
+            *coreState(emulator, core) = (struct EmulatorState){
+                .instructionLimit = emulator->config.instructionLimit,
+                .coreId = core,
+                .pstate = {.Z = true},
+            };
+        }
+    }
+    return emulator;
+}
+
+void freeEmulator(Emulator *emulator)
+{
+    if (emulator == NULL) {
+        return;
+    }
+    state = &emulator->state;
+    freeMemory();
+    free(emulator->cores);
+    freeRecording(emulator->recording);
+    free(emulator);
+}
+
+// Free the tables the engines keep between runs on the calling thread
+void freeEngineTables(void)
+{
+    freeCache();
+    freeFlagLiveness();
+    freeJit();
+    freeTiered();
+    freeBlocks();
+}
+
+// Copy an image to address 0
+int loadImage(Emulator *emulator, const uint8_t *image, size_t length)
+{
+    if (length == 0 || length > emulator->state.memory.size) {
+        return EXIT_FAILURE;
+    }
+    stopRecording(emulator);
+    state = &emulator->state;
+    copyToMemory(0, image, length);
+    return EXIT_SUCCESS;
+}
+
+// Load a .bin file to address 0, mapping it when it is a regular file
+int loadImageFile(Emulator *emulator, FILE *file)
+{
+    stopRecording(emulator);
+    state = &emulator->state;
+    int result = readToMemory(file);
+    return result;
+}
+
+// Back to the state createEmulator left, for loading the next image
+void resetEmulator(Emulator *emulator)
+{
+    stopRecording(emulator);
+    for (int core = 1; core < emulator->config.cores; core++) {
+        state = coreState(emulator, core);
+        resetRegisters();
+    }
+    state = &emulator->state;
+    resetState();
+    emulator->halted = false;
+}
+
+// Run from PC until the halt instruction, on every core of an SMP guest
+int runEmulator(Emulator *emulator)
+{
+    return (emulator->config.cores > 1) ? runCores(emulator) : callEmulator(emulator, run);
+}
+
+// Execute the instruction at PC of the first core, only setting halted if it is the halt instruction
+int stepEmulator(Emulator *emulator, bool *halted)
+{
+    int result = callEmulator(emulator, step);
+    *halted = emulator->halted;
+    return result;
+}
+
+// Run a single core guest until it has executed count instructions in all or
+// halts, setting halted in the second case. It runs on the reference engine,
+// which stops at exactly that instruction.
+int runEmulatorTo(Emulator *emulator, uint64_t count, bool *halted)
+{
+    *halted = false;
+    if (emulator->config.cores > 1) {
+        return EXIT_FAILURE;
+    }
+    uint64_t limit = emulator->state.instructionLimit;
+    bool pauses = limit == 0 || count < limit;
+    emulator->state.instructionLimit = pauses ? count : limit;
+    int result = callEmulator(emulator, runReference);
+    emulator->state.instructionLimit = limit;
+
+    if (result == EXIT_SUCCESS) {
+        *halted = true;
+        return EXIT_SUCCESS;
+    }
+    if (emulator->state.instructions >= count && pauses) {
+        return EXIT_SUCCESS;
+    }
+    if (limit != 0 && emulator->state.instructions >= limit) {
+        state = &emulator->state;
+        reportLimit();
+    }
+    return EXIT_FAILURE;
+}
+
+// Step a single core guest until PC is pc or it halts, setting halted in the second case
+int runEmulatorToPC(Emulator *emulator, uint64_t pc, bool *halted)
+{
+    *halted = false;
+    if (emulator->config.cores > 1) {
+        return EXIT_FAILURE;
+    }
+    emulator->halted = false;
+    emulator->pausePC = pc;
+    int result = callEmulator(emulator, runToPC);
+    *halted = emulator->halted;
+    return result;
+}
+
+// Keep checkpoints of a single core guest from here on, one every interval
+// instructions, for seekEmulator. Their page copies stay within about budget
+// bytes, see checkpoint.c. Loading or restoring another guest ends the recording.
+int startRecording(Emulator *emulator, uint64_t interval, uint64_t budget)
+{
+    if (emulator->config.cores > 1 || interval == 0) {
+        return EXIT_FAILURE;
+    }
+    stopRecording(emulator);
+    state = &emulator->state;
+    emulator->recording = createRecording(interval, budget);
+    return EXIT_SUCCESS;
+}
+
+// Move a recording guest to just after count instructions from its start, or
+// to the halt instruction if it halts first, setting halted then. Going back
+// restores the last checkpoint before count and runs forward from there, so
+// any seek runs at most a checkpoint interval more than the distance covered.
+// Running forward past the last checkpoint takes new ones on the way.
+int seekEmulator(Emulator *emulator, uint64_t count, bool *halted)
+{
+    Recording *recording = emulator->recording;
+    *halted = false;
+    if (recording == NULL) {
+        return EXIT_FAILURE;
+    }
+    if (count < emulator->state.instructions) {
+        state = &emulator->state;
+        int result = restoreCheckpoint(recording, count);
+        emulator->halted = false;
+        if (result != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+    while (emulator->state.instructions < count) {
+        uint64_t next = nextCheckpoint(recording);
+        bool due = next > emulator->state.instructions && next <= count;
+        if (runEmulatorTo(emulator, due ? next : count, halted) != EXIT_SUCCESS || *halted) {
+            return *halted ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (due) {
+            state = &emulator->state;
+            takeCheckpoint(recording);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+// Run a single core guest like runEmulator, but on the reference engine, recording
+// every instruction it runs to file in the format of trace.h. The trace ends
+// with the last instruction before the halt, the limit or a fault.
+int traceEmulator(Emulator *emulator, FILE *file)
+{
+    if (emulator->config.cores > 1) {
+        return EXIT_FAILURE;
+    }
+    emulator->trace = openTrace(file);
+    int result = callEmulator(emulator, runTraced);
+    if (closeTrace(emulator->trace) != EXIT_SUCCESS) {
+        fprintf(stderr, "Could not write the trace.\n");
+        result = EXIT_FAILURE;
+    }
+    emulator->trace = NULL;
+    return result;
+}
+
+// Run a single core guest like runEmulator, but on the reference engine,
+// counting how many times each instruction runs, then write the report of
+// profile.c to file, naming addresses after labels if a label map is given.
+// The report covers the run up to the halt, the limit or a fault.
+int profileEmulator(Emulator *emulator, FILE *file, FILE *labels)
+{
+    if (emulator->config.cores > 1) {
+        return EXIT_FAILURE;
+    }
+    emulator->profile = createProfile();
+    int result = callEmulator(emulator, runProfiled);
+    state = &emulator->state;
+    if (writeProfile(file, emulator->profile, labels) != EXIT_SUCCESS) {
+        fprintf(stderr, "Could not write the profile.\n");
+        result = EXIT_FAILURE;
+    }
+    free(emulator->profile);
+    emulator->profile = NULL;
+    return result;
+}
+
+// Run emulators loaded with the same program side by side, MAX_LANES at a time
+// in lockstep, see lanes.c. Their configurations are ignored apart from their
+// instruction limits. results[i] is the outcome of emulators[i], the call fails
+// if any of them failed.
+int runEmulatorLanes(Emulator **emulators, int count, int *results)
+{
+    struct EmulatorState *states[MAX_LANES];
+    int result = EXIT_SUCCESS;
+    for (int first = 0; first < count; first += MAX_LANES) {
+        int numLanes = (count - first < MAX_LANES) ? count - first : MAX_LANES;
+        for (int lane = 0; lane < numLanes; lane++) {
+            states[lane] = &emulators[first + lane]->state;
+        }
+        runLanes(states, numLanes, &results[first]);
+
+        for (int lane = 0; lane < numLanes; lane++) {
+            struct EmulatorState *laneState = states[lane];
+            if (results[first + lane] == EXIT_SUCCESS) {
+                continue;
+            }
+            result = EXIT_FAILURE;
+            if (laneState->instructionLimit != 0 && laneState->instructions >= laneState->instructionLimit) {
+                fprintf(stderr, "Stopped at PC 0x%08lx after the limit of %lu instructions\n",
+                        (unsigned long)laneState->PC, (unsigned long)laneState->instructionLimit);
+            }
+        }
+    }
+    return result;
+}
+
+// Runs from now on stop once the instruction count reaches limit, 0 for no limit
+void setInstructionLimit(Emulator *emulator, uint64_t limit)
+{
+    emulator->config.instructionLimit = limit;
+    for (int core = 0; core < emulator->config.cores; core++) {
+        coreState(emulator, core)->instructionLimit = limit;
+    }
+}
+
+uint64_t readInstructionCount(const Emulator *emulator)
+{
+    return emulator->state.instructions;
+}
+
+// A register of the first core
+int64_t readRegister(const Emulator *emulator, int reg)
+{
+    return readCoreRegister(emulator, 0, reg);
+}
+
+int64_t readCoreRegister(const Emulator *emulator, int core, int reg)
+{
+    if (core < 0 || core >= emulator->config.cores) {
+        return 0;
+    }
+    const struct EmulatorState *selected = (core == 0) ? &emulator->state : &emulator->cores[core - 1];
+    switch (reg) {
+        case REGISTER_SP:
+            return selected->SP;
+        case REGISTER_PC:
+            return selected->PC;
+        default:
+            return (reg >= 0 && reg < NUM_OF_REGISTERS) ? selected->R[reg] : 0;
+    }
+}
+
+struct EmulatorFlags readFlags(Emulator *emulator)
+{
+    state = &emulator->state;
+    evaluateFlags();
+    struct PSTATE pstate = emulator->state.pstate;
+    return (struct EmulatorFlags){.N = pstate.N, .Z = pstate.Z, .C = pstate.C, .V = pstate.V};
+}
+
+int readGuestMemory(Emulator *emulator, uint64_t addr, uint8_t *bytes, size_t length)
+{
+    uint64_t size = emulator->state.memory.size;
+    if (length > size || addr > size - length) {
+        return EXIT_FAILURE;
+    }
+    state = &emulator->state;
+    copyFromMemory(addr, bytes, length);
+    return EXIT_SUCCESS;
+}
+
+// The registers, flags and non-zero memory in the format of the .out files. An
+// SMP guest lists the registers of each core under a heading of its own.
+void writeEmulatorState(Emulator *emulator, FILE *file)
+{
+    if (emulator->config.cores == 1) {
+        state = &emulator->state;
+        writeFinalState(file);
+        return;
+    }
+    for (int core = 0; core < emulator->config.cores; core++) {
+        state = coreState(emulator, core);
+        fprintf(file, "Core %d Registers:\n", core);
+        writeRegisters(file);
+    }
+    state = &emulator->state;
+    writeNonZeroMemory(file);
+}
+
+// The registers and flags of the first core in the format of the .out files
+void writeEmulatorRegisters(Emulator *emulator, FILE *file)
+{
+    state = &emulator->state;
+    writeRegisters(file);
+}
+
+// Save the registers, flags and non-zero pages of a single core guest, see snapshot.c
+int saveSnapshot(Emulator *emulator, FILE *file)
+{
+    if (emulator->config.cores > 1) {
+        return EXIT_FAILURE;
+    }
+    state = &emulator->state;
+    int result = writeSnapshot(file);
+    return result;
+}
+
+// Replace the guest with one saved by saveSnapshot, mapping its pages when the file is a regular file
+int restoreSnapshot(Emulator *emulator, FILE *file)
+{
+    if (emulator->config.cores > 1) {
+        return EXIT_FAILURE;
+    }
+    stopRecording(emulator);
+    state = &emulator->state;
+    int result = readSnapshot(file);
+    emulator->halted = false;
+    return result;
+}
+
+// A C translation of the loaded image, see aot.c
+int writeEmulatorAot(Emulator *emulator, FILE *file, const char *inputFile)
+{
+    state = &emulator->state;
+    int result = writeAot(file, inputFile);
+    return result;
+}
@@ -0,0 +1,108 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Emulator Library
+// Each Emulator is a guest machine of its own, with its own registers and
+// memory, behind an opaque handle. Calls on one Emulator must not overlap, but
+// different Emulators can be used from different threads at the same time.
+// The engines keep their tables between runs on each thread, a thread frees
+// its own with freeEngineTables once it is done with the library.
+// Functions returning int give EXIT_SUCCESS or EXIT_FAILURE. A guest memory
+// fault fails the run or step it happened in and leaves the Emulator usable.
+// The engines work on one guest per thread, through the _Thread_local state
+// pointer of datatypes_em.h, which every call points at its Emulator.
+
+// Execution engines
+enum Engine {
+    ENGINE_REFERENCE, // fetch, decode and execute one instruction at a time
+    ENGINE_THREADED,  // basic blocks run through threaded handlers
+    ENGINE_JIT,       // basic blocks translated to native x86-64 code
+    ENGINE_TIERED,    // interpreted blocks promoted to threaded ones once hot
+};
+
+// Most emulators runEmulatorLanes runs in one lockstep group
+#define MAX_LANES 16
+
+// SMP guests
+// An Emulator with several cores gives each its own registers and flags, all
+// sharing one memory. Every core starts at PC 0 and runs until it halts, the
+// run fails if any core fails. A core reads its number, from 0, from the
+// read-only doubleword at 0xFFFFFFFFFFFFFFF8, which movn xN, #7 reaches.
+// Memory ordering: each core sees its own accesses in program order. Loads and
+// stores of 4 or 8 bytes inside a page are single-copy atomic, and a core's
+// stores reach the other cores in the order it made them, though its loads may
+// pass its own earlier stores to other addresses. This is total store order,
+// as on x86-64 hosts, other hosts order cores as their own memory does.
+// Accesses crossing a page may be seen half done. There are no barriers or
+// atomic read-modify-writes, so cores hand over data through flags they store
+// after it. Cores running cached engines may not see code other cores write.
+// With roundRobin set the cores instead take turns on the calling thread, in
+// order of their numbers, each running that many instructions on the reference
+// engine. That order is sequentially consistent and the same on every run.
+#define MAX_CORES 64
+
+// Register numbers for readRegister past X0-X30
+#define REGISTER_SP 31
+#define REGISTER_PC 32
+
+// Emulator Configuration, initializeConfig fills in the defaults
+struct EmulatorConfig {
+    enum Engine engine;
+    bool cache;                  // reference engine reuses predecoded instructions
+    unsigned long tierThreshold; // block entries before the tiered engine promotes a block
+    uint64_t memorySize;         // bytes in the guest address space, whole 4KB pages from 2MB to 512GB
+    bool fusion;                 // threaded blocks use superinstructions
+    bool fusionStats;            // report how often each fusion ran to stderr after a run
+    bool tierStats;              // report the work done in each tier of the tiered engine to stderr after a run
+    bool flagLiveness;           // skip flag updates that are never read
+    bool flagStats;              // report the flag updates the analysis eliminated to stderr after a run
+    uint64_t instructionLimit;   // a run fails once it has executed this many instructions, 0 for no limit
+    int cores;                   // guest cores sharing the memory, each running on a thread of its own
+    uint64_t roundRobin;         // if not 0, the cores take turns of this many instructions on one thread instead
+};
+
+// Condition flags, as of the last instruction that ran
+struct EmulatorFlags {
+    bool N;
+    bool Z;
+    bool C;
+    bool V;
+};
+
+typedef struct Emulator Emulator;
+
+// Prototypes
+extern void initializeConfig(struct EmulatorConfig *config);
+extern Emulator *createEmulator(const struct EmulatorConfig *config);
+extern void freeEmulator(Emulator *emulator);
+extern void freeEngineTables(void);
+extern int loadImage(Emulator *emulator, const uint8_t *image, size_t length);
+extern int loadImageFile(Emulator *emulator, FILE *file);
+extern void resetEmulator(Emulator *emulator);
+extern int runEmulator(Emulator *emulator);
+extern int stepEmulator(Emulator *emulator, bool *halted);
+extern int runEmulatorTo(Emulator *emulator, uint64_t count, bool *halted);
+extern int runEmulatorToPC(Emulator *emulator, uint64_t pc, bool *halted);
+extern int startRecording(Emulator *emulator, uint64_t interval, uint64_t budget);
+extern int seekEmulator(Emulator *emulator, uint64_t count, bool *halted);
+extern int traceEmulator(Emulator *emulator, FILE *file);
+extern int profileEmulator(Emulator *emulator, FILE *file, FILE *labels);
+extern int runEmulatorLanes(Emulator **emulators, int count, int *results);
+extern void setInstructionLimit(Emulator *emulator, uint64_t limit);
+extern uint64_t readInstructionCount(const Emulator *emulator);
+extern int64_t readRegister(const Emulator *emulator, int reg);
+extern int64_t readCoreRegister(const Emulator *emulator, int core, int reg);
+extern struct EmulatorFlags readFlags(Emulator *emulator);
+extern int readGuestMemory(Emulator *emulator, uint64_t addr, uint8_t *bytes, size_t length);
+extern void writeEmulatorState(Emulator *emulator, FILE *file);
+extern void writeEmulatorRegisters(Emulator *emulator, FILE *file);
+extern int saveSnapshot(Emulator *emulator, FILE *file);
+extern int restoreSnapshot(Emulator *emulator, FILE *file);
+extern int writeEmulatorAot(Emulator *emulator, FILE *file, const char *inputFile);
+
+#endif
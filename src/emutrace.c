@@ -0,0 +1,509 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "constants.h"
+#include "datatypes_em.h"
+#include "decoders.h"
+#include "structs.h"
+#include "trace.h"
+
+// Trace Analyzer
+// Reads a trace written by emulate --trace, see trace.h, and reports its
+// instruction mix, branches, the pages its loads and stores touched and its
+// hottest instructions. The trace is mapped rather than read, and worker
+// threads take its chunks a batch at a time, each counting into tables of its
+// own which are summed once they are done. A worker drops the pages of the
+// batches it has finished from the mapping. The tables of a worker hold a count
+// and a taken count for every instruction of the code window and a bit for every
+// page loaded or stored.
+// Instructions outside the code window, the first MEMORY_SIZE bytes, count
+// towards the mix but are not listed among the hottest.
+// Usage: emutrace [--jobs=<n>] [--top=<n>] <file.trace>
+
+#define JOBS_FLAG "--jobs="
+#define TOP_FLAG "--top="
+#define MAX_JOBS 1024
+#define DEFAULT_TOP 20
+#define BATCH_BYTES (1 << 20)
+#define CODE_WORDS (MEMORY_SIZE / INSTR_BYTES)
+#define MAX_PAGES (MAX_MEMORY_SIZE >> GUEST_PAGE_SHIFT)
+#define BITMAP_WORDS (MAX_PAGES / 64)
+#define CLASS_CACHE_SIZE 4096
+
+enum InstructionClass {
+    CLASS_ARITHMETIC_IMMEDIATE,
+    CLASS_WIDE_MOVE,
+    CLASS_ARITHMETIC_REGISTER,
+    CLASS_LOGICAL_REGISTER,
+    CLASS_MULTIPLY,
+    CLASS_LOAD,
+    CLASS_STORE,
+    CLASS_LOAD_LITERAL,
+    CLASS_BRANCH,
+    CLASS_BRANCH_CONDITIONAL,
+    CLASS_BRANCH_REGISTER,
+    NUM_CLASSES,
+};
+
+static const char *classNames[NUM_CLASSES] = {
+    "add/sub (imm)", "wide move", "add/sub (reg)", "logical (reg)", "multiply", "load", "store",
+    "load literal", "branch", "branch (cond)", "branch (reg)"};
+
+// The class of a word, decoded once and kept while no other word lands on its slot
+typedef struct {
+    uint32_t word;
+    bool valid;
+    uint8_t instructionClass;
+    uint8_t bytes; // transferred by a load or store
+} ClassEntry;
+
+typedef struct {
+    const uint8_t *trace;
+    size_t length;
+    pthread_mutex_t lock;
+    size_t next;  // offset of the first chunk no worker has taken
+    bool damaged; // a chunk did not decode
+} Analysis;
+
+typedef struct {
+    Analysis *analysis;
+    pthread_t thread;
+    uint64_t instructions;
+    uint64_t classes[NUM_CLASSES];
+    uint64_t conditionalTaken;
+    uint64_t *counts; // per instruction of the code window
+    uint64_t *taken;  // per branch of the code window
+    uint64_t *loaded; // a bit per page
+    uint64_t *stored;
+    ClassEntry classCache[CLASS_CACHE_SIZE];
+} Worker;
+
+static uint32_t getLittle32(const uint8_t *bytes)
+{
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; i--) {
+        value = value << 8 | bytes[i];
+    }
+    return value;
+}
+
+static uint64_t getLittle64(const uint8_t *bytes)
+{
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = value << 8 | bytes[i];
+    }
+    return value;
+}
+
+// Read a varint below end, NULL if it runs past it
+static const uint8_t *getVarint(const uint8_t *in, const uint8_t *end, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; in < end && shift < 64; shift += 7) {
+        uint8_t byte = *in++;
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            return in;
+        }
+    }
+    return NULL;
+}
+
+static void *allocate(size_t count, size_t size)
+{
+    void *memory = calloc(count, size);
+    if (memory == NULL) {
+        perror("Failed to allocate space for the analysis.\n");
+        exit(EXIT_FAILURE);
+    }
+    return memory;
+}
+
+//
+// Classification
+//
+static enum InstructionClass classify(const Instruction *instruction)
+{
+    switch (instruction->instructionType) {
+        case isDPI:
+            return (instruction->dpi.opi == WIDEMOVE) ? CLASS_WIDE_MOVE : CLASS_ARITHMETIC_IMMEDIATE;
+        case isDPR:
+            if (instruction->dpr.m) {
+                return CLASS_MULTIPLY;
+            }
+            return instruction->dpr.armOrLog ? CLASS_ARITHMETIC_REGISTER : CLASS_LOGICAL_REGISTER;
+        case isSDT:
+            if (instruction->sdt.mode == 0) {
+                return CLASS_LOAD_LITERAL;
+            }
+            return instruction->sdt.l ? CLASS_LOAD : CLASS_STORE;
+        default:
+            if (instruction->b.type == BRANCH_CONDITIONAL) {
+                return CLASS_BRANCH_CONDITIONAL;
+            }
+            return (instruction->b.type == BRANCH_REGISTER) ? CLASS_BRANCH_REGISTER : CLASS_BRANCH;
+    }
+}
+
+static const ClassEntry *lookupClass(Worker *worker, uint32_t word)
+{
+    ClassEntry *entry = &worker->classCache[(word ^ word >> 12) % CLASS_CACHE_SIZE];
+    if (!entry->valid || entry->word != word) {
+        Instruction instruction;
+        memset(&instruction, 0, sizeof(instruction));
+        decodeInstruction(word, &instruction);
+        entry->word = word;
+        entry->valid = true;
+        entry->instructionClass = classify(&instruction);
+        entry->bytes = (instruction.instructionType == isSDT && instruction.sdt.sf) ? MODE64_BYTES : MODE32_BYTES;
+    }
+    return entry;
+}
+
+static void markPages(uint64_t *bitmap, uint64_t addr, int bytes)
+{
+    uint64_t first = addr >> GUEST_PAGE_SHIFT;
+    uint64_t last = (addr + bytes - 1) >> GUEST_PAGE_SHIFT;
+    for (uint64_t page = first; page <= last && page < MAX_PAGES; page++) {
+        bitmap[page / 64] |= 1ULL << (page % 64);
+    }
+}
+
+//
+// Workers
+//
+// A conditional branch at pc was taken if the next instruction is not the one after it
+static void countBranch(Worker *worker, uint64_t pc, uint64_t nextPC)
+{
+    if (nextPC == pc + INSTR_BYTES) {
+        return;
+    }
+    worker->conditionalTaken++;
+    if (pc < MEMORY_SIZE) {
+        worker->taken[pc / INSTR_BYTES]++;
+    }
+}
+
+// Count the records of the chunk whose payload is [in, end) and which starts
+// at pc. nextPC is where the next chunk starts, if hasNext, which tells whether
+// a branch ending this one was taken. Fails if the chunk does not decode.
+static int analyzeChunk(Worker *worker, const uint8_t *in, const uint8_t *end, uint64_t pc, uint32_t count,
+                        bool hasNext, uint64_t nextPC)
+{
+    uint64_t expected = pc;
+    uint64_t previousPC = 0;
+    int previousClass = NUM_CLASSES;
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t tag;
+        uint64_t address = 0;
+        uint64_t value;
+        in = getVarint(in, end, &tag);
+        if (in == NULL || end - in < INSTR_BYTES) {
+            return EXIT_FAILURE;
+        }
+        uint64_t zigzag = tag >> 2;
+        pc = expected + ((zigzag >> 1) ^ -(zigzag & 1));
+        const ClassEntry *entry = lookupClass(worker, getLittle32(in));
+        in += INSTR_BYTES;
+        enum TraceKind kind = (enum TraceKind)(tag & 3);
+        if (kind == TRACE_LOAD || kind == TRACE_STORE) {
+            in = getVarint(in, end, &address);
+        }
+        if (kind != TRACE_BRANCH && in != NULL) {
+            in = getVarint(in, end, &value);
+        }
+        if (in == NULL) {
+            return EXIT_FAILURE;
+        }
+
+        // Whether the branch before this record was taken shows in this record's PC
+        if (previousClass == CLASS_BRANCH_CONDITIONAL) {
+            countBranch(worker, previousPC, pc);
+        }
+        worker->instructions++;
+        worker->classes[entry->instructionClass]++;
+        if (pc < MEMORY_SIZE) {
+            worker->counts[pc / INSTR_BYTES]++;
+        }
+        if (kind == TRACE_LOAD) {
+            markPages(worker->loaded, address, entry->bytes);
+        } else if (kind == TRACE_STORE) {
+            markPages(worker->stored, address, entry->bytes);
+        }
+        previousPC = pc;
+        previousClass = entry->instructionClass;
+        expected = pc + INSTR_BYTES;
+    }
+    if (hasNext && previousClass == CLASS_BRANCH_CONDITIONAL) {
+        countBranch(worker, previousPC, nextPC);
+    }
+    return (in == end) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Take the next batch of whole chunks, at least BATCH_BYTES unless the trace
+// ends first, as [*start, *end). False once there are none left.
+static bool takeBatch(Analysis *analysis, size_t *start, size_t *end)
+{
+    pthread_mutex_lock(&analysis->lock);
+    *start = analysis->next;
+    size_t offset = *start;
+    while (offset < analysis->length && offset - *start < BATCH_BYTES) {
+        if (analysis->length - offset < TRACE_CHUNK_HEADER) {
+            analysis->damaged = true;
+            break;
+        }
+        uint64_t bytes = getLittle32(&analysis->trace[offset + TRACE_CHUNK_BYTES]);
+        if (bytes > analysis->length - offset - TRACE_CHUNK_HEADER) {
+            analysis->damaged = true;
+            break;
+        }
+        offset += TRACE_CHUNK_HEADER + bytes;
+    }
+    analysis->next = analysis->damaged ? analysis->length : offset;
+    *end = offset;
+    pthread_mutex_unlock(&analysis->lock);
+    return *end > *start;
+}
+
+// Let the kernel drop the whole pages of [start, end) from the mapping
+static void releaseBatch(Analysis *analysis, size_t start, size_t end)
+{
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t first = (start + pageSize - 1) / pageSize * pageSize;
+    size_t last = end / pageSize * pageSize;
+    if (last > first) {
+        madvise((void *)(analysis->trace + first), last - first, MADV_DONTNEED);
+    }
+}
+
+static void *runWorker(void *argument)
+{
+    Worker *worker = (Worker *)argument;
+    Analysis *analysis = worker->analysis;
+    const uint8_t *trace = analysis->trace;
+    size_t start;
+    size_t end;
+    while (takeBatch(analysis, &start, &end)) {
+        for (size_t offset = start; offset < end;) {
+            const uint8_t *header = &trace[offset];
+            size_t payload = offset + TRACE_CHUNK_HEADER;
+            size_t next = payload + getLittle32(&header[TRACE_CHUNK_BYTES]);
+            bool hasNext = analysis->length - next >= TRACE_CHUNK_HEADER;
+            uint64_t nextPC = hasNext ? getLittle64(&trace[next + TRACE_CHUNK_PC]) : 0;
+            if (analyzeChunk(worker, &trace[payload], &trace[next], getLittle64(&header[TRACE_CHUNK_PC]),
+                             getLittle32(&header[TRACE_CHUNK_COUNT]), hasNext, nextPC) != EXIT_SUCCESS) {
+                pthread_mutex_lock(&analysis->lock);
+                analysis->damaged = true;
+                pthread_mutex_unlock(&analysis->lock);
+            }
+            offset = next;
+        }
+        releaseBatch(analysis, start, end);
+    }
+    return NULL;
+}
+
+// Add the tables of another worker into worker
+static void mergeWorker(Worker *worker, const Worker *other)
+{
+    worker->instructions += other->instructions;
+    worker->conditionalTaken += other->conditionalTaken;
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        worker->classes[i] += other->classes[i];
+    }
+    for (size_t i = 0; i < CODE_WORDS; i++) {
+        worker->counts[i] += other->counts[i];
+        worker->taken[i] += other->taken[i];
+    }
+    // Most of a bitmap is never written, so leave those pages unmapped here too
+    for (size_t i = 0; i < BITMAP_WORDS; i++) {
+        if (other->loaded[i] != 0) {
+            worker->loaded[i] |= other->loaded[i];
+        }
+        if (other->stored[i] != 0) {
+            worker->stored[i] |= other->stored[i];
+        }
+    }
+}
+
+//
+// Report
+//
+typedef struct {
+    uint64_t pc;
+    uint64_t count;
+} HotInstruction;
+
+static int compareHotness(const void *a, const void *b)
+{
+    const HotInstruction *hotA = (const HotInstruction *)a;
+    const HotInstruction *hotB = (const HotInstruction *)b;
+    if (hotA->count != hotB->count) {
+        return (hotA->count < hotB->count) - (hotA->count > hotB->count);
+    }
+    return (hotA->pc > hotB->pc) - (hotA->pc < hotB->pc);
+}
+
+static double percent(uint64_t part, uint64_t whole)
+{
+    return (whole == 0) ? 0.0 : 100.0 * part / whole;
+}
+
+static void writeReport(const Worker *total, int top)
+{
+    printf("Instructions: %lu\n", (unsigned long)total->instructions);
+    printf("Instruction mix:\n");
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        printf("  %-16s %14lu %6.1f%%\n", classNames[i], (unsigned long)total->classes[i],
+               percent(total->classes[i], total->instructions));
+    }
+
+    uint64_t conditional = total->classes[CLASS_BRANCH_CONDITIONAL];
+    printf("Branches: %lu conditional, %.1f%% taken, %lu unconditional, %lu through registers\n",
+           (unsigned long)conditional, percent(total->conditionalTaken, conditional),
+           (unsigned long)total->classes[CLASS_BRANCH], (unsigned long)total->classes[CLASS_BRANCH_REGISTER]);
+
+    uint64_t loaded = 0;
+    uint64_t stored = 0;
+    uint64_t touched = 0;
+    for (size_t i = 0; i < BITMAP_WORDS; i++) {
+        loaded += __builtin_popcountll(total->loaded[i]);
+        stored += __builtin_popcountll(total->stored[i]);
+        touched += __builtin_popcountll(total->loaded[i] | total->stored[i]);
+    }
+    printf("Memory footprint: %lu pages loaded, %lu stored, %lu in all (%lu KB)\n", (unsigned long)loaded,
+           (unsigned long)stored, (unsigned long)touched, (unsigned long)(touched * GUEST_PAGE_SIZE >> 10));
+
+    HotInstruction *hot = (HotInstruction *)allocate(CODE_WORDS, sizeof(HotInstruction));
+    size_t numHot = 0;
+    for (size_t i = 0; i < CODE_WORDS; i++) {
+        if (total->counts[i] != 0) {
+            hot[numHot++] = (HotInstruction){.pc = i * INSTR_BYTES, .count = total->counts[i]};
+        }
+    }
+    qsort(hot, numHot, sizeof(HotInstruction), compareHotness);
+    printf("Hottest instructions:\n");
+    for (size_t i = 0; i < numHot && i < (size_t)top; i++) {
+        printf("  0x%08lx %14lu %6.1f%%", (unsigned long)hot[i].pc, (unsigned long)hot[i].count,
+               percent(hot[i].count, total->instructions));
+        uint64_t taken = total->taken[hot[i].pc / INSTR_BYTES];
+        if (taken != 0) {
+            printf("  taken %.1f%%", percent(taken, hot[i].count));
+        }
+        printf("\n");
+    }
+    free(hot);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: emutrace [--jobs=<n>] [--top=<n>] <file.trace>\n");
+    exit(EXIT_FAILURE);
+}
+
+static int parseCount(const char *value, int max)
+{
+    char *end;
+    unsigned long count = strtoul(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || count == 0 || count > (unsigned long)max) {
+        fprintf(stderr, "Invalid count: %s, use 1 to %d\n", value, max);
+        usage();
+    }
+    return (int)count;
+}
+
+// Map the trace at path, checking its magic
+static const uint8_t *mapTrace(const char *path, size_t *length)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0) {
+        perror("Could not open the trace");
+        exit(EXIT_FAILURE);
+    }
+    *length = (size_t)status.st_size;
+    const uint8_t *trace = (*length >= TRACE_MAGIC_LENGTH)
+                               ? (const uint8_t *)mmap(NULL, *length, PROT_READ, MAP_PRIVATE, fd, 0)
+                               : MAP_FAILED;
+    close(fd);
+    if (trace == MAP_FAILED || memcmp(trace, TRACE_MAGIC, TRACE_MAGIC_LENGTH) != 0) {
+        fprintf(stderr, "Not a trace: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    madvise((void *)trace, *length, MADV_SEQUENTIAL);
+    return trace;
+}
+
+//
+// Main Program
+//
+int main(int argc, char **argv)
+{
+    const char *path = NULL;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int jobs = (cores > 0 && cores <= MAX_JOBS) ? (int)cores : 1;
+    int top = DEFAULT_TOP;
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], JOBS_FLAG, strlen(JOBS_FLAG))) {
+            jobs = parseCount(argv[i] + strlen(JOBS_FLAG), MAX_JOBS);
+        } else if (!strncmp(argv[i], TOP_FLAG, strlen(TOP_FLAG))) {
+            top = parseCount(argv[i] + strlen(TOP_FLAG), CODE_WORDS);
+        } else if (argv[i][0] == '-' || path != NULL) {
+            usage();
+        } else {
+            path = argv[i];
+        }
+    }
+    if (path == NULL) {
+        usage();
+    }
+
+    Analysis analysis = {.next = TRACE_MAGIC_LENGTH};
+    analysis.trace = mapTrace(path, &analysis.length);
+    pthread_mutex_init(&analysis.lock, NULL);
+    Worker *workers = (Worker *)allocate(jobs, sizeof(Worker));
+    for (int i = 0; i < jobs; i++) {
+        workers[i].analysis = &analysis;
+        workers[i].counts = (uint64_t *)allocate(CODE_WORDS, sizeof(uint64_t));
+        workers[i].taken = (uint64_t *)allocate(CODE_WORDS, sizeof(uint64_t));
+        workers[i].loaded = (uint64_t *)allocate(BITMAP_WORDS, sizeof(uint64_t));
+        workers[i].stored = (uint64_t *)allocate(BITMAP_WORDS, sizeof(uint64_t));
+        if (pthread_create(&workers[i].thread, NULL, runWorker, &workers[i]) != 0) {
+            perror("Failed to start a worker thread.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < jobs; i++) {
+        pthread_join(workers[i].thread, NULL);
+        if (i > 0) {
+            mergeWorker(&workers[0], &workers[i]);
+        }
+    }
+
+    int result = EXIT_SUCCESS;
+    if (analysis.damaged) {
+        fprintf(stderr, "The trace is cut short or damaged, the report covers the chunks that decoded.\n");
+        result = EXIT_FAILURE;
+    }
+    writeReport(&workers[0], top);
+
+    for (int i = 0; i < jobs; i++) {
+        free(workers[i].counts);
+        free(workers[i].taken);
+        free(workers[i].loaded);
+        free(workers[i].stored);
+    }
+    free(workers);
+    pthread_mutex_destroy(&analysis.lock);
+    munmap((void *)analysis.trace, analysis.length);
+    return result;
+}
@@ -1,14 +1,48 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "structs.h"
+
 // Execute Functions
 
-extern struct EmulatorState state;
+extern _Thread_local struct EmulatorState *state;
+
+extern _Thread_local uint64_t transferAddress;
+
+extern void updateFlagsArithmetic(int64_t a, int64_t b, bool sf, bool isAdd);
+
+extern void updateFlagsAnd(int64_t a, int64_t b, bool sf);
+
+extern int shift(int64_t value, int64_t *op, int8_t amount, uint8_t mode, bool nbits);
+
+extern void loadFromMemory(uint64_t addr, int64_t *reg, bool sf);
+
+extern void invalidateCode(uint64_t addr, int bytes);
+
+extern void storeToMemory(uint64_t addr, int64_t reg, bool sf);
+
+extern int executeArithmeticImmediate(Instruction instruction);
+
+extern int executeWideMove(Instruction instruction);
 
 extern int executeDPI(Instruction instruction);
 
+extern void readOperandsDPR(struct DPR dpr, int64_t *Rn, int64_t *Rm);
+
+extern int executeArithmeticRegister(Instruction instruction);
+
+extern int executeLogicalRegister(Instruction instruction);
+
+extern int executeMultiply(Instruction instruction);
+
 extern int executeDPR(Instruction instruction);
 
 extern int executeSDT(Instruction instruction);
 
+extern int executeBranchUnconditional(Instruction instruction);
+
+extern int executeBranchConditional(Instruction instruction);
+
+extern int executeBranchRegister(Instruction instruction);
+
 extern int executeB(Instruction instruction);
\ No newline at end of file
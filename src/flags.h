@@ -0,0 +1,109 @@
+#ifndef FLAGS_H
+#define FLAGS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "constants.h"
+#include "datatypes_em.h"
+
+// Condition Flags
+// Shared by execute and the fused handlers, so both set bit-identical flags.
+// Flag-setting instructions only record their operands in state->pendingFlags,
+// NZCV is worked out when a conditional branch or the final state reads it.
+
+// Operation recorded in state->pendingFlags
+enum FlagOp {
+    FLAGS_EVALUATED, // pstate is up to date
+    FLAGS_ADD,
+    FLAGS_SUB,
+    FLAGS_AND,
+};
+
+// NZCV of a + b or a - b, with a and b already masked to the operand width
+static inline struct PSTATE arithmeticFlags(int64_t a, int64_t b, bool sf, bool isAdd) {
+    int64_t res = isAdd ? a + b : a - b;
+    struct PSTATE flags;
+
+    // Sign Flag (N)
+    flags.N = sf ? (res < 0) : ((int32_t)res < 0);
+    // Zero Flag (Z)
+    flags.Z = (res == 0);
+    // Carry Flag (C)
+    flags.C = isAdd ? (sf ? ((uint64_t)res < (uint64_t)a)
+                          : ((uint32_t)res < (uint32_t)a))
+                    : (sf ? ((uint64_t)a >= (uint64_t)b)
+                          : ((uint32_t)a >= (uint32_t)b));
+    // Overflow Flag (V)
+    flags.V = isAdd ? (sf ? (((a > 0) == (b > 0)) && ((res > 0) != (a > 0)))
+                          : ((((int32_t)a > 0) == ((int32_t)b > 0)) && (((int32_t)res > 0) != ((int32_t)a > 0))))
+                    : (sf ? (((a > 0) != (b > 0)) && ((res > 0) == (b > 0)))
+                          : ((((int32_t)a > 0) != ((int32_t)b > 0)) && (((int32_t)res > 0) == ((int32_t)b > 0))));
+    return flags;
+}
+
+// NZCV of a & b, with a and b already masked to the operand width
+static inline struct PSTATE andFlags(int64_t a, int64_t b, bool sf) {
+    int64_t res = a & b;
+    struct PSTATE flags;
+
+    // Sign Flag (N)
+    flags.N = (sf == 0) ? ((int32_t)(res & MASK32) < 0)
+                        : (res < 0);
+    // Zero Flag (Z)
+    flags.Z = (res == 0);
+    // Carry Flag (C)
+    flags.C = 0;
+    // Overflow Flag (V)
+    flags.V = 0;
+    return flags;
+}
+
+// Record a flag-setting operation in place of its flags
+static inline void setFlagsLazily(enum FlagOp op, int64_t a, int64_t b, bool sf) {
+    state->pendingFlags.op = op;
+    state->pendingFlags.sf = sf;
+    state->pendingFlags.a = a;
+    state->pendingFlags.b = b;
+}
+
+// Flags as of the last flag-setting operation, without updating pstate
+static inline struct PSTATE currentFlags(void) {
+    struct PendingFlags pending = state->pendingFlags;
+    switch (pending.op) {
+        case FLAGS_ADD:
+            return arithmeticFlags(pending.a, pending.b, pending.sf, true);
+        case FLAGS_SUB:
+            return arithmeticFlags(pending.a, pending.b, pending.sf, false);
+        case FLAGS_AND:
+            return andFlags(pending.a, pending.b, pending.sf);
+        default:
+            return state->pstate;
+    }
+}
+
+// Bring pstate up to date with the last flag-setting operation
+static inline void evaluateFlags(void) {
+    state->pstate = currentFlags();
+    state->pendingFlags.op = FLAGS_EVALUATED;
+}
+
+// Whether a condition tag holds for flags, before its negation is applied
+static inline bool conditionHolds(struct PSTATE flags, uint8_t tag) {
+    switch (tag) {
+        case EQ_NE_TAG: // EQ (equal) - 0000, NE (not equal) - 0001
+            return flags.Z;
+        case GE_LT_TAG: // GE (greater or equal) - 1010, LT (less) - 1011
+            return (flags.N == flags.V);
+        case GT_LE_TAG: // GT (greater) - 1100, LE (less or equal) - 1101
+            return (!flags.Z && (flags.N == flags.V));
+        default: // AL (always) - 1110
+            return true;
+    }
+}
+
+static inline bool isValidCondition(uint8_t tag) {
+    return tag == EQ_NE_TAG || tag == GE_LT_TAG || tag == GT_LE_TAG || tag == ALWAYS_TAG;
+}
+
+#endif
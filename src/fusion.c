@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "block.h"
+#include "constants.h"
+#include "datatypes_em.h"
+#include "execute.h"
+#include "flags.h"
+#include "fusion.h"
+#include "utils_em.h"
+
+// Superinstructions
+// After a block is decoded, common instruction sequences are replaced by a
+// single fused handler on their first op. The remaining ops of the sequence stay
+// in the block, so other engines can still read them, but the fused handler
+// skips over them. Every fused handler leaves exactly the state its ops would
+// have left when run one at a time.
+
+#define MAX_WIDE_MOVE_KEEPS 3 // movk instructions after a movz
+#define MAX_POST_INDEX_RUN 4  // consecutive post-index transfers
+
+#define DISPATCH_FUSED(op) TAIL_CALL return (op + op->fused + 1)->handler(op + op->fused + 1)
+
+_Thread_local bool fusionEnabled = true;
+
+static const char *fusionNames[] = {
+    "compare-branch", "wide-move", "post-index"};
+
+static _Thread_local uint64_t fusionCounts[NUM_FUSIONS]; // executions of each fused handler
+
+//
+// Fused Handlers
+//
+// Second half of a compare-and-branch, the condition is tested on flags that never
+// go through state, and only the ones it reads are worked out
+static enum BlockExit branchOn(struct PSTATE flags, struct B b)
+{
+    if (conditionHolds(flags, b.cond.tag) ^ b.cond.neg) {
+        state->PC += INSTR_BYTES + ((int64_t)b.simm19) * INSTR_BYTES;
+    } else {
+        state->PC += 2 * INSTR_BYTES;
+    }
+    fusionCounts[FUSION_COMPARE_BRANCH]++;
+    return BLOCK_NEXT;
+}
+
+// adds / subs (immediate), b.cond, with the shifted immediate in op->value
+static enum BlockExit runCompareImmediateBranch(Op *op)
+{
+    struct DPI dpi = op->instruction.dpi;
+    int64_t *Rd = (dpi.rd == ZR_SP) ? &state->SP : &state->R[dpi.rd];
+    int64_t Rn = (dpi.rn == ZR_SP) ? state->SP : state->R[dpi.rn];
+    bool isAdd = (dpi.opc == ADD_SETFLAGS);
+
+    maskTo32Bits(dpi.sf, &Rn);
+    if (dpi.rd != ZR_SP) {
+        *Rd = isAdd ? Rn + op->value : Rn - op->value;
+    }
+    maskTo32Bits(dpi.sf, Rd);
+    setFlagsLazily(isAdd ? FLAGS_ADD : FLAGS_SUB, Rn, op->value, dpi.sf);
+    return branchOn(arithmeticFlags(Rn, op->value, dpi.sf, isAdd), (op + 1)->instruction.b);
+}
+
+// adds / subs (shifted register), b.cond
+static enum BlockExit runCompareRegisterBranch(Op *op)
+{
+    struct DPR dpr = op->instruction.dpr;
+    int64_t *Rd = &state->R[dpr.rd];
+    int64_t Rn, Rm, op2;
+    bool isAdd = (dpr.opc == ADD_SETFLAGS);
+
+    readOperandsDPR(dpr, &Rn, &Rm);
+    shift(Rm, &op2, dpr.operand, dpr.shift, dpr.sf);
+    if (dpr.rd != ZR_SP) {
+        *Rd = isAdd ? Rn + op2 : Rn - op2;
+    }
+    maskTo32Bits(dpr.sf, Rd);
+    setFlagsLazily(isAdd ? FLAGS_ADD : FLAGS_SUB, Rn, op2, dpr.sf);
+    return branchOn(arithmeticFlags(Rn, op2, dpr.sf, isAdd), (op + 1)->instruction.b);
+}
+
+// movz, movk..., with the final register value in op->value
+static enum BlockExit runWideMoveConstant(Op *op)
+{
+    state->R[op->instruction.dpi.rd] = op->value;
+    state->PC += (op->fused + 1) * INSTR_BYTES;
+    fusionCounts[FUSION_WIDE_MOVE]++;
+    DISPATCH_FUSED(op);
+}
+
+// ldr / str [xn], #simm9, for each op of the run
+static enum BlockExit runPostIndex(Op *op)
+{
+    fusionCounts[FUSION_POST_INDEX]++;
+    for (Op *transfer = op; transfer <= op + op->fused; transfer++) {
+        struct SDT sdt = transfer->instruction.sdt;
+        int64_t *Xn = (sdt.xn == ZR_SP) ? &state->SP : &state->R[sdt.xn];
+
+        maskTo32Bits(sdt.sf, &state->R[sdt.rt]);
+        uint64_t targetAddress = *Xn;
+        *Xn += (int64_t)sdt.simm9;
+        if (sdt.l == 1) {
+            loadFromMemory(targetAddress, &state->R[sdt.rt], sdt.sf);
+        } else {
+            storeToMemory(targetAddress, state->R[sdt.rt], sdt.sf);
+        }
+        state->PC += INSTR_BYTES;
+
+        // A store into the running block ends it, as in the unfused handler
+        if (blocksModified) {
+            return BLOCK_NEXT;
+        }
+    }
+    DISPATCH_FUSED(op);
+}
+
+//
+// Fusion Stage
+//
+// Same result as executeWideMove, for movz and movk
+static int64_t wideMoveValue(int64_t value, struct DPI dpi)
+{
+    uint64_t imm16 = ((uint64_t)dpi.imm16) << (dpi.hw * WIDEMOVE_SHIFT);
+    if (dpi.opc == MOVE_WITH_ZERO) {
+        value = imm16;
+    } else {
+        int64_t mask = MASK16 << (dpi.hw * 16);
+        value = (value & ~mask) | imm16;
+    }
+    maskTo32Bits(dpi.sf, &value);
+    return value;
+}
+
+static bool isWideMove(Instruction *instruction, uint8_t opc)
+{
+    return instruction->instructionType == isDPI
+           && instruction->dpi.opi == WIDEMOVE
+           && instruction->dpi.opc == opc;
+}
+
+static bool isPostIndex(Instruction *instruction)
+{
+    struct SDT sdt = instruction->sdt;
+    return instruction->instructionType == isSDT
+           && sdt.mode == 1 && sdt.u == 0 && sdt.offmode == 0 && sdt.i == 0;
+}
+
+// Each matcher fuses the sequence at ops and returns its length, or 0 if there is none
+static int fuseCompareBranch(Op *ops, int remaining)
+{
+    if (remaining < 2) {
+        return 0;
+    }
+    Instruction *compare = &ops[0].instruction;
+    Instruction *branch = &ops[1].instruction;
+    if (branch->instructionType != isB || branch->b.type != BRANCH_CONDITIONAL
+        || !isValidCondition(branch->b.cond.tag)) {
+        return 0;
+    }
+
+    if (compare->instructionType == isDPI && compare->dpi.opi == ARITHMETIC
+        && (compare->dpi.opc == ADD_SETFLAGS || compare->dpi.opc == SUB_SETFLAGS)) {
+        ops[0].handler = runCompareImmediateBranch;
+        ops[0].value = ((int64_t)compare->dpi.imm12) << (ARITHMETIC_SHIFT * compare->dpi.sh);
+    } else if (compare->instructionType == isDPR && compare->dpr.m == 0 && compare->dpr.armOrLog == 1
+               && (compare->dpr.opc == ADD_SETFLAGS || compare->dpr.opc == SUB_SETFLAGS)) {
+        ops[0].handler = runCompareRegisterBranch;
+    } else {
+        return 0;
+    }
+    ops[0].fused = 1;
+    return 2;
+}
+
+static int fuseWideMove(Op *ops, int remaining)
+{
+    struct DPI movz = ops[0].instruction.dpi;
+    if (!isWideMove(&ops[0].instruction, MOVE_WITH_ZERO) || movz.rd == ZR_SP) {
+        return 0;
+    }
+
+    int keeps = 0;
+    while (keeps < MAX_WIDE_MOVE_KEEPS && keeps + 1 < remaining
+           && isWideMove(&ops[keeps + 1].instruction, MOVE_WITH_KEEP)
+           && ops[keeps + 1].instruction.dpi.rd == movz.rd) {
+        keeps++;
+    }
+    if (keeps == 0) {
+        return 0;
+    }
+
+    int64_t value = 0;
+    for (int i = 0; i <= keeps; i++) {
+        value = wideMoveValue(value, ops[i].instruction.dpi);
+    }
+    ops[0].handler = runWideMoveConstant;
+    ops[0].fused = keeps;
+    ops[0].value = value;
+    return keeps + 1;
+}
+
+static int fusePostIndex(Op *ops, int remaining)
+{
+    int run = 0;
+    while (run < MAX_POST_INDEX_RUN && run < remaining && isPostIndex(&ops[run].instruction)) {
+        run++;
+    }
+    if (run == 0) {
+        return 0;
+    }
+    ops[0].handler = runPostIndex;
+    ops[0].fused = run - 1;
+    return run;
+}
+
+// Replace the handlers of fusable sequences among the length decoded ops
+void fuseOps(Op *ops, int length)
+{
+    int i = 0;
+    while (i < length) {
+        int fused = fuseCompareBranch(ops + i, length - i);
+        if (fused == 0) {
+            fused = fuseWideMove(ops + i, length - i);
+        }
+        if (fused == 0) {
+            fused = fusePostIndex(ops + i, length - i);
+        }
+        i += (fused == 0) ? 1 : fused;
+    }
+}
+
+void writeFusionReport(FILE *file)
+{
+    fprintf(file, "%-16s %14s\n", "Fusion", "Executions");
+    for (int fusion = 0; fusion < NUM_FUSIONS; fusion++) {
+        fprintf(file, "%-16s %14lu\n", fusionNames[fusion], (unsigned long)fusionCounts[fusion]);
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef FUSION_H
+#define FUSION_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "block.h"
+
+// Fused instruction sequences
+enum Fusion {
+    FUSION_COMPARE_BRANCH, // adds / subs followed by b.cond
+    FUSION_WIDE_MOVE,      // movz followed by one to three movk into the same register
+    FUSION_POST_INDEX,     // consecutive post-index ldr / str
+    NUM_FUSIONS,
+};
+
+// Fusion is applied to every block built while this is set
+extern _Thread_local bool fusionEnabled;
+
+// Prototypes
+extern void fuseOps(Op *ops, int length);
+extern void writeFusionReport(FILE *file);
+
+#endif
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "constants.h"
+#include "datatypes_em.h"
+#include "flags.h"
+#include "io_em.h"
+#include "memory_em.h"
+
+// Emulator State
+extern _Thread_local struct EmulatorState *state;
+
+//
+// IO Handling
+//
+int readToMemory(FILE *file)
+{
+    // Regular files are mapped, their pages are read in as the program touches them
+    struct stat status;
+    if (fstat(fileno(file), &status) == 0 && S_ISREG(status.st_mode)
+        && mapImage(fileno(file), status.st_size) == EXIT_SUCCESS) {
+        return EXIT_SUCCESS;
+    }
+
+    // Anything else is copied a page at a time, so only the pages of the image are allocated
+    uint8_t buffer[GUEST_PAGE_SIZE];
+    uint64_t numberOfBytes = 0;
+    while (numberOfBytes < state->memory.size) {
+        uint64_t remaining = state->memory.size - numberOfBytes;
+        size_t chunk = fread(buffer, 1, (remaining < sizeof(buffer)) ? remaining : sizeof(buffer), file);
+        if (chunk == 0) {
+            break;
+        }
+        copyToMemory(numberOfBytes, buffer, chunk);
+        numberOfBytes += chunk;
+    }
+    if (numberOfBytes == 0) {
+        perror("The file is empty.");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+void writeFinalState(FILE *file)
+{
+    fprintf(file, "Registers:\n");
+    writeRegisters(file);
+    writeNonZeroMemory(file);
+}
+
+// X00-X30, PC and PSTATE of the core in state
+void writeRegisters(FILE *file)
+{
+    evaluateFlags();
+    for (int i = 0; i < NUM_OF_REGISTERS; i++) {
+        fprintf(file, "X%d%d    = %016lx\n", i / 10, i % 10, state->R[i]);
+    }
+    fprintf(file, "PC     = %016lx\n", state->PC);
+    fprintf(file, "PSTATE : %c%c%c%c",
+            state->pstate.N ? 'N' : '-',
+            state->pstate.Z ? 'Z' : '-',
+            state->pstate.C ? 'C' : '-',
+            state->pstate.V ? 'V' : '-');
+    fprintf(file, "\n");
+}
+
+void writeNonZeroMemory(FILE *file)
+{
+    fprintf(file, "Non-Zero Memory:\n");
+    // Only dirty pages can hold non-zero memory, skip zeros a doubleword at a time
+    struct DirtyPage *pages;
+    size_t numPages = sortDirtyPages(&pages);
+    for (size_t i = 0; i < numPages; i++) {
+        uint64_t base = pages[i].page << GUEST_PAGE_SHIFT;
+        uint8_t *page = pages[i].host;
+        for (size_t offset = 0; offset < GUEST_PAGE_SIZE; offset += MODE64_BYTES) {
+            if (loadLittle64(&page[offset]) == 0) {
+                continue;
+            }
+            for (size_t word = offset; word < offset + MODE64_BYTES; word += INSTR_BYTES) {
+                uint32_t binInstr = loadLittle32(&page[word]);
+                if (binInstr != 0) {
+                    fprintf(file, "0x%08lx : %08x\n", (unsigned long)(base + word), binInstr);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,12 @@
+#ifndef IO_EM_H
+#define IO_EM_H
+
+#include <stdio.h>
+
+// Prototypes
+extern int readToMemory(FILE *file);
+extern void writeFinalState(FILE *file);
+extern void writeRegisters(FILE *file);
+extern void writeNonZeroMemory(FILE *file);
+
+#endif
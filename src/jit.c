@@ -0,0 +1,917 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "block.h"
+#include "constants.h"
+#include "datatypes_em.h"
+#include "execute.h"
+#include "flags.h"
+#include "jit.h"
+#include "liveness.h"
+#include "pipeline.h"
+#include "threaded.h"
+
+// x86-64 JIT
+// Blocks are translated into native code on first use. Data processing, loads
+// and stores and direct branches are emitted inline, each instruction reading its
+// registers from state and writing its result straight back. Flag-setting
+// instructions record their operands in state->pendingFlags like setFlagsLazily.
+// Loads and stores look their address up in the TLB inline; a miss or an access
+// that crosses a page runs executeSDT instead, from untouched state. Anything
+// else calls its execute function, so both engines share the same semantics.
+// Direct branches end in a patchable jmp: the first time one is taken it exits
+// to runJit, which compiles the target and rewrites the jmp to go straight there.
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+
+#include "memory_em.h"
+
+#define CODE_SIZE (32 * 1024 * 1024) // 32MB
+#define MAX_INSTR_CODE 192           // upper bound on bytes emitted per instruction
+#define MAX_EXIT_CODE 256            // upper bound on bytes emitted for a block exit
+
+// Guest state offsets, rbx holds state inside translated code.
+// R[ZR_SP] is ZR, the field after R, as the execute functions also assume.
+#define OFFSET_R(n) (offsetof(struct EmulatorState, R) + (n) * sizeof(int64_t))
+#define OFFSET_SP offsetof(struct EmulatorState, SP)
+#define OFFSET_PC offsetof(struct EmulatorState, PC)
+#define OFFSET_INSTRUCTIONS offsetof(struct EmulatorState, instructions)
+#define OFFSET_INSTRUCTION_LIMIT offsetof(struct EmulatorState, instructionLimit)
+#define OFFSET_N offsetof(struct EmulatorState, pstate.N)
+#define OFFSET_Z offsetof(struct EmulatorState, pstate.Z)
+#define OFFSET_V offsetof(struct EmulatorState, pstate.V)
+#define OFFSET_FLAG_OP offsetof(struct EmulatorState, pendingFlags.op)
+#define OFFSET_FLAG_SF offsetof(struct EmulatorState, pendingFlags.sf)
+#define OFFSET_FLAG_A offsetof(struct EmulatorState, pendingFlags.a)
+#define OFFSET_FLAG_B offsetof(struct EmulatorState, pendingFlags.b)
+#define OFFSET_TLB (offsetof(struct EmulatorState, memory) + offsetof(struct GuestMemory, tlb))
+#define OFFSET_TLB_PAGE (OFFSET_TLB + offsetof(struct TlbEntry, page))
+#define OFFSET_TLB_HOST (OFFSET_TLB + offsetof(struct TlbEntry, host))
+
+// x86-64 encoding used by the emitter
+#define REX_W 0x48
+#define JMP_REL32 0xE9
+#define JCC_PREFIX 0x0F
+#define JNZ_REL32 0x85
+#define JZ_REL32 0x84
+#define JA_REL32 0x87
+#define JAE_REL32 0x83
+#define JB_REL32 0x82
+#define REL32_BYTES 4
+
+// Host registers by their ModRM number, rbx holds state
+enum HostRegister {
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3,
+    RSI = 6,
+    RDI = 7,
+};
+
+#define MODRM_REGISTERS(reg, rm) (0xC0 | ((reg) << 3) | (rm)) // reg, rm
+#define MODRM_INDIRECT(reg, rm) (((reg) << 3) | (rm))         // reg, [rm]
+#define MODRM_STATE(reg) (0x80 | ((reg) << 3) | RBX)          // reg, [rbx + disp32]
+#define MODRM_TLB(reg) (0x80 | ((reg) << 3) | 0x04)           // reg, [rbx + rcx + disp32] with SIB_TLB
+#define SIB_TLB ((RCX << 3) | RBX)
+
+// Opcodes of the op r/m64, r64 forms
+#define OP_ADD 0x01
+#define OP_OR 0x09
+#define OP_AND 0x21
+#define OP_SUB 0x29
+#define OP_XOR 0x31
+#define OP_STORE 0x89 // mov r/m, r
+#define OP_LOAD 0x8B  // mov r, r/m
+
+// ModRM extensions of the immediate (0x81) and shift (0xC1) groups
+#define EXT_ADD 0
+#define EXT_SUB 5
+#define EXT_CMP 7
+#define EXT_ROR 1
+#define EXT_SHL 4
+#define EXT_SHR 5
+#define EXT_SAR 7
+
+// Entry: push rbx; mov rbx, rsi; jmp rdi
+typedef uintptr_t (*EnterFunc)(void *code, struct EmulatorState *machine);
+
+static _Thread_local uint8_t *codeBuffer = NULL;
+static _Thread_local uint8_t *codeEnd = NULL;   // first free byte
+static _Thread_local uint8_t *codeStart = NULL; // first byte after the shared stubs
+static _Thread_local unsigned long codeGeneration = 0; // bumped on every flush, stale exits are never patched
+
+// Shared stubs at the start of the buffer
+static _Thread_local EnterFunc enter;
+static _Thread_local uint8_t *exitStub;  // pop rbx; ret, with the exit value already in rax
+static _Thread_local uint8_t *errorExit; // return BLOCK_ERROR
+static _Thread_local uint8_t *nextExit;  // return BLOCK_NEXT, PC is already up to date
+
+//
+// Emitter
+//
+static void emit8(uint8_t byte)
+{
+    *codeEnd++ = byte;
+}
+
+static void emit32(uint32_t value)
+{
+    memcpy(codeEnd, &value, sizeof(value));
+    codeEnd += sizeof(value);
+}
+
+static void emit64(uint64_t value)
+{
+    memcpy(codeEnd, &value, sizeof(value));
+    codeEnd += sizeof(value);
+}
+
+// Point the rel32 at site (its last 4 bytes) to target
+static void patchRel32(uint8_t *end, uint8_t *target)
+{
+    int32_t rel = (int32_t)(target - end);
+    memcpy(end - REL32_BYTES, &rel, sizeof(rel));
+}
+
+static void emitJump(uint8_t *target)
+{
+    emit8(JMP_REL32);
+    emit32(0);
+    patchRel32(codeEnd, target);
+}
+
+static void emitJumpIf(uint8_t cc, uint8_t *target)
+{
+    emit8(JCC_PREFIX);
+    emit8(cc);
+    emit32(0);
+    patchRel32(codeEnd, target);
+}
+
+// jcc to a target emitted later, returns the site to patch
+static uint8_t *emitForwardJumpIf(uint8_t cc)
+{
+    emitJumpIf(cc, codeEnd);
+    return codeEnd;
+}
+
+static uint8_t *emitForwardJump(void)
+{
+    emitJump(codeEnd);
+    return codeEnd;
+}
+
+// mov reg, [rbx + offset]
+static void emitLoad(enum HostRegister reg, size_t offset)
+{
+    emit8(REX_W);
+    emit8(OP_LOAD);
+    emit8(MODRM_STATE(reg));
+    emit32(offset);
+}
+
+// mov [rbx + offset], reg
+static void emitStore(enum HostRegister reg, size_t offset)
+{
+    emit8(REX_W);
+    emit8(OP_STORE);
+    emit8(MODRM_STATE(reg));
+    emit32(offset);
+}
+
+// mov byte [rbx + offset], value
+static void emitStoreByte(size_t offset, uint8_t value)
+{
+    emit8(0xC6);
+    emit8(MODRM_STATE(0));
+    emit32(offset);
+    emit8(value);
+}
+
+// movzx reg, byte [rbx + offset]
+static void emitLoadFlag(enum HostRegister reg, size_t offset)
+{
+    emit8(0x0F);
+    emit8(0xB6);
+    emit8(MODRM_STATE(reg));
+    emit32(offset);
+}
+
+// mov reg, value, with the shorter zero-extending form where it fits
+static void emitMoveImmediate(enum HostRegister reg, uint64_t value)
+{
+    if (value <= UINT32_MAX) {
+        emit8(0xB8 + reg);
+        emit32(value);
+        return;
+    }
+    emit8(REX_W);
+    emit8(0xB8 + reg);
+    emit64(value);
+}
+
+// op dst, src on the whole registers
+static void emitAlu(uint8_t opcode, enum HostRegister dst, enum HostRegister src)
+{
+    emit8(REX_W);
+    emit8(opcode);
+    emit8(MODRM_REGISTERS(src, dst));
+}
+
+// op reg, value, with value sign-extended
+static void emitAluImmediate(uint8_t extension, enum HostRegister reg, int32_t value)
+{
+    emit8(REX_W);
+    emit8(0x81);
+    emit8(MODRM_REGISTERS(extension, reg));
+    emit32(value);
+}
+
+// Shift or rotate reg by a constant, on its low half unless wide
+static void emitShift(uint8_t extension, enum HostRegister reg, uint8_t amount, bool wide)
+{
+    if (amount == 0) {
+        return;
+    }
+    if (wide) {
+        emit8(REX_W);
+    }
+    emit8(0xC1);
+    emit8(MODRM_REGISTERS(extension, reg));
+    emit8(amount);
+}
+
+// mov r32, r32 clears the top half of reg
+static void emitMaskTo32Bits(enum HostRegister reg, bool sf)
+{
+    if (sf == 0) {
+        emit8(OP_STORE);
+        emit8(MODRM_REGISTERS(reg, reg));
+    }
+}
+
+// maskTo32Bits on a register of the guest that is not otherwise written
+static void emitMaskInPlace(size_t offset, bool sf)
+{
+    if (sf == 0) {
+        emitLoad(RAX, offset);
+        emitMaskTo32Bits(RAX, sf);
+        emitStore(RAX, offset);
+    }
+}
+
+// mov qword [rbx + PC], addr
+static void emitSetPC(uint32_t addr)
+{
+    emit8(REX_W);
+    emit8(0xC7);
+    emit8(MODRM_STATE(0));
+    emit32(OFFSET_PC);
+    emit32(addr);
+}
+
+// Call function, with its arguments already in rdi and rsi
+static void emitCallFunction(uintptr_t function)
+{
+    emitMoveImmediate(RAX, function);
+    emit8(0xFF); // call rax
+    emit8(0xD0);
+}
+
+// Call helper(op), leaving to errorExit if it fails
+static void emitCall(int (*helper)(Op *), Op *op)
+{
+    emitMoveImmediate(RDI, (uintptr_t)op);
+    emitCallFunction((uintptr_t)helper);
+    emit8(0x85); // test eax, eax
+    emit8(0xC0);
+    emitJumpIf(JNZ_REL32, errorExit);
+}
+
+// mov eax, value; jmp exitStub
+static void emitReturn(uint32_t value)
+{
+    emit8(0xB8);
+    emit32(value);
+    emitJump(exitStub);
+}
+
+// Exit to the block at target through a jmp that runJit can later patch
+static void emitChainExit(uint32_t target)
+{
+    emitSetPC(target);
+    uint8_t *site = emitForwardJump();
+    patchRel32(site, codeEnd);
+
+    // Until patched, the jmp lands here and hands the site to runJit
+    emitMoveImmediate(RAX, (uintptr_t)site);
+    emitJump(exitStub);
+}
+
+static void emitStubs(void)
+{
+    codeEnd = codeBuffer;
+
+    uint8_t *entry = codeEnd;
+    emit8(0x53); // push rbx
+    emit8(REX_W);
+    emit8(0x89); // mov rbx, rsi
+    emit8(0xF3);
+    emit8(0xFF); // jmp rdi
+    emit8(0xE7);
+    memcpy(&enter, &entry, sizeof(enter));
+
+    exitStub = codeEnd;
+    emit8(0x5B); // pop rbx
+    emit8(0xC3); // ret
+
+    errorExit = codeEnd;
+    emitReturn(BLOCK_ERROR);
+    nextExit = codeEnd;
+    emitReturn(BLOCK_NEXT);
+
+    codeStart = codeEnd;
+}
+
+//
+// Helpers
+//
+// Instructions without an inline translation run through their execute function
+#define JIT_HELPER(name, executeFunction)      \
+    static int name(Op *op)                    \
+    {                                          \
+        return executeFunction(op->instruction); \
+    }
+
+JIT_HELPER(helperWideMove, executeWideMove)
+JIT_HELPER(helperSDT, executeSDT)
+JIT_HELPER(helperBranchConditional, executeBranchConditional)
+JIT_HELPER(helperBranchRegister, executeBranchRegister)
+JIT_HELPER(helperExecute, execute)
+
+static void helperEvaluateFlags(void)
+{
+    evaluateFlags();
+}
+
+//
+// Translation
+//
+static size_t offsetOfDPIRegister(uint8_t reg)
+{
+    return (reg == ZR_SP) ? OFFSET_SP : OFFSET_R(reg);
+}
+
+// Record a flag-setting operation like setFlagsLazily, with a in rax and b in rcx
+static void emitSetFlagsLazily(enum FlagOp flagOp, bool sf)
+{
+    emitStoreByte(OFFSET_FLAG_OP, flagOp);
+    emitStoreByte(OFFSET_FLAG_SF, sf);
+    emitStore(RAX, OFFSET_FLAG_A);
+    emitStore(RCX, OFFSET_FLAG_B);
+}
+
+// Rd = mask(a +- b) with a in rax and b in rcx, as addOrSub and the mask after it.
+// The flag-setting forms leave a zero register destination unwritten but masked.
+static void emitAddOrSub(uint8_t opc, size_t rd, bool toZero, bool sf)
+{
+    bool isAdd = (opc == ADD || opc == ADD_SETFLAGS);
+
+    if (opc == ADD_SETFLAGS || opc == SUB_SETFLAGS) {
+        emitSetFlagsLazily((isAdd) ? FLAGS_ADD : FLAGS_SUB, sf);
+        if (toZero) {
+            emitMaskInPlace(rd, sf);
+            return;
+        }
+    }
+    emitAlu((isAdd) ? OP_ADD : OP_SUB, RAX, RCX);
+    emitMaskTo32Bits(RAX, sf);
+    emitStore(RAX, rd);
+}
+
+static void translateArithmeticImmediate(struct DPI dpi)
+{
+    int64_t imm = ((int64_t)dpi.imm12) << (ARITHMETIC_SHIFT * dpi.sh);
+
+    emitLoad(RAX, offsetOfDPIRegister(dpi.rn));
+    emitMaskTo32Bits(RAX, dpi.sf);
+    emitMoveImmediate(RCX, imm);
+    emitAddOrSub(dpi.opc, offsetOfDPIRegister(dpi.rd), dpi.rd == ZR_SP, dpi.sf);
+}
+
+static bool translateWideMove(struct DPI dpi)
+{
+    uint64_t widthMask = (dpi.sf) ? UINT64_MAX : MASK32;
+    uint64_t imm16 = ((uint64_t)dpi.imm16) << (dpi.hw * WIDEMOVE_SHIFT);
+    size_t rd = offsetOfDPIRegister(dpi.rd);
+
+    if (dpi.rd == ZR_SP) { // Only the width mask reaches SP
+        emitMaskInPlace(rd, dpi.sf);
+        return true;
+    }
+    switch (dpi.opc) {
+        case MOVE_WITH_NOT:
+            emitMoveImmediate(RAX, ~imm16 & widthMask);
+            break;
+        case MOVE_WITH_ZERO:
+            emitMoveImmediate(RAX, imm16 & widthMask);
+            break;
+        case MOVE_WITH_KEEP: {
+            uint64_t mask = MASK16 << (dpi.hw * WIDEMOVE_SHIFT);
+            emitLoad(RAX, rd);
+            emitMoveImmediate(RCX, ~mask & widthMask);
+            emitAlu(OP_AND, RAX, RCX);
+            emitMoveImmediate(RCX, imm16 & widthMask);
+            emitAlu(OP_OR, RAX, RCX);
+            break;
+        }
+        default:
+            return false;
+    }
+    emitStore(RAX, rd);
+    return true;
+}
+
+// Rn into rax and Rm shifted by the operand into rcx, both masked to the width, as
+// readOperandsDPR and shift work them out. Rn reads as ZR when Rm is the zero register.
+static void emitOperandsDPR(struct DPR dpr, bool shifted)
+{
+    static const uint8_t shiftExtensions[] = {EXT_SHL, EXT_SHR, EXT_SAR, EXT_ROR}; // by shift mode
+
+    emitLoad(RAX, OFFSET_R((dpr.rm != ZR_SP) ? dpr.rn : ZR_SP));
+    emitLoad(RCX, OFFSET_R(dpr.rm));
+    emitMaskTo32Bits(RAX, dpr.sf);
+    emitMaskTo32Bits(RCX, dpr.sf);
+    if (shifted) {
+        emitShift(shiftExtensions[dpr.shift], RCX, dpr.operand % ((dpr.sf) ? MODE64 : MODE32), dpr.sf);
+    }
+}
+
+static void translateArithmeticRegister(struct DPR dpr)
+{
+    emitOperandsDPR(dpr, true);
+    emitAddOrSub(dpr.opc, OFFSET_R(dpr.rd), dpr.rd == ZR_SP, dpr.sf);
+}
+
+static void translateLogicalRegister(struct DPR dpr)
+{
+    static const uint8_t opcodes[] = {OP_AND, OP_OR, OP_XOR, OP_AND}; // by opc
+
+    emitOperandsDPR(dpr, true);
+    if (dpr.n == 1) {
+        emit8(REX_W); // not rcx
+        emit8(0xF7);
+        emit8(MODRM_REGISTERS(2, RCX));
+    }
+    if (dpr.opc == BITWISE_AND_SETFLAGS) {
+        emitSetFlagsLazily(FLAGS_AND, dpr.sf);
+        if (dpr.rd == ZR_SP) {
+            emitMaskInPlace(OFFSET_R(ZR_SP), dpr.sf);
+            return;
+        }
+    }
+    emitAlu(opcodes[dpr.opc], RAX, RCX);
+    emitMaskTo32Bits(RAX, dpr.sf);
+    emitStore(RAX, OFFSET_R(dpr.rd));
+}
+
+static void translateMultiply(struct DPR dpr)
+{
+    if (dpr.rd == ZR_SP) {
+        emitMaskInPlace(OFFSET_R(ZR_SP), dpr.sf);
+        return;
+    }
+    emitOperandsDPR(dpr, false);
+    emit8(REX_W); // imul rax, rcx
+    emit8(0x0F);
+    emit8(0xAF);
+    emit8(MODRM_REGISTERS(RAX, RCX));
+    emitLoad(RDX, OFFSET_R(dpr.ra));
+    emitAlu((dpr.x == 0) ? OP_ADD : OP_SUB, RDX, RAX);
+    emitMaskTo32Bits(RDX, dpr.sf);
+    emitStore(RDX, OFFSET_R(dpr.rd));
+}
+
+// Loads and stores, leaving PC unsynced. The address is worked out into rdi and
+// looked up in the TLB. A hit does the writeback and the transfer inline, anything
+// else has not changed the guest yet and runs executeSDT.
+static void translateSDT(Op *op, uint32_t pc)
+{
+    struct SDT sdt = op->instruction.sdt;
+    int bytes = (sdt.sf) ? MODE64_BYTES : MODE32_BYTES;
+    size_t rt = OFFSET_R(sdt.rt);
+    size_t xn = offsetOfDPIRegister(sdt.xn);
+    bool writeback = (sdt.mode == 1 && sdt.u == 0 && sdt.offmode == 0);
+    bool load = (sdt.mode == 0 || sdt.l == 1);
+
+    // executeSDT masks Rt before anything else, doing it twice changes nothing
+    emitMaskInPlace(rt, sdt.sf);
+
+    if (sdt.mode == 1) {
+        emitLoad(RDI, xn);
+        if (sdt.u == 1) { // Unsigned Immediate Offset
+            emitAluImmediate(EXT_ADD, RDI, (uint16_t)(sdt.imm12 * bytes));
+        } else if (sdt.offmode == 0) { // Pre/Post - Index
+            if (sdt.i) {
+                emitAluImmediate(EXT_ADD, RDI, sdt.simm9);
+            }
+        } else { // Register Offset, Xm reads SP along with Xn
+            emit8(REX_W); // add rdi, [rbx + Xm]
+            emit8(0x03);
+            emit8(MODRM_STATE(RDI));
+            emit32((sdt.xn == ZR_SP) ? OFFSET_SP : OFFSET_R(sdt.xm));
+        }
+    } else { // Load Literal
+        emitMoveImmediate(RDI, (uint64_t)(pc + ((int64_t)sdt.simm19) * INSTR_BYTES));
+    }
+
+    // rax = page, rcx = offset of its TLB entry
+    emitAlu(OP_STORE, RAX, RDI);
+    emitShift(EXT_SHR, RAX, GUEST_PAGE_SHIFT, true);
+    emit8(0x0F); // movzx ecx, al
+    emit8(0xB6);
+    emit8(MODRM_REGISTERS(RCX, RAX));
+    emit8(0x69); // imul ecx, ecx, sizeof(struct TlbEntry)
+    emit8(MODRM_REGISTERS(RCX, RCX));
+    emit32(sizeof(struct TlbEntry));
+    emit8(REX_W); // cmp rax, [rbx + rcx + page]
+    emit8(0x3B);
+    emit8(MODRM_TLB(RAX));
+    emit8(SIB_TLB);
+    emit32(OFFSET_TLB_PAGE);
+    uint8_t *miss = emitForwardJumpIf(JNZ_REL32);
+
+    // The access must not run past the end of the page
+    emit8(OP_STORE); // mov eax, edi
+    emit8(MODRM_REGISTERS(RDI, RAX));
+    emit8(0x25); // and eax, GUEST_PAGE_SIZE - 1
+    emit32(GUEST_PAGE_SIZE - 1);
+    emit8(0x3D); // cmp eax, GUEST_PAGE_SIZE - bytes
+    emit32(GUEST_PAGE_SIZE - bytes);
+    uint8_t *crossing = emitForwardJumpIf(JA_REL32);
+    emit8(REX_W); // add rax, [rbx + rcx + host]
+    emit8(0x03);
+    emit8(MODRM_TLB(RAX));
+    emit8(SIB_TLB);
+    emit32(OFFSET_TLB_HOST);
+
+    if (writeback) {
+        emitLoad(RDX, xn);
+        emitAluImmediate(EXT_ADD, RDX, sdt.simm9);
+        emitStore(RDX, xn);
+    }
+    if (load) { // mov edx / rdx, [rax]
+        if (sdt.sf) {
+            emit8(REX_W);
+        }
+        emit8(OP_LOAD);
+        emit8(MODRM_INDIRECT(RDX, RAX));
+        emitStore(RDX, rt);
+    } else { // mov [rax], edx / rdx
+        emitLoad(RDX, rt);
+        if (sdt.sf) {
+            emit8(REX_W);
+        }
+        emit8(OP_STORE);
+        emit8(MODRM_INDIRECT(RDX, RAX));
+    }
+    emitMoveImmediate(RCX, (uintptr_t)&transferAddress);
+    emit8(REX_W); // mov [rcx], rdi
+    emit8(OP_STORE);
+    emit8(MODRM_INDIRECT(RDI, RCX));
+    if (!load) { // Only the code window can hold translated code
+        emit8(REX_W); // cmp rdi, MEMORY_SIZE
+        emit8(0x81);
+        emit8(MODRM_REGISTERS(EXT_CMP, RDI));
+        emit32(MEMORY_SIZE);
+        uint8_t *outside = emitForwardJumpIf(JAE_REL32);
+        emitMoveImmediate(RSI, bytes);
+        emitCallFunction((uintptr_t)invalidateCode);
+        patchRel32(outside, codeEnd);
+    }
+    uint8_t *done = emitForwardJump();
+
+    patchRel32(miss, codeEnd);
+    patchRel32(crossing, codeEnd);
+    emitSetPC(pc);
+    emitCall(helperSDT, op);
+    patchRel32(done, codeEnd);
+
+    if (!load) {
+        // A store into translated code ends the block
+        emitMoveImmediate(RCX, (uintptr_t)&blocksModified);
+        emit8(0x80); // cmp byte [rcx], 0
+        emit8(0x39);
+        emit8(0x00);
+        uint8_t *unmodified = emitForwardJumpIf(JZ_REL32);
+        emitSetPC(pc + INSTR_BYTES);
+        emitJump(nextExit);
+        patchRel32(unmodified, codeEnd);
+    }
+}
+
+// Bring pstate up to date if a flag-setting instruction left it stale
+static void emitEvaluateFlags(void)
+{
+    emit8(0x80); // cmp byte [rbx + pendingFlags.op], FLAGS_EVALUATED
+    emit8(MODRM_STATE(EXT_CMP));
+    emit32(OFFSET_FLAG_OP);
+    emit8(FLAGS_EVALUATED);
+    uint8_t *evaluated = emitForwardJumpIf(JZ_REL32);
+    emitCallFunction((uintptr_t)helperEvaluateFlags);
+    patchRel32(evaluated, codeEnd);
+}
+
+// Leave the condition of a conditional branch in eax, false if it has no inline form
+static bool translateCondition(struct B b)
+{
+    if (!isValidCondition(b.cond.tag)) {
+        return false;
+    }
+    emitEvaluateFlags();
+    switch (b.cond.tag) {
+        case EQ_NE_TAG: // Z
+            emitLoadFlag(RAX, OFFSET_Z);
+            break;
+        case GE_LT_TAG: // N == V
+        case GT_LE_TAG: // !Z && N == V
+            emitLoadFlag(RAX, OFFSET_N);
+            emitLoadFlag(RCX, OFFSET_V);
+            emit8(0x39); // cmp eax, ecx
+            emit8(0xC8);
+            emit8(0x0F); // sete al
+            emit8(0x94);
+            emit8(0xC0);
+            emit8(0x0F); // movzx eax, al
+            emit8(0xB6);
+            emit8(0xC0);
+            if (b.cond.tag == GT_LE_TAG) {
+                emitLoadFlag(RCX, OFFSET_Z);
+                emit8(0x83); // xor ecx, 1
+                emit8(0xF1);
+                emit8(0x01);
+                emit8(0x21); // and eax, ecx
+                emit8(0xC8);
+            }
+            break;
+        case ALWAYS_TAG:
+            emit8(0xB8); // mov eax, 1
+            emit32(1);
+            break;
+        default:
+            return false;
+    }
+    if (b.cond.neg) {
+        emit8(0x83); // xor eax, 1
+        emit8(0xF0);
+        emit8(0x01);
+    }
+    return true;
+}
+
+static void translateBranch(Op *op, uint32_t pc)
+{
+    struct B b = op->instruction.b;
+
+    switch (b.type) {
+        case BRANCH_UNCONDITIONAL:
+            emitChainExit(pc + ((int64_t)b.simm26) * INSTR_BYTES);
+            return;
+        case BRANCH_CONDITIONAL: {
+            if (!translateCondition(b)) {
+                emitSetPC(pc);
+                emitCall(helperBranchConditional, op);
+                emitJump(nextExit);
+                return;
+            }
+            emit8(0x85); // test eax, eax
+            emit8(0xC0);
+            uint8_t *notTaken = emitForwardJumpIf(JZ_REL32);
+            emitChainExit(pc + ((int64_t)b.simm19) * INSTR_BYTES);
+            patchRel32(notTaken, codeEnd);
+            emitChainExit(pc + INSTR_BYTES);
+            return;
+        }
+        case BRANCH_REGISTER:
+            emitSetPC(pc);
+            emitCall(helperBranchRegister, op);
+            emitJump(nextExit);
+            return;
+        default:
+            emitSetPC(pc);
+            emitCall(helperExecute, op);
+            emitJump(nextExit);
+            return;
+    }
+}
+
+// Translate one instruction other than a branch, false if it has no inline form
+static bool translateInstruction(Op *op, uint32_t pc)
+{
+    Instruction *instruction = &(op->instruction);
+
+    switch (instruction->instructionType) {
+        case isDPI:
+            switch (instruction->dpi.opi) {
+                case ARITHMETIC:
+                    translateArithmeticImmediate(instruction->dpi);
+                    return true;
+                case WIDEMOVE:
+                    return translateWideMove(instruction->dpi);
+            }
+            return false;
+        case isDPR:
+            if (instruction->dpr.m == 1) {
+                translateMultiply(instruction->dpr);
+            } else if (instruction->dpr.armOrLog == 1) {
+                translateArithmeticRegister(instruction->dpr);
+            } else {
+                translateLogicalRegister(instruction->dpr);
+            }
+            return true;
+        case isSDT:
+            translateSDT(op, pc);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Pick the execute function used for an instruction without an inline form
+static int (*selectHelper(Instruction *instruction))(Op *)
+{
+    if (instruction->instructionType == isDPI && instruction->dpi.opi == WIDEMOVE) {
+        return helperWideMove;
+    }
+    return helperExecute;
+}
+
+static void translateBlock(Block *block)
+{
+    block->code = codeEnd;
+    uint32_t pc = block->start;
+    bool syncedPC = true; // state->PC == pc
+
+    // Leave before counting the block once the run has used up its instruction limit.
+    // The check is emitted whatever the limit of the run that translates the block:
+    // limit - 1 < instructions, where a limit of 0 wraps around and is never reached.
+    if (block->length > 0) {
+        emitLoad(RAX, OFFSET_INSTRUCTION_LIMIT);
+        emitAluImmediate(EXT_SUB, RAX, 1);
+        emit8(REX_W); // cmp rax, [rbx + instructions]
+        emit8(0x3B);
+        emit8(MODRM_STATE(RAX));
+        emit32(OFFSET_INSTRUCTIONS);
+        emitJumpIf(JB_REL32, errorExit);
+    }
+
+    emit8(REX_W); // add qword [rbx + instructions], length
+    emit8(0x81);
+    emit8(MODRM_STATE(EXT_ADD));
+    emit32(OFFSET_INSTRUCTIONS);
+    emit32(block->length);
+
+    if (block->deadFlags > 0) {
+        emitMoveImmediate(RAX, (uintptr_t)&flagUpdatesEliminated);
+        emit8(REX_W); // add qword [rax], deadFlags
+        emit8(0x81);
+        emit8(MODRM_INDIRECT(EXT_ADD, RAX));
+        emit32(block->deadFlags);
+    }
+
+    for (int i = 0; i < block->length; i++, pc += INSTR_BYTES) {
+        Op *op = &(block->ops[i]);
+
+        if (op->instruction.instructionType == isB) {
+            translateBranch(op, pc);
+            return;
+        }
+        if (translateInstruction(op, pc)) {
+            syncedPC = false;
+            continue;
+        }
+
+        // Execute functions read and advance PC themselves
+        if (!syncedPC) {
+            emitSetPC(pc);
+        }
+        emitCall(selectHelper(&(op->instruction)), op);
+        syncedPC = true;
+    }
+
+    if (block->halts) {
+        emitSetPC(pc);
+        emitReturn(BLOCK_HALT);
+    } else {
+        emitChainExit(pc);
+    }
+}
+
+//
+// Code Buffer
+//
+// The buffer and its stubs stay mapped between runs on a thread
+static void initializeCode(void)
+{
+    if (codeBuffer != NULL) {
+        codeEnd = codeStart;
+        return;
+    }
+    void *buffer = mmap(NULL, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+        perror("Failed to map memory for the JIT.\n");
+        exit(EXIT_FAILURE);
+    }
+    codeBuffer = (uint8_t *)buffer;
+    emitStubs();
+}
+
+void freeJit(void)
+{
+    if (codeBuffer != NULL) {
+        munmap(codeBuffer, CODE_SIZE);
+        codeBuffer = NULL;
+    }
+}
+
+// Throw away every block together with its translation
+static void flushCode(void)
+{
+    flushBlocks();
+    codeEnd = codeStart;
+    codeGeneration++;
+}
+
+// Find the translation of the block at addr, compiling it if needed
+static int lookupCode(uint64_t addr, Block **block)
+{
+    if (lookupBlock(addr, block) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    if ((*block)->code != NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    size_t worstCase = ((*block)->length + 1) * MAX_INSTR_CODE + MAX_EXIT_CODE;
+    if (codeEnd + worstCase > codeBuffer + CODE_SIZE) {
+        flushCode();
+        if (lookupBlock(addr, block) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+    translateBlock(*block);
+    return EXIT_SUCCESS;
+}
+
+int runJit(void)
+{
+    Block *block;
+    uintptr_t result = BLOCK_NEXT;
+    initializeBlocks();
+    initializeCode();
+
+    while (result != BLOCK_HALT && result != BLOCK_ERROR) {
+        uint8_t *site = (result == BLOCK_NEXT) ? NULL : (uint8_t *)result;
+        if (blocksModified) {
+            flushCode();
+            site = NULL;
+        }
+        unsigned long generation = codeGeneration;
+
+        if (lookupCode(state->PC, &block) != EXIT_SUCCESS) {
+            result = BLOCK_ERROR;
+            break;
+        }
+        // Chain the exit we came from, unless the buffer was flushed under it
+        if (site != NULL && generation == codeGeneration) {
+            patchRel32(site, block->code);
+        }
+        result = enter(block->code, state);
+    }
+
+    flushBlocks();
+    return (result == BLOCK_HALT) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#else
+
+// Other hosts keep running on the threaded interpreter
+int runJit(void)
+{
+    fprintf(stderr, "The JIT needs an x86-64 host, using the threaded engine.\n");
+    return runThreaded();
+}
+
+void freeJit(void)
+{
+}
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef JIT_H
+#define JIT_H
+
+// Prototypes
+extern int runJit(void);
+extern void freeJit(void);
+
+#endif
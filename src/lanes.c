@@ -0,0 +1,746 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "constants.h"
+#include "datatypes_em.h"
+#include "decoders.h"
+#include "flags.h"
+#include "lanes.h"
+#include "memory_em.h"
+#include "structs.h"
+
+// Lockstep Lanes
+// Runs up to MAX_LANES guests in lockstep, each with its own memory, decoding
+// every instruction once for all of them. Registers are kept one array per
+// register, a lane to an element, and every instruction computes all lanes at
+// once with vector operations, blending the results into the lanes it runs for.
+// Each step runs the lanes whose PC is the lowest, and only those that fetched
+// the same word there, so lanes split when a conditional branch goes both ways
+// and join again once the lanes left behind reach the same PC. A lane only
+// fetches a word again after storing over it, so lanes running the same code
+// share the fetch as well. Loads and stores go to each lane's memory one lane
+// at a time. Lanes running different programs rarely share a step, they are
+// best run apart.
+// Lanes take the place of the engine. On 64 runs of a hash kernel with different
+// inputs, one worker ran about 29M guest instructions/s on the reference engine,
+// 115M with 16 lanes two to a vector, 270-300M with 16 lanes eight to a vector,
+// 210-245M on the threaded engine and 585M on the JIT. Lanes are worth using on
+// AVX-512 hosts, for many runs of one program whose branches mostly agree; where
+// lanes split often, as in loops run a different number of times in each lane,
+// the threaded engine is faster.
+// Every lane ends in exactly the state a run of its own would have left, down
+// to the register quirks of execute.c, which is why those are copied below.
+
+// Vector width. lanes_avx512.c builds this file again with eight lanes in a
+// vector, and runLanes hands the lanes to it on hosts with AVX-512. Otherwise
+// AVX2 builds hold four lanes in a vector and SSE2 builds two.
+#if defined(LANES_WIDE)
+#define CHUNK_BYTES 64
+#define RUN_LANES runLanesWide
+#elif defined(__AVX2__)
+#define CHUNK_BYTES 32
+#define RUN_LANES runLanesNarrow
+#else
+#define CHUNK_BYTES 16
+#define RUN_LANES runLanesNarrow
+#endif
+#define CHUNK_LANES ((int)(CHUNK_BYTES / sizeof(int64_t)))
+#define NUM_CHUNKS (MAX_LANES / CHUNK_LANES)
+#define LANE(reg, lane) ((reg)[(lane) / CHUNK_LANES][(lane) % CHUNK_LANES])
+#define ZR_LANES NUM_OF_REGISTERS // R[31] reaches state->ZR in execute.c, so it is the zero register here
+#define DECODED_ENTRIES 1024
+
+typedef int64_t LaneChunk __attribute__((vector_size(CHUNK_BYTES)));
+typedef uint64_t LaneChunkUnsigned __attribute__((vector_size(CHUNK_BYTES)));
+typedef LaneChunk LaneRegister[NUM_CHUNKS]; // one register of every lane
+typedef uint32_t LaneMask;                    // bit i stands for lane i
+
+typedef struct {
+    LaneRegister R[NUM_OF_REGISTERS + 1];
+    LaneRegister SP;
+    LaneRegister PC;
+    LaneRegister instructions;
+    LaneRegister active;  // all ones for the lanes the current instruction runs for
+    LaneRegister laneBit; // the bit of activeMask each lane stands for
+    LaneRegister flagOp;  // pending flags of each lane, as in state->pendingFlags
+    LaneRegister flagSf;
+    LaneRegister flagA;
+    LaneRegister flagB;
+    LaneMask activeMask;  // active as a bit mask
+    LaneMask runningMask; // lanes that have not halted or failed
+    bool together;        // every running lane is at groupPC, so no search for the lowest PC is needed
+    uint64_t groupPC;
+    bool limited; // some lane has an instruction limit
+    struct PSTATE pstate[MAX_LANES];
+    struct EmulatorState **states;
+    int numLanes;
+    int results[MAX_LANES];
+} Lanes;
+
+// Decoded words by PC. Lanes in verified are known to hold word at pc, they are
+// taken out again by their stores over it, so only the others fetch it.
+typedef struct {
+    uint64_t pc;
+    uint32_t word;
+    LaneMask verified;
+    bool decoded;
+    Instruction instruction;
+} DecodedWord;
+
+static _Thread_local DecodedWord decoded[DECODED_ENTRIES];
+
+//
+// Vector Helpers
+//
+static inline LaneChunk blend(LaneChunk mask, LaneChunk a, LaneChunk b)
+{
+    return (mask & a) | (~mask & b);
+}
+
+static inline LaneChunk broadcast(int64_t value)
+{
+    return (LaneChunk){0} + value;
+}
+
+static inline LaneChunk mask32(bool sf, LaneChunk value)
+{
+    return sf ? value : (value & MASK32);
+}
+
+// Write value into the active lanes of reg
+static inline void setActive(Lanes *lanes, LaneRegister reg, const LaneRegister value)
+{
+    for (int c = 0; c < NUM_CHUNKS; c++) {
+        reg[c] = blend(lanes->active[c], value[c], reg[c]);
+    }
+}
+
+static inline void maskActive(Lanes *lanes, LaneRegister reg, bool sf)
+{
+    if (!sf) {
+        for (int c = 0; c < NUM_CHUNKS; c++) {
+            reg[c] = blend(lanes->active[c], reg[c] & MASK32, reg[c]);
+        }
+    }
+}
+
+static inline void advancePC(Lanes *lanes)
+{
+    for (int c = 0; c < NUM_CHUNKS; c++) {
+        lanes->PC[c] += lanes->active[c] & INSTR_BYTES;
+    }
+}
+
+static inline bool isActive(Lanes *lanes, int lane)
+{
+    return (lanes->activeMask >> lane) & 1;
+}
+
+static inline int lowestLane(LaneMask mask)
+{
+    return __builtin_ctz(mask);
+}
+
+// The lanes of mask in a bit mask
+static inline LaneMask maskOf(Lanes *lanes, const LaneRegister mask)
+{
+    LaneChunk bits = {0};
+    for (int c = 0; c < NUM_CHUNKS; c++) {
+        bits |= mask[c] & lanes->laneBit[c];
+    }
+    LaneMask result = 0;
+    for (int i = 0; i < CHUNK_LANES; i++) {
+        result |= bits[i];
+    }
+    return result;
+}
+
+static inline void setActiveMask(Lanes *lanes, LaneMask mask)
+{
+    LaneChunk bits = broadcast(mask);
+    lanes->activeMask = mask;
+    for (int c = 0; c < NUM_CHUNKS; c++) {
+        lanes->active[c] = (bits & lanes->laneBit[c]) != 0;
+    }
+}
+
+static void failLane(Lanes *lanes, int lane)
+{
+    LANE(lanes->active, lane) = 0;
+    lanes->activeMask &= ~(1U << lane);
+    lanes->runningMask &= ~(1U << lane);
+    lanes->results[lane] = EXIT_FAILURE;
+}
+
+static void failActive(Lanes *lanes)
+{
+    for (int lane = 0; lane < lanes->numLanes; lane++) {
+        if (isActive(lanes, lane)) {
+            failLane(lanes, lane);
+        }
+    }
+}
+
+// Record a flag-setting operation in the active lanes, as setFlagsLazily does
+static void setFlagsActive(Lanes *lanes, enum FlagOp op, const LaneRegister a, const LaneRegister b, bool sf)
+{
+    for (int c = 0; c < NUM_CHUNKS; c++) {
+        LaneChunk active = lanes->active[c];
+        lanes->flagOp[c] = blend(active, broadcast(op), lanes->flagOp[c]);
+        lanes->flagSf[c] = blend(active, broadcast(sf), lanes->flagSf[c]);
+        lanes->flagA[c] = blend(active, a[c], lanes->flagA[c]);
+        lanes->flagB[c] = blend(active, b[c], lanes->flagB[c]);
+    }
+}
+
+// Flags of one lane, brought up to date as evaluateFlags does
+static struct PSTATE laneFlags(Lanes *lanes, int lane)
+{
+    int64_t a = LANE(lanes->flagA, lane);
+    int64_t b = LANE(lanes->flagB, lane);
+    bool sf = LANE(lanes->flagSf, lane);
+    switch (LANE(lanes->flagOp, lane)) {
+        case FLAGS_ADD:
+            lanes->pstate[lane] = arithmeticFlags(a, b, sf, true);
+            break;
+        case FLAGS_SUB:
+            lanes->pstate[lane] = arithmeticFlags(a, b, sf, false);
+            break;
+        case FLAGS_AND:
+            lanes->pstate[lane] = andFlags(a, b, sf);
+            break;
+    }
+    LANE(lanes->flagOp, lane) = FLAGS_EVALUATED;
+    return lanes->pstate[lane];
+}
+
+//
+// Data Processing
+//
+// Rd of addOrSub in execute.c: the result is not written for a flag-setting rd 31
+static void addOrSubActive(Lanes *lanes, uint8_t opc, uint8_t rd, bool sf, LaneRegister Rd,
+                           const LaneRegister a, const LaneRegister b)
+{
+    bool isAdd = (opc == ADD || opc == ADD_SETFLAGS);
+    bool setsFlags = (opc == ADD_SETFLAGS || opc == SUB_SETFLAGS);
+    LaneRegister result;
+    for (int c = 0; c < NUM_CHUNKS; c++) {
+        result[c] = isAdd ? a[c] + b[c] : a[c] - b[c];
+    }
+    if (!setsFlags || rd != ZR_SP) {
+        setActive(lanes, Rd, result);
+    }
+    if (setsFlags) {
+        setFlagsActive(lanes, isAdd ? FLAGS_ADD : FLAGS_SUB, a, b, sf);
+    }
+}
+
+static int executeDPILanes(Lanes *lanes, struct DPI dpi)
+{
+    LaneChunk *Rd = (dpi.rd == ZR_SP) ? lanes->SP : lanes->R[dpi.rd];
+    if (dpi.opi == ARITHMETIC) {
+        int64_t imm12 = ((int64_t)dpi.imm12) << (ARITHMETIC_SHIFT * dpi.sh);
+        const LaneChunk *Xn = (dpi.rn == ZR_SP) ? lanes->SP : lanes->R[dpi.rn];
+        LaneRegister Rn;
+        LaneRegister imm;
+        for (int c = 0; c < NUM_CHUNKS; c++) {
+            Rn[c] = mask32(dpi.sf, Xn[c]);
+            imm[c] = broadcast(imm12);
+        }
+        addOrSubActive(lanes, dpi.opc, dpi.rd, dpi.sf, Rd, Rn, imm);
+    } else if (dpi.opi == WIDEMOVE) {
+        if (dpi.rd != ZR_SP) {
+            uint64_t imm16 = ((uint64_t)dpi.imm16) << (dpi.hw * WIDEMOVE_SHIFT);
+            int64_t keep = ~(MASK16 << (dpi.hw * 16));
+            LaneRegister result;
+            for (int c = 0; c < NUM_CHUNKS; c++) {
+                switch (dpi.opc) {
+                    case MOVE_WITH_NOT:
+                        result[c] = broadcast(~imm16);
+                        break;
+                    case MOVE_WITH_ZERO:
+                        result[c] = broadcast(imm16);
+                        break;
+                    case MOVE_WITH_KEEP:
+                        result[c] = (Rd[c] & keep) | (int64_t)imm16;
+                        break;
+                    default:
+                        perror("Unsupported wide move type (bits 29-30), use either 00, 10 or 11.\n");
+                        return EXIT_FAILURE;
+                }
+            }
+            setActive(lanes, Rd, result);
+        }
+    } else {
+        perror("Unsupported opi (bits 23-25), use either 010 or 101.\n");
+        return EXIT_FAILURE;
+    }
+    maskActive(lanes, Rd, dpi.sf);
+    advancePC(lanes);
+    return EXIT_SUCCESS;
+}
+
+// shift in execute.c, for every lane
+static void shiftLanes(const LaneRegister value, LaneRegister op, int8_t amount, uint8_t mode, bool sf)
+{
+    amount %= (sf) ? MODE64 : MODE32;
+    for (int c = 0; c < NUM_CHUNKS; c++) {
+        LaneChunk v = value[c];
+        LaneChunkUnsigned u = (LaneChunkUnsigned)v;
+        LaneChunkUnsigned u32 = (LaneChunkUnsigned)(v & MASK32);
+        switch (mode) {
+            case LOGICAL_SHIFT_LEFT:
+                op[c] = sf ? (v << amount) : ((v << amount) & MASK32);
+                break;
+            case LOGICAL_SHIFT_RIGHT:
+                op[c] = sf ? (LaneChunk)(u >> amount) : (LaneChunk)(u32 >> amount);
+                break;
+            case ARITHMETIC_SHIFT_RIGHT:
+                op[c] = sf ? (v >> amount) : (((v << MODE32) >> (MODE32 + amount)) & MASK32);
+                break;
+            default: // ROTATE_RIGHT, a shift by the full width moves nothing, as on x86
+                if (sf) {
+                    op[c] = (LaneChunk)(u >> amount) | ((amount == 0) ? v : (v << (MODE64 - amount)));
+                } else {
+                    op[c] = ((LaneChunk)(u32 >> amount) | (v << (MODE32 - amount))) & MASK32;
+                }
+                break;
+        }
+    }
+}
+
+static int executeDPRLanes(Lanes *lanes, struct DPR dpr)
+{
+    LaneChunk *Rd = lanes->R[dpr.rd];
+    // As readOperandsDPR, rm 31 reads the zero register for both operands
+    const LaneChunk *Xm = lanes->R[(dpr.rm != ZR_SP) ? dpr.rm : ZR_LANES];
+    const LaneChunk *Xn = lanes->R[(dpr.rm != ZR_SP) ? dpr.rn : ZR_LANES];
+    LaneRegister Rn;
+    LaneRegister Rm;
+    LaneRegister result;
+    for (int c = 0; c < NUM_CHUNKS; c++) {
+        Rm[c] = mask32(dpr.sf, Xm[c]);
+        Rn[c] = mask32(dpr.sf, Xn[c]);
+    }
+
+    if (dpr.m == 1) { // Multiply
+        if (dpr.rd != ZR_SP) {
+            const LaneChunk *Ra = lanes->R[(dpr.ra != ZR_SP) ? dpr.ra : ZR_LANES];
+            for (int c = 0; c < NUM_CHUNKS; c++) {
+                result[c] = (dpr.x == 0) ? Ra[c] + Rn[c] * Rm[c] : Ra[c] - Rn[c] * Rm[c];
+            }
+            setActive(lanes, Rd, result);
+        }
+    } else if (dpr.armOrLog == 1) { // Arithmetic
+        LaneRegister op2;
+        shiftLanes(Rm, op2, dpr.operand, dpr.shift, dpr.sf);
+        addOrSubActive(lanes, dpr.opc, dpr.rd, dpr.sf, Rd, Rn, op2);
+    } else { // Logical
+        LaneRegister op2;
+        shiftLanes(Rm, op2, dpr.operand, dpr.shift, dpr.sf);
+        for (int c = 0; c < NUM_CHUNKS; c++) {
+            if (dpr.n == 1) {
+                op2[c] = ~op2[c];
+            }
+            switch (dpr.opc) {
+                case BITWISE_OR:
+                    result[c] = Rn[c] | op2[c];
+                    break;
+                case BITWISE_XOR:
+                    result[c] = Rn[c] ^ op2[c];
+                    break;
+                default: // BITWISE_AND and BITWISE_AND_SETFLAGS
+                    result[c] = Rn[c] & op2[c];
+                    break;
+            }
+        }
+        if (dpr.opc != BITWISE_AND_SETFLAGS || dpr.rd != ZR_SP) {
+            setActive(lanes, Rd, result);
+        }
+        if (dpr.opc == BITWISE_AND_SETFLAGS) {
+            setFlagsActive(lanes, FLAGS_AND, Rn, op2, dpr.sf);
+        }
+    }
+    maskActive(lanes, Rd, dpr.sf);
+    advancePC(lanes);
+    return EXIT_SUCCESS;
+}
+
+//
+// Single Data Transfer
+//
+static int64_t loadLane(struct GuestMemory *memory, uint64_t addr, bool sf)
+{
+    int bytes = (sf) ? MODE64_BYTES : MODE32_BYTES;
+    uint8_t *host = lookupTlbIn(memory, addr, bytes);
+    if (host != NULL) {
+        return (sf) ? (int64_t)loadLittle64(host) : (int64_t)loadLittle32(host);
+    }
+    return (int64_t)readMemoryIn(memory, addr, bytes);
+}
+
+// The lane has to fetch the words a store to addr overwrote again before running them
+static void forgetWords(int lane, uint64_t addr, int bytes)
+{
+    uint64_t first = (addr < INSTR_BYTES) ? 0 : (addr - INSTR_BYTES + 1) / INSTR_BYTES;
+    for (uint64_t index = first; index <= (addr + bytes - 1) / INSTR_BYTES; index++) {
+        DecodedWord *entry = &decoded[index % DECODED_ENTRIES];
+        if (entry->pc < addr + bytes && entry->pc + INSTR_BYTES > addr) {
+            entry->verified &= ~(1U << lane);
+        }
+    }
+}
+
+static void storeLane(struct GuestMemory *memory, uint64_t addr, int64_t value, bool sf)
+{
+    int bytes = (sf) ? MODE64_BYTES : MODE32_BYTES;
+    uint8_t *host = lookupTlbIn(memory, addr, bytes);
+    if (host == NULL) {
+        writeMemoryIn(memory, addr, value, bytes);
+    } else if (sf) {
+        storeLittle64(host, value);
+    } else {
+        storeLittle32(host, value);
+    }
+}
+
+// Load or store every active lane at its own address, failing the lanes that fault
+static void transferLanes(Lanes *lanes, struct SDT sdt, const LaneRegister addresses)
+{
+    int bytes = (sdt.sf) ? MODE64_BYTES : MODE32_BYTES;
+    bool load = (sdt.mode == 0 || sdt.l == 1);
+    for (int lane = 0; lane < lanes->numLanes; lane++) {
+        if (!isActive(lanes, lane)) {
+            continue;
+        }
+        struct GuestMemory *memory = &lanes->states[lane]->memory;
+        uint64_t addr = LANE(addresses, lane);
+        if (load && isCoreIdAccess(addr, bytes)) {
+            LANE(lanes->R[sdt.rt], lane) = readCoreId(lanes->states[lane]->coreId, addr, bytes);
+        } else if (!inMemory(memory, addr, bytes)) {
+            fprintf(stderr, "Guest memory fault at PC 0x%08lx: address 0x%08lx is outside memory\n",
+                    (unsigned long)LANE(lanes->PC, lane), (unsigned long)addr);
+            failLane(lanes, lane);
+        } else if (load) {
+            LANE(lanes->R[sdt.rt], lane) = loadLane(memory, addr, sdt.sf);
+        } else {
+            storeLane(memory, addr, LANE(lanes->R[sdt.rt], lane), sdt.sf);
+            forgetWords(lane, addr, bytes);
+        }
+    }
+}
+
+static int executeSDTLanes(Lanes *lanes, struct SDT sdt)
+{
+    LaneRegister addresses;
+    maskActive(lanes, lanes->R[sdt.rt], sdt.sf);
+
+    if (sdt.mode == 1) { // Single Data Transfer
+        LaneChunk *Xn = (sdt.xn == ZR_SP) ? lanes->SP : lanes->R[sdt.xn];
+        const LaneChunk *Xm = (sdt.xn == ZR_SP) ? lanes->SP : lanes->R[sdt.xm];
+        for (int c = 0; c < NUM_CHUNKS; c++) {
+            addresses[c] = Xn[c];
+            if (sdt.u == 1) { // Unsigned Immediate Offset
+                uint16_t uoffset = sdt.imm12 * ((sdt.sf) ? MODE64_BYTES : MODE32_BYTES);
+                addresses[c] += uoffset;
+            } else if (sdt.offmode == 0) { // Pre/Post - Index
+                addresses[c] += (sdt.i) ? sdt.simm9 : 0;
+                Xn[c] = blend(lanes->active[c], Xn[c] + (int64_t)sdt.simm9, Xn[c]);
+            } else { // Register Offset
+                addresses[c] += Xm[c];
+            }
+        }
+    } else { // Load Literal
+        for (int c = 0; c < NUM_CHUNKS; c++) {
+            addresses[c] = lanes->PC[c] + ((int64_t)sdt.simm19) * INSTR_BYTES;
+        }
+    }
+    transferLanes(lanes, sdt, addresses);
+    advancePC(lanes);
+    return EXIT_SUCCESS;
+}
+
+//
+// Branches
+//
+static int executeBLanes(Lanes *lanes, struct B b)
+{
+    LaneRegister target;
+    switch (b.type) {
+        case BRANCH_UNCONDITIONAL:
+            for (int c = 0; c < NUM_CHUNKS; c++) {
+                target[c] = lanes->PC[c] + ((int64_t)b.simm26) * INSTR_BYTES;
+            }
+            break;
+        case BRANCH_CONDITIONAL: {
+            if (!isValidCondition(b.cond.tag)) {
+                perror("Unsupported branch condition (bits 1-3), use either 000, 101, 110 or 111.\n");
+                return EXIT_FAILURE;
+            }
+            // Flags differ between lanes, so the condition is worked out one lane at a time
+            LaneRegister taken = {0};
+            for (int lane = 0; lane < lanes->numLanes; lane++) {
+                if (isActive(lanes, lane)) {
+                    LANE(taken, lane) = -(int64_t)(conditionHolds(laneFlags(lanes, lane), b.cond.tag) ^ b.cond.neg);
+                }
+            }
+            for (int c = 0; c < NUM_CHUNKS; c++) {
+                target[c] = lanes->PC[c] + blend(taken[c], broadcast(((int64_t)b.simm19) * INSTR_BYTES),
+                                                 broadcast(INSTR_BYTES));
+            }
+            break;
+        }
+        case BRANCH_REGISTER:
+            for (int c = 0; c < NUM_CHUNKS; c++) {
+                target[c] = lanes->R[(b.xn == ZR_SP) ? ZR_LANES : b.xn][c];
+            }
+            break;
+        default:
+            perror("Unsupported branch type (bits 30-31), use either 00, 01 or 11.\n");
+            return EXIT_FAILURE;
+    }
+    setActive(lanes, lanes->PC, target);
+    return EXIT_SUCCESS;
+}
+
+//
+// Lockstep Loop
+//
+// The word at PC of a lane, 0 after failing the lane if PC is outside its memory
+static uint32_t fetchLane(Lanes *lanes, int lane, uint64_t pc, bool *fetched)
+{
+    struct GuestMemory *memory = &lanes->states[lane]->memory;
+    if (isCoreIdAccess(pc, INSTR_BYTES)) {
+        *fetched = true;
+        return readCoreId(lanes->states[lane]->coreId, pc, INSTR_BYTES);
+    }
+    *fetched = inMemory(memory, pc, INSTR_BYTES);
+    if (!*fetched) {
+        fprintf(stderr, "Guest memory fault at PC 0x%08lx: address 0x%08lx is outside memory\n",
+                (unsigned long)pc, (unsigned long)pc);
+        failLane(lanes, lane);
+        return 0;
+    }
+    uint8_t *host = lookupTlbIn(memory, pc, INSTR_BYTES);
+    return (host != NULL) ? loadLittle32(host) : (uint32_t)readMemoryIn(memory, pc, INSTR_BYTES);
+}
+
+// Activate the running lanes at the lowest PC, false once no lane is running
+static bool selectActive(Lanes *lanes, uint64_t *pc)
+{
+    if (lanes->runningMask == 0) {
+        return false;
+    }
+    if (lanes->together) {
+        *pc = lanes->groupPC;
+        setActiveMask(lanes, lanes->runningMask);
+        return true;
+    }
+
+    int leader = lowestLane(lanes->runningMask);
+    for (int lane = leader + 1; lane < lanes->numLanes; lane++) {
+        if (((lanes->runningMask >> lane) & 1)
+            && (uint64_t)LANE(lanes->PC, lane) < (uint64_t)LANE(lanes->PC, leader)) {
+            leader = lane;
+        }
+    }
+    *pc = LANE(lanes->PC, leader);
+    LaneRegister atPC;
+    for (int c = 0; c < NUM_CHUNKS; c++) {
+        atPC[c] = lanes->PC[c] == (int64_t)*pc;
+    }
+    setActiveMask(lanes, maskOf(lanes, atPC) & lanes->runningMask);
+    return true;
+}
+
+// Narrow the active lanes to those holding the same word at pc as the lowest
+// one, giving its entry, or NULL if that lane faulted or the word is invalid
+static const DecodedWord *verifyActive(Lanes *lanes, uint64_t pc)
+{
+    DecodedWord *entry = &decoded[(pc / INSTR_BYTES) % DECODED_ENTRIES];
+    int leader = lowestLane(lanes->activeMask);
+    LaneMask active = lanes->activeMask;
+    if (entry->pc != pc || !((entry->verified >> leader) & 1)) {
+        bool fetched;
+        uint32_t word = fetchLane(lanes, leader, pc, &fetched);
+        if (!fetched) {
+            return NULL;
+        }
+        if (entry->pc != pc || entry->word != word) {
+            *entry = (DecodedWord){.pc = pc, .word = word};
+        }
+        entry->verified |= 1U << leader;
+    }
+
+    for (LaneMask unverified = active & ~entry->verified; unverified != 0; unverified &= unverified - 1) {
+        int lane = lowestLane(unverified);
+        bool fetched;
+        uint32_t word = fetchLane(lanes, lane, pc, &fetched);
+        if (!fetched) {
+            active &= ~(1U << lane);
+        } else if (word == entry->word) {
+            entry->verified |= 1U << lane;
+        } else {
+            active &= ~(1U << lane); // runs on a later step
+        }
+    }
+    setActiveMask(lanes, active);
+
+    if (!entry->decoded && entry->word != HALT_INSTR) {
+        if (decodeInstruction(entry->word, &entry->instruction) != EXIT_SUCCESS) {
+            failActive(lanes);
+            return NULL;
+        }
+        entry->decoded = true;
+    }
+    return entry;
+}
+
+// Leave the halted lanes and fail those at their instruction limit, false if none are left
+static bool startActive(Lanes *lanes, uint32_t word)
+{
+    if (word == HALT_INSTR) {
+        for (LaneMask halted = lanes->activeMask; halted != 0; halted &= halted - 1) {
+            lanes->results[lowestLane(halted)] = EXIT_SUCCESS;
+        }
+        lanes->runningMask &= ~lanes->activeMask;
+        setActiveMask(lanes, 0);
+        return false;
+    }
+    if (lanes->limited) {
+        for (LaneMask active = lanes->activeMask; active != 0; active &= active - 1) {
+            int lane = lowestLane(active);
+            uint64_t limit = lanes->states[lane]->instructionLimit;
+            if (limit != 0 && (uint64_t)LANE(lanes->instructions, lane) >= limit) {
+                failLane(lanes, lane);
+            }
+        }
+    }
+    return lanes->activeMask != 0;
+}
+
+// Whether all running lanes ran the last step and went to the same PC
+static bool stillTogether(Lanes *lanes)
+{
+    if (lanes->activeMask != lanes->runningMask || lanes->runningMask == 0) {
+        return false;
+    }
+    lanes->groupPC = LANE(lanes->PC, lowestLane(lanes->runningMask));
+    LaneRegister atPC;
+    for (int c = 0; c < NUM_CHUNKS; c++) {
+        atPC[c] = lanes->PC[c] == (int64_t)lanes->groupPC;
+    }
+    return (maskOf(lanes, atPC) & lanes->runningMask) == lanes->runningMask;
+}
+
+static int executeLanes(Lanes *lanes, const Instruction *instruction)
+{
+    switch (instruction->instructionType) {
+        case isDPI:
+            return executeDPILanes(lanes, instruction->dpi);
+        case isDPR:
+            return executeDPRLanes(lanes, instruction->dpr);
+        case isSDT:
+            return executeSDTLanes(lanes, instruction->sdt);
+        case isB:
+            return executeBLanes(lanes, instruction->b);
+    }
+    return EXIT_FAILURE;
+}
+
+static void loadLanes(Lanes *lanes, struct EmulatorState **states, int numLanes)
+{
+    lanes->states = states;
+    lanes->numLanes = numLanes;
+    lanes->limited = false;
+    for (int lane = 0; lane < MAX_LANES; lane++) {
+        // Unused lanes copy the first one and never run
+        struct EmulatorState *state = states[(lane < numLanes) ? lane : 0];
+        for (int r = 0; r < NUM_OF_REGISTERS; r++) {
+            LANE(lanes->R[r], lane) = state->R[r];
+        }
+        LANE(lanes->R[ZR_LANES], lane) = state->ZR;
+        LANE(lanes->SP, lane) = state->SP;
+        LANE(lanes->PC, lane) = state->PC;
+        LANE(lanes->instructions, lane) = state->instructions;
+        LANE(lanes->laneBit, lane) = 1 << lane;
+        LANE(lanes->flagOp, lane) = state->pendingFlags.op;
+        LANE(lanes->flagSf, lane) = state->pendingFlags.sf;
+        LANE(lanes->flagA, lane) = state->pendingFlags.a;
+        LANE(lanes->flagB, lane) = state->pendingFlags.b;
+        lanes->pstate[lane] = state->pstate;
+        lanes->results[lane] = EXIT_FAILURE;
+        lanes->limited |= lane < numLanes && state->instructionLimit != 0;
+    }
+    lanes->runningMask = (1U << numLanes) - 1;
+    lanes->together = false;
+    for (int i = 0; i < DECODED_ENTRIES; i++) {
+        decoded[i].verified = 0; // the lanes are other guests now
+    }
+}
+
+static void storeLanes(Lanes *lanes)
+{
+    for (int lane = 0; lane < lanes->numLanes; lane++) {
+        struct EmulatorState *state = lanes->states[lane];
+        for (int r = 0; r < NUM_OF_REGISTERS; r++) {
+            state->R[r] = LANE(lanes->R[r], lane);
+        }
+        state->ZR = LANE(lanes->R[ZR_LANES], lane);
+        state->SP = LANE(lanes->SP, lane);
+        state->PC = LANE(lanes->PC, lane);
+        state->instructions = LANE(lanes->instructions, lane);
+        state->pendingFlags = (struct PendingFlags){
+            .op = LANE(lanes->flagOp, lane),
+            .sf = LANE(lanes->flagSf, lane),
+            .a = LANE(lanes->flagA, lane),
+            .b = LANE(lanes->flagB, lane),
+        };
+        state->pstate = lanes->pstate[lane];
+    }
+}
+
+// Run the lanes with vectors of CHUNK_BYTES
+void RUN_LANES(struct EmulatorState **states, int numLanes, int *results)
+{
+    Lanes lanes;
+    loadLanes(&lanes, states, numLanes);
+
+    uint64_t pc;
+    while (selectActive(&lanes, &pc)) {
+        const DecodedWord *entry = verifyActive(&lanes, pc);
+        lanes.together = false;
+        if (entry == NULL || !startActive(&lanes, entry->word)) {
+            continue;
+        }
+        if (executeLanes(&lanes, &entry->instruction) != EXIT_SUCCESS) {
+            failActive(&lanes);
+            continue;
+        }
+        for (int c = 0; c < NUM_CHUNKS; c++) {
+            lanes.instructions[c] -= lanes.active[c]; // all ones is -1
+        }
+        lanes.together = stillTogether(&lanes);
+    }
+
+    storeLanes(&lanes);
+    for (int lane = 0; lane < numLanes; lane++) {
+        results[lane] = lanes.results[lane];
+    }
+}
+
+#if !defined(LANES_WIDE)
+// Run numLanes guests from their PCs until each halts or fails, results[i] is the outcome of states[i]
+void runLanes(struct EmulatorState **states, int numLanes, int *results)
+{
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")) {
+        runLanesWide(states, numLanes, results);
+        return;
+    }
+#endif
+    runLanesNarrow(states, numLanes, results);
+}
+#endif
@@ -0,0 +1,12 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include "datatypes_em.h"
+#include "emulator.h"
+
+// Prototypes
+extern void runLanes(struct EmulatorState **states, int numLanes, int *results);
+extern void runLanesNarrow(struct EmulatorState **states, int numLanes, int *results);
+extern void runLanesWide(struct EmulatorState **states, int numLanes, int *results);
+
+#endif
@@ -0,0 +1,7 @@
+// Lockstep lanes with eight lanes in a vector, for hosts with AVX-512.
+// runLanes in lanes.c calls runLanesWide once it has checked the host has it.
+#if defined(__x86_64__)
+#pragma GCC target("avx2,avx512f,avx512vl")
+#endif
+#define LANES_WIDE
+#include "lanes.c"
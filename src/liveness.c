@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "block.h"
+#include "cache.h"
+#include "constants.h"
+#include "datatypes_em.h"
+#include "decoders.h"
+#include "liveness.h"
+#include "pipeline.h"
+#include "utils_em.h"
+
+// Flag Liveness
+// Once the image is loaded, the control-flow graph reachable from address 0 is
+// decoded and a backward dataflow pass finds the flag-setting instructions whose
+// flags are overwritten on every path before a conditional branch reads them.
+// Those instructions are then decoded as their non-flag-setting forms.
+// Every flag-setting instruction writes all of NZCV, so one liveness bit covers
+// the four flags. Anything the pass cannot follow keeps the flags live: the halt
+// instruction (the final state prints them), br, undecodable words, branches out
+// of memory, loads and stores, which may fault and leave the run with the flags
+// visible, and stores, which might also overwrite the code that was analysed. The
+// results are dropped at the first store that actually does. A run with an
+// instruction limit can stop after any instruction, so it is not analysed at all.
+// The tables stay allocated between runs on a thread. Only the entries of the
+// instructions the last analysis reached are set, and resetFlagLiveness clears those.
+
+#define LIVENESS_ENTRIES (MEMORY_SIZE / INSTR_BYTES)
+#define MAX_SUCCESSORS 2
+
+_Thread_local uint64_t flagUpdatesEliminated = 0;
+
+// Instruction reachable from address 0
+typedef struct {
+    uint32_t addr;
+    bool reads;  // reads the flags, or ends execution with them visible
+    bool writes; // sets every flag
+    bool exits;  // control leaves the analysed code
+    uint8_t rd;  // destination of a flag-setting instruction
+    int numSuccessors;
+    uint32_t successors[MAX_SUCCESSORS];
+    bool liveIn; // flags may be read before being written, from this instruction on
+} Node;
+
+static _Thread_local bool *reached = NULL;      // word decoded as reachable code, indexed by addr / 4
+static _Thread_local bool *deadFlags = NULL;    // flag-setting instruction whose flags are never read
+static _Thread_local bool analysisValid = false; // cleared by the first store into analysed code
+static _Thread_local uint64_t numSetters = 0;
+static _Thread_local uint64_t numDead = 0;
+static _Thread_local Node *nodes = NULL;        // instructions reached by the last analysis, NULL if none ran
+static _Thread_local int numNodes = 0;
+static _Thread_local int32_t *nodeIndex = NULL; // maps addr / 4 to index + 1, zero again between analyses
+static _Thread_local uint32_t *worklist = NULL;
+
+static bool setsFlags(Instruction *instruction)
+{
+    switch (instruction->instructionType) {
+        case isDPI:
+            return instruction->dpi.opi == ARITHMETIC
+                   && (instruction->dpi.opc == ADD_SETFLAGS || instruction->dpi.opc == SUB_SETFLAGS);
+        case isDPR:
+            if (instruction->dpr.m == 1) {
+                return false;
+            }
+            return (instruction->dpr.armOrLog == 1)
+                   ? (instruction->dpr.opc == ADD_SETFLAGS || instruction->dpr.opc == SUB_SETFLAGS)
+                   : (instruction->dpr.opc == BITWISE_AND_SETFLAGS);
+        default:
+            return false;
+    }
+}
+
+static void addSuccessor(Node *node, int64_t target)
+{
+    if (target < 0 || target >= MEMORY_SIZE) {
+        node->exits = true;
+    } else {
+        node->successors[node->numSuccessors++] = target;
+    }
+}
+
+// Decode the instruction at addr and find where control goes next
+static void buildNode(uint32_t addr, Node *node)
+{
+    Instruction instruction;
+    uint32_t instr = fetch(addr);
+
+    *node = (Node){.addr = addr};
+    if (instr == HALT_INSTR || decodeInstructionQuietly(instr, &instruction) != EXIT_SUCCESS) {
+        node->reads = true;
+        return;
+    }
+
+    if (instruction.instructionType != isB) {
+        node->writes = setsFlags(&instruction);
+        node->rd = (instruction.instructionType == isDPI) ? instruction.dpi.rd : instruction.dpr.rd;
+        // Unsupported DPI opcodes stop execution before the next instruction, and so
+        // does a load or store that faults. A store may also rewrite the code that
+        // follows, so the flags any of them sees are kept.
+        node->reads = (instruction.instructionType == isDPI
+                       && instruction.dpi.opi != ARITHMETIC && instruction.dpi.opi != WIDEMOVE)
+                      || instruction.instructionType == isSDT;
+        addSuccessor(node, (int64_t)addr + INSTR_BYTES);
+        return;
+    }
+
+    struct B b = instruction.b;
+    switch (b.type) {
+        case BRANCH_UNCONDITIONAL:
+            addSuccessor(node, addr + ((int64_t)b.simm26) * INSTR_BYTES);
+            break;
+        case BRANCH_CONDITIONAL:
+            node->reads = (b.cond.tag != ALWAYS_TAG);
+            addSuccessor(node, addr + ((int64_t)b.simm19) * INSTR_BYTES);
+            addSuccessor(node, (int64_t)addr + INSTR_BYTES);
+            break;
+        default: // br targets are only known at run time
+            node->exits = true;
+            break;
+    }
+}
+
+// Number the instructions reachable from address 0
+static void discoverNodes(void)
+{
+    int capacity = 256;
+    nodes = (Node *)malloc(capacity * sizeof(Node));
+    if (nodes == NULL) {
+        perror("Failed to allocate space for the flag liveness analysis.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int count = 0;
+    int pending = 0;
+    worklist[pending++] = 0;
+    nodeIndex[0] = -1;
+    while (pending > 0) {
+        uint32_t addr = worklist[--pending];
+        if (count == capacity) {
+            capacity *= 2;
+            nodes = (Node *)realloc(nodes, capacity * sizeof(Node));
+            if (nodes == NULL) {
+                perror("Failed to allocate space for the flag liveness analysis.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        buildNode(addr, &nodes[count]);
+        nodeIndex[addr / INSTR_BYTES] = ++count;
+
+        Node *node = &nodes[count - 1];
+        for (int i = 0; i < node->numSuccessors; i++) {
+            uint32_t word = node->successors[i] / INSTR_BYTES;
+            if (nodeIndex[word] == 0) {
+                nodeIndex[word] = -1; // queued
+                worklist[pending++] = node->successors[i];
+            }
+        }
+    }
+
+    numNodes = count;
+}
+
+void analyzeFlagLiveness(void)
+{
+    if (nodeIndex == NULL) {
+        nodeIndex = (int32_t *)calloc(LIVENESS_ENTRIES, sizeof(int32_t));
+        reached = (bool *)calloc(LIVENESS_ENTRIES, sizeof(bool));
+        deadFlags = (bool *)calloc(LIVENESS_ENTRIES, sizeof(bool));
+        worklist = (uint32_t *)malloc(LIVENESS_ENTRIES * sizeof(uint32_t));
+        if (nodeIndex == NULL || reached == NULL || deadFlags == NULL || worklist == NULL) {
+            perror("Failed to allocate space for the flag liveness analysis.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    discoverNodes();
+
+    // Liveness only grows, so sweeping until nothing changes reaches the fixpoint.
+    // Sweeping backwards follows the direction the information flows.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = numNodes - 1; i >= 0; i--) {
+            Node *node = &nodes[i];
+            if (node->liveIn) {
+                continue;
+            }
+            bool liveOut = node->exits;
+            for (int s = 0; s < node->numSuccessors && !liveOut; s++) {
+                liveOut = nodes[nodeIndex[node->successors[s] / INSTR_BYTES] - 1].liveIn;
+            }
+            if (node->reads || (!node->writes && liveOut)) {
+                node->liveIn = true;
+                changed = true;
+            }
+        }
+    }
+
+    for (int i = 0; i < numNodes; i++) {
+        Node *node = &nodes[i];
+        reached[node->addr / INSTR_BYTES] = true;
+        if (!node->writes) {
+            continue;
+        }
+        numSetters++;
+
+        bool liveOut = node->exits;
+        for (int s = 0; s < node->numSuccessors; s++) {
+            liveOut |= nodes[nodeIndex[node->successors[s] / INSTR_BYTES] - 1].liveIn;
+        }
+        // cmp, cmn and tst have no non-flag-setting form that leaves rd alone
+        if (!liveOut && node->rd != ZR_SP) {
+            deadFlags[node->addr / INSTR_BYTES] = true;
+            numDead++;
+        }
+    }
+
+    for (int i = 0; i < numNodes; i++) {
+        nodeIndex[nodes[i].addr / INSTR_BYTES] = 0;
+    }
+    analysisValid = true;
+}
+
+// Drop the results of the last analysis, clearing only the entries it set
+void resetFlagLiveness(void)
+{
+    if (nodes != NULL) {
+        for (int i = 0; i < numNodes; i++) {
+            reached[nodes[i].addr / INSTR_BYTES] = false;
+            deadFlags[nodes[i].addr / INSTR_BYTES] = false;
+        }
+        free(nodes);
+        nodes = NULL;
+        numNodes = 0;
+    }
+    analysisValid = false;
+}
+
+void freeFlagLiveness(void)
+{
+    resetFlagLiveness();
+    free(nodeIndex);
+    free(reached);
+    free(deadFlags);
+    free(worklist);
+    nodeIndex = NULL;
+    reached = NULL;
+    deadFlags = NULL;
+    worklist = NULL;
+}
+
+// Rewrite a freshly decoded instruction at addr into its non-flag-setting form if its flags are dead
+bool eliminateDeadFlags(uint32_t addr, Instruction *instruction)
+{
+    if (!analysisValid || addr % INSTR_BYTES != 0 || addr >= MEMORY_SIZE
+        || !deadFlags[addr / INSTR_BYTES]) {
+        return false;
+    }
+    switch (instruction->instructionType) {
+        case isDPI:
+            instruction->dpi.opc = (instruction->dpi.opc == ADD_SETFLAGS) ? ADD : SUB;
+            break;
+        case isDPR:
+            if (instruction->dpr.armOrLog == 1) {
+                instruction->dpr.opc = (instruction->dpr.opc == ADD_SETFLAGS) ? ADD : SUB;
+            } else {
+                instruction->dpr.opc = BITWISE_AND;
+            }
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+// A store into analysed code may change the graph, so the results are dropped
+// along with every instruction already decoded from them
+void invalidateFlagLiveness(uint32_t addr, int bytes)
+{
+    if (!analysisValid) {
+        return;
+    }
+    for (uint32_t word = addr / INSTR_BYTES; word <= (addr + bytes - 1) / INSTR_BYTES && word < LIVENESS_ENTRIES; word++) {
+        if (reached[word]) {
+            analysisValid = false;
+            flushCache();
+            blocksModified = true;
+            return;
+        }
+    }
+}
+
+void writeFlagLivenessReport(FILE *file)
+{
+    fprintf(file, "Flag-setting instructions:        %lu\n", (unsigned long)numSetters);
+    fprintf(file, "Flag-setting with dead flags:     %lu\n", (unsigned long)numDead);
+    fprintf(file, "Dynamic flag updates eliminated:  %lu\n", (unsigned long)flagUpdatesEliminated);
+    if (nodes != NULL && !analysisValid) {
+        fprintf(file, "Analysis dropped after a store into analysed code\n");
+    }
+}
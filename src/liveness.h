@@ -0,0 +1,21 @@
+#ifndef LIVENESS_H
+#define LIVENESS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "structs.h"
+
+// Executions of flag-setting instructions that ran without setting flags
+extern _Thread_local uint64_t flagUpdatesEliminated;
+
+// Prototypes
+extern void analyzeFlagLiveness(void);
+extern void resetFlagLiveness(void);
+extern void freeFlagLiveness(void);
+extern bool eliminateDeadFlags(uint32_t addr, Instruction *instruction);
+extern void invalidateFlagLiveness(uint32_t addr, int bytes);
+extern void writeFlagLivenessReport(FILE *file);
+
+#endif
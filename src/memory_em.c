@@ -0,0 +1,465 @@
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "datatypes_em.h"
+#include "memory_em.h"
+
+// Paged Guest Memory
+// The address space is split into 4KB pages found through a three-level page
+// table, each level indexed by 9 bits of the page number. Tables and pages are
+// only allocated when a store first touches them, so resident memory follows
+// the pages a program writes rather than the size of its address space. Loads
+// from pages that were never written read zero without allocating them.
+// Every access outside the address space is reported as a guest fault; the
+// check costs nothing on a TLB hit, since the TLB only holds valid pages.
+// Every page in the table is listed as dirty, so the final state dump and a
+// reset between runs only visit the pages a run loaded or wrote. A reset zeroes
+// them, takes them out of the table and keeps them for the next run.
+// A loaded image or the pages of a snapshot can be mapped copy-on-write from
+// their file, so they are only read from disk when first touched and a store
+// copies just that page.
+// The cores of an SMP guest share one table, each through a view of the
+// memory with a TLB of its own. Views walk the table without locking, only
+// allocation takes the lock of the shared memory, and table entries are
+// published with release stores so a walk never sees a page before its zeroes.
+
+#define TABLE_ENTRIES (1 << PAGE_TABLE_BITS)
+#define TABLE_INDEX(page, level) (((page) >> ((PAGE_TABLE_LEVELS - 1 - (level)) * PAGE_TABLE_BITS)) & (TABLE_ENTRIES - 1))
+#define NO_PAGE UINT64_MAX
+
+struct SharedMemory {
+    pthread_mutex_t lock;
+    struct GuestMemory memory; // owns the table, the page lists and the image while shared
+};
+
+static void **allocateTable(void)
+{
+    void **table = (void **)calloc(TABLE_ENTRIES, sizeof(void *));
+    if (table == NULL) {
+        perror("Failed to allocate space for the page table.\n");
+        exit(EXIT_FAILURE);
+    }
+    return table;
+}
+
+static void flushTlb(struct GuestMemory *memory)
+{
+    for (int i = 0; i < TLB_ENTRIES; i++) {
+        memory->tlb[i].page = NO_PAGE;
+        memory->tlb[i].host = NULL;
+    }
+}
+
+// Double the capacity of a full array
+static void *growArray(void *array, size_t *capacity, size_t elementSize)
+{
+    *capacity = (*capacity == 0) ? GUEST_PAGE_SIZE / elementSize : *capacity * 2;
+    array = realloc(array, *capacity * elementSize);
+    if (array == NULL) {
+        perror("Failed to allocate space for the guest page lists.\n");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+static void markDirty(struct GuestMemory *memory, uint64_t page, uint8_t *host)
+{
+    if (memory->numDirty == memory->dirtyCapacity) {
+        memory->dirty = growArray(memory->dirty, &memory->dirtyCapacity, sizeof(struct DirtyPage));
+    }
+    memory->dirty[memory->numDirty++] = (struct DirtyPage){.page = page, .host = host};
+}
+
+// Zeroed page for the table, reusing one kept by a reset if there is one
+static uint8_t *allocatePage(struct GuestMemory *memory, uint64_t page)
+{
+    uint8_t *host;
+    if (memory->numSpare > 0) {
+        host = memory->spare[--memory->numSpare];
+    } else {
+        host = (uint8_t *)calloc(1, GUEST_PAGE_SIZE);
+        if (host == NULL) {
+            perror("Failed to allocate space for a guest page.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    markDirty(memory, page, host);
+    return host;
+}
+
+static bool isImagePage(struct GuestMemory *memory, uint8_t *host)
+{
+    return host >= memory->image && host < memory->image + memory->imageLength;
+}
+
+static void unmapImage(void)
+{
+    if (state->memory.image != NULL) {
+        munmap(state->memory.image, state->memory.imageLength);
+        state->memory.image = NULL;
+        state->memory.imageLength = 0;
+    }
+}
+
+void initializeMemory(uint64_t size)
+{
+    state->memory.size = size;
+    state->memory.root = allocateTable();
+    flushTlb(&state->memory);
+}
+
+// Zero every dirty page, leaving the address space as initializeMemory did
+void resetMemory(void)
+{
+    struct GuestMemory *memory = &state->memory;
+    for (size_t i = 0; i < memory->numDirty; i++) {
+        struct DirtyPage *dirty = &memory->dirty[i];
+        void **table = memory->root;
+        for (int level = 0; level < PAGE_TABLE_LEVELS - 1; level++) {
+            table = (void **)table[TABLE_INDEX(dirty->page, level)];
+        }
+        table[TABLE_INDEX(dirty->page, PAGE_TABLE_LEVELS - 1)] = NULL;
+
+        if (isImagePage(memory, dirty->host)) {
+            continue; // dropped with the mapping
+        }
+        memset(dirty->host, 0, GUEST_PAGE_SIZE);
+        if (memory->numSpare == memory->spareCapacity) {
+            memory->spare = growArray(memory->spare, &memory->spareCapacity, sizeof(uint8_t *));
+        }
+        memory->spare[memory->numSpare++] = dirty->host;
+    }
+    memory->numDirty = 0;
+    unmapImage();
+    flushTlb(memory);
+}
+
+static void freeTable(struct GuestMemory *memory, void **table, int level)
+{
+    for (int i = 0; i < TABLE_ENTRIES; i++) {
+        if (table[i] == NULL) {
+            continue;
+        }
+        if (level < PAGE_TABLE_LEVELS - 1) {
+            freeTable(memory, (void **)table[i], level + 1);
+        } else if (!isImagePage(memory, (uint8_t *)table[i])) {
+            free(table[i]); // a guest page
+        }
+    }
+    free(table);
+}
+
+void freeMemory(void)
+{
+    struct GuestMemory *memory = &state->memory;
+    if (memory->root == NULL) {
+        return;
+    }
+    freeTable(memory, memory->root, 0);
+    for (size_t i = 0; i < memory->numSpare; i++) {
+        free(memory->spare[i]);
+    }
+    free(memory->dirty);
+    free(memory->spare);
+    unmapImage();
+    *memory = (struct GuestMemory){.size = memory->size};
+    flushTlb(memory);
+}
+
+_Thread_local jmp_buf *faultHandler = NULL;
+
+void guestFault(uint64_t addr)
+{
+    fprintf(stderr, "Guest memory fault at PC 0x%08lx: address 0x%08lx is outside memory\n",
+            (unsigned long)state->PC, (unsigned long)addr);
+    if (faultHandler != NULL) {
+        longjmp(*faultHandler, 1);
+    }
+    exit(EXIT_FAILURE);
+}
+
+// Walk the page table to the entry of a page, NULL if one of its tables was never allocated
+static void **findEntry(struct GuestMemory *memory, uint64_t page, bool allocate)
+{
+    void **table = memory->root;
+    for (int level = 0; level < PAGE_TABLE_LEVELS - 1; level++) {
+        void **entry = &table[TABLE_INDEX(page, level)];
+        void **next = __atomic_load_n(entry, __ATOMIC_ACQUIRE);
+        if (next == NULL) {
+            if (!allocate) {
+                return NULL;
+            }
+            next = allocateTable();
+            __atomic_store_n(entry, next, __ATOMIC_RELEASE);
+        }
+        table = next;
+    }
+    return &table[TABLE_INDEX(page, PAGE_TABLE_LEVELS - 1)];
+}
+
+// Host address of a page, NULL if it was never allocated
+static uint8_t *findPage(struct GuestMemory *memory, uint64_t page, bool allocate)
+{
+    void **entry = findEntry(memory, page, allocate);
+    if (entry == NULL) {
+        return NULL;
+    }
+    uint8_t *host = __atomic_load_n(entry, __ATOMIC_ACQUIRE);
+    if (host == NULL && allocate) {
+        host = allocatePage(memory, page);
+        __atomic_store_n(entry, host, __ATOMIC_RELEASE);
+    }
+    return host;
+}
+
+// findPage for a view, allocating in the shared memory under its lock
+static uint8_t *findSharedPage(struct GuestMemory *memory, uint64_t page, bool allocate)
+{
+    if (!allocate) {
+        return findPage(memory, page, false);
+    }
+    struct SharedMemory *shared = memory->shared;
+    pthread_mutex_lock(&shared->lock);
+    uint8_t *host = findPage(&shared->memory, page, true);
+    pthread_mutex_unlock(&shared->lock);
+    return host;
+}
+
+// Host address of the byte at addr, filling the TLB, or NULL for a page never written
+static uint8_t *translate(struct GuestMemory *memory, uint64_t addr, bool allocate)
+{
+    uint8_t *host = lookupTlbIn(memory, addr, 1);
+    if (host != NULL) {
+        return host;
+    }
+
+    uint64_t page = addr >> GUEST_PAGE_SHIFT;
+    uint8_t *base = (memory->shared != NULL) ? findSharedPage(memory, page, allocate)
+                                             : findPage(memory, page, allocate);
+    if (base == NULL) {
+        return NULL;
+    }
+    struct TlbEntry *entry = &memory->tlb[page % TLB_ENTRIES];
+    entry->page = page;
+    entry->host = base;
+    return base + (addr & (GUEST_PAGE_SIZE - 1));
+}
+
+static void checkRange(uint64_t addr, uint64_t length)
+{
+    if (!inMemory(&state->memory, addr, length)) {
+        guestFault(addr);
+    }
+}
+
+// Accesses to any guest's memory that missed its TLB or cross a page. Those
+// inside a page are one host access, so other cores never see them half done,
+// those across pages go a byte at a time. The caller checks the range.
+uint64_t readMemoryIn(struct GuestMemory *memory, uint64_t addr, int bytes)
+{
+    if ((addr & (GUEST_PAGE_SIZE - 1)) + bytes <= GUEST_PAGE_SIZE) {
+        uint8_t *host = translate(memory, addr, false);
+        if (host == NULL) {
+            return 0;
+        }
+        if (bytes == MODE64_BYTES) {
+            return loadLittle64(host);
+        }
+        if (bytes == MODE32_BYTES) {
+            return loadLittle32(host);
+        }
+    }
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        uint8_t *host = translate(memory, addr + i, false);
+        if (host != NULL) {
+            value |= ((uint64_t)*host) << (BYTE_SIZE * i);
+        }
+    }
+    return value;
+}
+
+void writeMemoryIn(struct GuestMemory *memory, uint64_t addr, uint64_t value, int bytes)
+{
+    if ((addr & (GUEST_PAGE_SIZE - 1)) + bytes <= GUEST_PAGE_SIZE) {
+        if (bytes == MODE64_BYTES) {
+            storeLittle64(translate(memory, addr, true), value);
+            return;
+        }
+        if (bytes == MODE32_BYTES) {
+            storeLittle32(translate(memory, addr, true), value);
+            return;
+        }
+    }
+    for (int i = 0; i < bytes; i++) {
+        *translate(memory, addr + i, true) = (value >> (BYTE_SIZE * i)) & MASK8;
+    }
+}
+
+// Accesses to the running guest that missed the TLB or cross a page
+uint64_t readMemorySlow(uint64_t addr, int bytes)
+{
+    if (isCoreIdAccess(addr, bytes)) {
+        return readCoreId(state->coreId, addr, bytes);
+    }
+    checkRange(addr, bytes);
+    return readMemoryIn(&state->memory, addr, bytes);
+}
+
+void writeMemorySlow(uint64_t addr, uint64_t value, int bytes)
+{
+    checkRange(addr, bytes);
+    writeMemoryIn(&state->memory, addr, value, bytes);
+}
+
+// Bulk copies, a page at a time
+void copyToMemory(uint64_t addr, const uint8_t *bytes, size_t length)
+{
+    checkRange(addr, length);
+    while (length > 0) {
+        size_t chunk = GUEST_PAGE_SIZE - (addr & (GUEST_PAGE_SIZE - 1));
+        chunk = (chunk < length) ? chunk : length;
+        memcpy(translate(&state->memory, addr, true), bytes, chunk);
+        addr += chunk;
+        bytes += chunk;
+        length -= chunk;
+    }
+}
+
+void copyFromMemory(uint64_t addr, uint8_t *bytes, size_t length)
+{
+    checkRange(addr, length);
+    while (length > 0) {
+        size_t chunk = GUEST_PAGE_SIZE - (addr & (GUEST_PAGE_SIZE - 1));
+        chunk = (chunk < length) ? chunk : length;
+        uint8_t *host = translate(&state->memory, addr, false);
+        if (host != NULL) {
+            memcpy(bytes, host, chunk);
+        } else {
+            memset(bytes, 0, chunk);
+        }
+        addr += chunk;
+        bytes += chunk;
+        length -= chunk;
+    }
+}
+
+// Map length bytes of a file at offset privately, so stores copy a page instead of writing to the file
+static int mapPrivate(struct GuestMemory *memory, int fd, uint64_t offset, uint64_t length)
+{
+    void *image = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset);
+    if (image == MAP_FAILED) {
+        return EXIT_FAILURE;
+    }
+    memory->image = (uint8_t *)image;
+    memory->imageLength = length;
+    return EXIT_SUCCESS;
+}
+
+static void placeImagePage(struct GuestMemory *memory, uint64_t page, uint8_t *host)
+{
+    *findEntry(memory, page, true) = host;
+    markDirty(memory, page, host);
+}
+
+// Map length bytes of a file at address 0, only before anything else is loaded
+int mapImage(int fd, uint64_t length)
+{
+    struct GuestMemory *memory = &state->memory;
+    if (memory->numDirty > 0 || length == 0) {
+        return EXIT_FAILURE;
+    }
+    length = (length < memory->size) ? length : memory->size;
+    if (mapPrivate(memory, fd, 0, length) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    // The tail of the last page past the end of the file reads as zero
+    uint64_t numPages = (length + GUEST_PAGE_SIZE - 1) >> GUEST_PAGE_SHIFT;
+    for (uint64_t page = 0; page < numPages; page++) {
+        placeImagePage(memory, page, memory->image + (page << GUEST_PAGE_SHIFT));
+    }
+    return EXIT_SUCCESS;
+}
+
+// Map whole pages stored one after another in a file from offset, the i-th
+// becoming guest page pages[i], only before anything else is loaded. The pages
+// must lie inside the address space.
+int mapPages(int fd, uint64_t offset, const uint64_t *pages, size_t numPages)
+{
+    struct GuestMemory *memory = &state->memory;
+    if (memory->numDirty > 0 || numPages == 0
+        || mapPrivate(memory, fd, offset, numPages * GUEST_PAGE_SIZE) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < numPages; i++) {
+        placeImagePage(memory, pages[i], memory->image + i * GUEST_PAGE_SIZE);
+    }
+    return EXIT_SUCCESS;
+}
+
+//
+// Sharing
+//
+// Move the table of memory into a new shared memory, leaving memory a view of it
+struct SharedMemory *shareMemory(struct GuestMemory *memory)
+{
+    struct SharedMemory *shared = (struct SharedMemory *)malloc(sizeof(struct SharedMemory));
+    if (shared == NULL) {
+        perror("Failed to allocate space for the shared memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&shared->lock, NULL);
+    shared->memory = *memory;
+    attachMemory(memory, shared);
+    return shared;
+}
+
+// Make memory a view of shared with an empty TLB, it owns nothing
+void attachMemory(struct GuestMemory *memory, struct SharedMemory *shared)
+{
+    *memory = shared->memory;
+    memory->shared = shared;
+    flushTlb(memory);
+}
+
+// Give the table back to memory once no view is used any more, freeing shared
+void unshareMemory(struct GuestMemory *memory, struct SharedMemory *shared)
+{
+    *memory = shared->memory;
+    flushTlb(memory);
+    pthread_mutex_destroy(&shared->lock);
+    free(shared);
+}
+
+// Whether a host page holds only zeroes
+bool isZeroPage(const uint8_t *page)
+{
+    for (size_t offset = 0; offset < GUEST_PAGE_SIZE; offset += MODE64_BYTES) {
+        if (loadLittle64(&page[offset]) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int comparePages(const void *a, const void *b)
+{
+    uint64_t pageA = ((const struct DirtyPage *)a)->page;
+    uint64_t pageB = ((const struct DirtyPage *)b)->page;
+    return (pageA > pageB) - (pageA < pageB);
+}
+
+// The dirty pages in address order
+size_t sortDirtyPages(struct DirtyPage **pages)
+{
+    qsort(state->memory.dirty, state->memory.numDirty, sizeof(struct DirtyPage), comparePages);
+    *pages = state->memory.dirty;
+    return state->memory.numDirty;
+}
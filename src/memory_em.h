@@ -0,0 +1,155 @@
+#ifndef MEMORY_EM_H
+#define MEMORY_EM_H
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "datatypes_em.h"
+
+// Guest Memory Access
+// Fixed-width little-endian accessors for guest memory at any alignment. On a
+// little-endian host each one is a single memcpy, which compilers turn into one
+// host load or store. Other hosts assemble the value one byte at a time.
+// Guest addresses go through a direct-mapped TLB in front of the page table,
+// misses and accesses that cross a page take the slow path in memory_em.c.
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HOST_LITTLE_ENDIAN 1
+#else
+#define HOST_LITTLE_ENDIAN 0
+#endif
+
+static inline uint32_t loadLittle32(const uint8_t *bytes) {
+    uint32_t value = 0;
+#if HOST_LITTLE_ENDIAN
+    memcpy(&value, bytes, sizeof(value));
+#else
+    for (int i = 0; i < (int)sizeof(value); i++) {
+        value |= ((uint32_t)bytes[i]) << (8 * i);
+    }
+#endif
+    return value;
+}
+
+static inline uint64_t loadLittle64(const uint8_t *bytes) {
+    uint64_t value = 0;
+#if HOST_LITTLE_ENDIAN
+    memcpy(&value, bytes, sizeof(value));
+#else
+    for (int i = 0; i < (int)sizeof(value); i++) {
+        value |= ((uint64_t)bytes[i]) << (8 * i);
+    }
+#endif
+    return value;
+}
+
+static inline void storeLittle32(uint8_t *bytes, uint32_t value) {
+#if HOST_LITTLE_ENDIAN
+    memcpy(bytes, &value, sizeof(value));
+#else
+    for (int i = 0; i < (int)sizeof(value); i++) {
+        bytes[i] = (value >> (8 * i)) & 0xFF;
+    }
+#endif
+}
+
+static inline void storeLittle64(uint8_t *bytes, uint64_t value) {
+#if HOST_LITTLE_ENDIAN
+    memcpy(bytes, &value, sizeof(value));
+#else
+    for (int i = 0; i < (int)sizeof(value); i++) {
+        bytes[i] = (value >> (8 * i)) & 0xFF;
+    }
+#endif
+}
+
+// Where a guest fault returns to while set, otherwise a fault ends the process
+extern _Thread_local jmp_buf *faultHandler;
+
+// Prototypes
+extern void initializeMemory(uint64_t size);
+extern void resetMemory(void);
+extern void freeMemory(void);
+extern void guestFault(uint64_t addr);
+extern uint64_t readMemorySlow(uint64_t addr, int bytes);
+extern void writeMemorySlow(uint64_t addr, uint64_t value, int bytes);
+extern uint64_t readMemoryIn(struct GuestMemory *memory, uint64_t addr, int bytes);
+extern void writeMemoryIn(struct GuestMemory *memory, uint64_t addr, uint64_t value, int bytes);
+extern void copyToMemory(uint64_t addr, const uint8_t *bytes, size_t length);
+extern void copyFromMemory(uint64_t addr, uint8_t *bytes, size_t length);
+extern int mapImage(int fd, uint64_t length);
+extern int mapPages(int fd, uint64_t offset, const uint64_t *pages, size_t numPages);
+extern bool isZeroPage(const uint8_t *page);
+extern size_t sortDirtyPages(struct DirtyPage **pages);
+extern struct SharedMemory *shareMemory(struct GuestMemory *memory);
+extern void attachMemory(struct GuestMemory *memory, struct SharedMemory *shared);
+extern void unshareMemory(struct GuestMemory *memory, struct SharedMemory *shared);
+
+//
+// Guest Accessors
+//
+// Whether [addr, addr + length) lies inside the address space of memory
+static inline bool inMemory(const struct GuestMemory *memory, uint64_t addr, uint64_t length) {
+    return length <= memory->size && addr <= memory->size - length;
+}
+
+// Whether [addr, addr + bytes) lies in the core ID doubleword, loads from it read
+// the matching bytes of the core number and stores fault like any other address
+// outside memory
+static inline bool isCoreIdAccess(uint64_t addr, int bytes) {
+    return addr >= CORE_ID_ADDRESS && addr - CORE_ID_ADDRESS <= (uint64_t)(MODE64_BYTES - bytes);
+}
+
+static inline uint64_t readCoreId(uint64_t coreId, uint64_t addr, int bytes) {
+    uint64_t value = coreId >> (BYTE_SIZE * (addr - CORE_ID_ADDRESS));
+    return (bytes == MODE64_BYTES) ? value : value & ((1ULL << (BYTE_SIZE * bytes)) - 1);
+}
+
+// Host address of [addr, addr + bytes) if its page is in the TLB of memory, NULL otherwise.
+// Only pages inside the address space are ever in the TLB, so a hit needs no bounds check.
+static inline uint8_t *lookupTlbIn(struct GuestMemory *memory, uint64_t addr, int bytes) {
+    uint64_t page = addr >> GUEST_PAGE_SHIFT;
+    uint64_t offset = addr & (GUEST_PAGE_SIZE - 1);
+    struct TlbEntry *entry = &memory->tlb[page % TLB_ENTRIES];
+    if (entry->page != page || offset + bytes > GUEST_PAGE_SIZE) {
+        return NULL;
+    }
+    return entry->host + offset;
+}
+
+static inline uint8_t *lookupTlb(uint64_t addr, int bytes) {
+    return lookupTlbIn(&state->memory, addr, bytes);
+}
+
+static inline uint32_t readMemory32(uint64_t addr) {
+    uint8_t *host = lookupTlb(addr, sizeof(uint32_t));
+    return (host != NULL) ? loadLittle32(host) : (uint32_t)readMemorySlow(addr, sizeof(uint32_t));
+}
+
+static inline uint64_t readMemory64(uint64_t addr) {
+    uint8_t *host = lookupTlb(addr, sizeof(uint64_t));
+    return (host != NULL) ? loadLittle64(host) : readMemorySlow(addr, sizeof(uint64_t));
+}
+
+static inline void writeMemory32(uint64_t addr, uint32_t value) {
+    uint8_t *host = lookupTlb(addr, sizeof(uint32_t));
+    if (host != NULL) {
+        storeLittle32(host, value);
+    } else {
+        writeMemorySlow(addr, value, sizeof(uint32_t));
+    }
+}
+
+static inline void writeMemory64(uint64_t addr, uint64_t value) {
+    uint8_t *host = lookupTlb(addr, sizeof(uint64_t));
+    if (host != NULL) {
+        storeLittle64(host, value);
+    } else {
+        writeMemorySlow(addr, value, sizeof(uint64_t));
+    }
+}
+
+#endif
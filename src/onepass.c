@@ -1,19 +1,23 @@
-#include "datatypes_as.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "constants.h"
 #include "datatypes_as.h"
 #include "instructions.h"
 #include "utils_as.h"
 
-extern uint32_t binaryInstr;
-extern size_t PC;
-
-void handleUndefLabel(int i)
+static int handleUndefLabel(size_t i)
 {
     struct undefTable *entry = (struct undefTable *)getFromVector(undeftable, i);
     uint32_t instruction = binaryInstr[entry->PC];
 
     int literal = getLiteral(entry->label);
-    int offset = (literal - entry->PC) >> 2;
+    if (literal == INT32_MIN) {
+        fprintf(stderr, "Undefined label: %s\n", entry->label);
+        return EXIT_FAILURE;
+    }
+    int offset = (literal - entry->PC * INSTR_BYTES) >> 2;
 
     switch (entry->type) {
         case ll: // Load Literal
@@ -28,23 +32,27 @@ void handleUndefLabel(int i)
     }
 
     binaryInstr[entry->PC] = instruction;
+    return EXIT_SUCCESS;
 }
 
 // Iterates through vector to handle all the undefined lables
-void handleUndefTable()
+int handleUndefTable(void)
 {
-    for (int i = 0; i < undeftable->currentSize; i++) {
-        handleUndefLabel(i);
+    for (size_t i = 0; i < undeftable->currentSize; i++) {
+        if (handleUndefLabel(i) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
     }
+    return EXIT_SUCCESS;
 }
 
 void updateUndefTable(enum undefType type, char *labelName)
 {
-    struct undefTable *newEntry = (struct undefTable *)malloc(sizeof(struct undefTable));
-    
-    newEntry->PC = PC;
-    newEntry->type = type;
-    strcpy(newEntry->label, labelName);
-
-    addToVector(undeftable, newEntry);
-}
\ No newline at end of file
+    struct undefTable newEntry;
+
+    newEntry.PC = PC;
+    newEntry.type = type;
+    strcpy(newEntry.label, labelName);
+
+    addToVector(undeftable, &newEntry);
+}
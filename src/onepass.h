@@ -29,5 +29,6 @@ struct undefTable {
 extern vector *undeftable;
 extern vector *symtable;
 extern void updateUndefTable(enum undefType type, char *labelName);
+extern int handleUndefTable(void);
 
 #endif
\ No newline at end of file
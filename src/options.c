@@ -0,0 +1,359 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "datatypes_em.h"
+#include "emulator.h"
+#include "io.h"
+#include "options.h"
+
+#define FLAG_PREFIX "-"
+#define OUTPUT_FLAG "-o"
+#define ENGINE_FLAG "--engine="
+#define THRESHOLD_FLAG "--tier-threshold="
+#define MEMORY_SIZE_FLAG "--memory-size="
+#define JOBS_FLAG "--jobs="
+#define LANES_FLAG "--lanes="
+#define LIMIT_FLAG "--max-instructions="
+#define SOCKET_FLAG "--socket="
+#define CORES_FLAG "--cores="
+#define ROUND_ROBIN_FLAG "--round-robin"
+#define SNAPSHOT_FLAG "--snapshot="
+#define SNAPSHOT_AT_FLAG "--snapshot-at="
+#define SNAPSHOT_PC_FLAG "--snapshot-pc="
+#define CHECKPOINT_FLAG "--checkpoint-every="
+#define BUDGET_FLAG "--checkpoint-budget="
+#define TRACE_FLAG "--trace="
+#define PROFILE_FLAG "--profile"
+#define LABELS_FLAG "--labels="
+#define MAX_JOBS 1024
+
+static const char *engineNames[] = {
+    "reference", "threaded", "jit", "tiered"};
+#define SIZE_ENGINES (sizeof(engineNames) / sizeof(char *))
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: emulate [--cache] [--engine=reference|threaded|jit|tiered] [--tier-threshold=<n>]\n"
+                    "               [--no-fusion] [--fusion-stats] [--tier-stats] [--no-flag-liveness] [--flag-stats]\n"
+                    "               [--memory-size=<n>[K|M|G]] [--max-instructions=<n>]\n"
+                    "               [--cores=<n>] [--round-robin[=<n>]]\n"
+                    "               [--snapshot=<file.snap> --snapshot-at=<n>|--snapshot-pc=<addr>]\n"
+                    "               [--trace=<file.trace>] [--profile[=<file.prof>] [--labels=<file.map>]]\n"
+                    "               <file.bin> [file.out]\n");
+    fprintf(stderr, "       emulate --restore [engine options] <file.snap> [file.out]\n");
+    fprintf(stderr, "       emulate --aot <file.bin> -o <file.c>\n");
+    fprintf(stderr, "       emulate --batch [--jobs=<n>] [engine options] <list|directory> [output directory]\n");
+    fprintf(stderr, "       emulate --batch [--jobs=<n>] --lanes=<n> [--memory-size=<n>[K|M|G]] [--max-instructions=<n>]\n"
+                    "               <list|directory> [output directory]\n");
+    fprintf(stderr, "       (lanes above 1 run the programs in lockstep in place of an engine)\n");
+    fprintf(stderr, "       emulate --server [--socket=<path>] [engine options]\n");
+    fprintf(stderr, "       emulate --debug [--checkpoint-every=<n>] [--checkpoint-budget=<n>[K|M|G]] [engine options] <file.bin>\n");
+    exit(EXIT_FAILURE);
+}
+
+static enum Engine parseEngine(const char *name)
+{
+    for (size_t i = 0; i < SIZE_ENGINES; i++) {
+        if (!strcmp(name, engineNames[i])) {
+            return (enum Engine)i;
+        }
+    }
+    fprintf(stderr, "Unknown engine: %s\n", name);
+    usage();
+    return ENGINE_REFERENCE;
+}
+
+static unsigned long parseThreshold(const char *value)
+{
+    char *end;
+    unsigned long threshold = strtoul(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || threshold > UINT32_MAX) {
+        fprintf(stderr, "Invalid tier threshold: %s\n", value);
+        usage();
+    }
+    return threshold;
+}
+
+static int parseJobs(const char *value)
+{
+    char *end;
+    unsigned long jobs = strtoul(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || jobs == 0 || jobs > MAX_JOBS) {
+        fprintf(stderr, "Invalid number of jobs: %s, use 1 to %d\n", value, MAX_JOBS);
+        usage();
+    }
+    return (int)jobs;
+}
+
+static int parseLanes(const char *value)
+{
+    char *end;
+    unsigned long lanes = strtoul(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || lanes == 0 || lanes > MAX_LANES) {
+        fprintf(stderr, "Invalid number of lanes: %s, use 1 to %d\n", value, MAX_LANES);
+        usage();
+    }
+    return (int)lanes;
+}
+
+static int parseCores(const char *value)
+{
+    char *end;
+    unsigned long cores = strtoul(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || cores == 0 || cores > MAX_CORES) {
+        fprintf(stderr, "Invalid number of cores: %s, use 1 to %d\n", value, MAX_CORES);
+        usage();
+    }
+    return (int)cores;
+}
+
+// Instructions per turn after --round-robin, one if no =<n> follows
+static uint64_t parseRoundRobin(const char *value)
+{
+    if (*value == '\0') {
+        return 1;
+    }
+    char *end;
+    uint64_t quantum = strtoull(value + 1, &end, 10);
+    if (*value != '=' || value[1] == '\0' || *end != '\0' || quantum == 0) {
+        fprintf(stderr, "Invalid round robin turn: %s\n", value);
+        usage();
+    }
+    return quantum;
+}
+
+// A count or an address, in decimal or with a 0x prefix in hexadecimal
+static uint64_t parseNumber(const char *value)
+{
+    char *end;
+    uint64_t number = strtoull(value, &end, 0);
+    if (*value == '\0' || *value == '-' || *end != '\0') {
+        fprintf(stderr, "Invalid number: %s\n", value);
+        usage();
+    }
+    return number;
+}
+
+static uint64_t parseLimit(const char *value)
+{
+    char *end;
+    uint64_t limit = strtoull(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || limit == 0) {
+        fprintf(stderr, "Invalid instruction limit: %s\n", value);
+        usage();
+    }
+    return limit;
+}
+
+// A number of bytes, with an optional K, M or G suffix, false if it is malformed or overflows
+static bool parseBytes(const char *value, uint64_t *bytes)
+{
+    char *end;
+    uint64_t size = strtoull(value, &end, 10);
+    int shift = 0;
+    switch (*end) {
+        case 'K':
+            shift = 10;
+            end++;
+            break;
+        case 'M':
+            shift = 20;
+            end++;
+            break;
+        case 'G':
+            shift = 30;
+            end++;
+            break;
+    }
+    *bytes = size << shift;
+    return *value != '\0' && *value != '-' && *end == '\0' && size <= (UINT64_MAX >> shift);
+}
+
+// A whole number of pages, from MEMORY_SIZE, which holds the code, up to MAX_MEMORY_SIZE
+static uint64_t parseMemorySize(const char *value)
+{
+    uint64_t size;
+    if (!parseBytes(value, &size) || size > MAX_MEMORY_SIZE || size < MEMORY_SIZE || size % GUEST_PAGE_SIZE != 0) {
+        fprintf(stderr, "Invalid memory size: %s, use a multiple of %llu bytes from %dM to %lluG\n",
+                value, GUEST_PAGE_SIZE, MEMORY_SIZE >> 20, MAX_MEMORY_SIZE >> 30);
+        usage();
+    }
+    return size;
+}
+
+static uint64_t parseInterval(const char *value)
+{
+    char *end;
+    uint64_t interval = strtoull(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || interval == 0) {
+        fprintf(stderr, "Invalid checkpoint interval: %s\n", value);
+        usage();
+    }
+    return interval;
+}
+
+static uint64_t parseBudget(const char *value)
+{
+    uint64_t budget;
+    if (!parseBytes(value, &budget)) {
+        fprintf(stderr, "Invalid checkpoint budget: %s\n", value);
+        usage();
+    }
+    return budget;
+}
+
+// Flags may appear anywhere, the remaining arguments are the input and output files
+void parseOptions(int argc, char **argv, struct Options *options)
+{
+    memset(options, 0, sizeof(struct Options));
+    options->outputFile = STDOUT;
+    initializeConfig(&options->config);
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    options->jobs = (cores > 0 && cores <= MAX_JOBS) ? (int)cores : 1;
+    options->lanes = 1;
+    options->checkpointInterval = CHECKPOINT_INTERVAL;
+    options->checkpointBudget = CHECKPOINT_BUDGET;
+
+    int positional = 0;
+    bool engineOption = false;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], FLAG_PREFIX, strlen(FLAG_PREFIX)) != 0) {
+            if (positional == 0) {
+                options->inputFile = argv[i];
+            } else if (positional == 1) {
+                options->outputFile = argv[i];
+            } else {
+                usage();
+            }
+            positional++;
+        } else if (!strcmp(argv[i], OUTPUT_FLAG) && i + 1 < argc) {
+            options->outputFile = argv[++i];
+        } else if (!strcmp(argv[i], "--aot")) {
+            options->aot = true;
+        } else if (!strcmp(argv[i], "--batch")) {
+            options->batch = true;
+        } else if (!strncmp(argv[i], JOBS_FLAG, strlen(JOBS_FLAG))) {
+            options->jobs = parseJobs(argv[i] + strlen(JOBS_FLAG));
+        } else if (!strncmp(argv[i], LANES_FLAG, strlen(LANES_FLAG))) {
+            options->lanes = parseLanes(argv[i] + strlen(LANES_FLAG));
+        } else if (!strcmp(argv[i], "--server")) {
+            options->server = true;
+        } else if (!strncmp(argv[i], SOCKET_FLAG, strlen(SOCKET_FLAG)) && argv[i][strlen(SOCKET_FLAG)] != '\0') {
+            options->socketPath = argv[i] + strlen(SOCKET_FLAG);
+        } else if (!strcmp(argv[i], "--no-fusion")) {
+            engineOption = true;
+            options->config.fusion = false;
+        } else if (!strcmp(argv[i], "--fusion-stats")) {
+            engineOption = true;
+            options->config.fusionStats = true;
+        } else if (!strcmp(argv[i], "--tier-stats")) {
+            engineOption = true;
+            options->config.tierStats = true;
+        } else if (!strcmp(argv[i], "--no-flag-liveness")) {
+            engineOption = true;
+            options->config.flagLiveness = false;
+        } else if (!strcmp(argv[i], "--flag-stats")) {
+            engineOption = true;
+            options->config.flagStats = true;
+        } else if (!strcmp(argv[i], "--cache")) {
+            engineOption = true;
+            options->config.cache = true;
+        } else if (!strncmp(argv[i], ENGINE_FLAG, strlen(ENGINE_FLAG))) {
+            engineOption = true;
+            options->config.engine = parseEngine(argv[i] + strlen(ENGINE_FLAG));
+        } else if (!strncmp(argv[i], THRESHOLD_FLAG, strlen(THRESHOLD_FLAG))) {
+            engineOption = true;
+            options->config.tierThreshold = parseThreshold(argv[i] + strlen(THRESHOLD_FLAG));
+        } else if (!strncmp(argv[i], MEMORY_SIZE_FLAG, strlen(MEMORY_SIZE_FLAG))) {
+            options->config.memorySize = parseMemorySize(argv[i] + strlen(MEMORY_SIZE_FLAG));
+        } else if (!strncmp(argv[i], LIMIT_FLAG, strlen(LIMIT_FLAG))) {
+            options->config.instructionLimit = parseLimit(argv[i] + strlen(LIMIT_FLAG));
+        } else if (!strncmp(argv[i], CORES_FLAG, strlen(CORES_FLAG))) {
+            options->config.cores = parseCores(argv[i] + strlen(CORES_FLAG));
+        } else if (!strncmp(argv[i], ROUND_ROBIN_FLAG, strlen(ROUND_ROBIN_FLAG))) {
+            options->config.roundRobin = parseRoundRobin(argv[i] + strlen(ROUND_ROBIN_FLAG));
+        } else if (!strncmp(argv[i], SNAPSHOT_FLAG, strlen(SNAPSHOT_FLAG)) && argv[i][strlen(SNAPSHOT_FLAG)] != '\0') {
+            options->snapshotFile = argv[i] + strlen(SNAPSHOT_FLAG);
+        } else if (!strncmp(argv[i], SNAPSHOT_AT_FLAG, strlen(SNAPSHOT_AT_FLAG))) {
+            options->snapshotAt = parseNumber(argv[i] + strlen(SNAPSHOT_AT_FLAG));
+            options->snapshotPoints++;
+        } else if (!strncmp(argv[i], SNAPSHOT_PC_FLAG, strlen(SNAPSHOT_PC_FLAG))) {
+            options->snapshotPC = parseNumber(argv[i] + strlen(SNAPSHOT_PC_FLAG));
+            options->snapshotAtPC = true;
+            options->snapshotPoints++;
+        } else if (!strcmp(argv[i], "--restore")) {
+            options->restore = true;
+        } else if (!strncmp(argv[i], TRACE_FLAG, strlen(TRACE_FLAG)) && argv[i][strlen(TRACE_FLAG)] != '\0') {
+            options->traceFile = argv[i] + strlen(TRACE_FLAG);
+        } else if (!strcmp(argv[i], PROFILE_FLAG)) {
+            options->profile = true;
+        } else if (!strncmp(argv[i], PROFILE_FLAG "=", strlen(PROFILE_FLAG "=")) && argv[i][strlen(PROFILE_FLAG "=")] != '\0') {
+            options->profile = true;
+            options->profileFile = argv[i] + strlen(PROFILE_FLAG "=");
+        } else if (!strncmp(argv[i], LABELS_FLAG, strlen(LABELS_FLAG)) && argv[i][strlen(LABELS_FLAG)] != '\0') {
+            options->labelFile = argv[i] + strlen(LABELS_FLAG);
+        } else if (!strcmp(argv[i], "--debug")) {
+            options->debug = true;
+        } else if (!strncmp(argv[i], CHECKPOINT_FLAG, strlen(CHECKPOINT_FLAG))) {
+            options->checkpointInterval = parseInterval(argv[i] + strlen(CHECKPOINT_FLAG));
+        } else if (!strncmp(argv[i], BUDGET_FLAG, strlen(BUDGET_FLAG))) {
+            options->checkpointBudget = parseBudget(argv[i] + strlen(BUDGET_FLAG));
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            usage();
+        }
+    }
+
+    // Lockstep lanes, translations and snapshots work on a single core
+    bool snapshots = options->snapshotFile != NULL || options->restore;
+    if (options->config.cores > 1 && (options->lanes > 1 || options->aot || snapshots)) {
+        usage();
+    }
+    // Lockstep lanes replace the engine, so none of its options apply to them
+    if (options->lanes > 1 && engineOption) {
+        usage();
+    }
+    // A snapshot is taken at one point of a single run
+    if ((options->snapshotFile != NULL) != (options->snapshotPoints == 1) || options->snapshotPoints > 1
+        || (snapshots && (options->aot || options->batch || options->server))) {
+        usage();
+    }
+
+    // A trace records a single run of a single core
+    if (options->traceFile != NULL && (options->config.cores > 1 || options->aot || options->batch
+                                       || options->server || options->debug)) {
+        usage();
+    }
+
+    // A profile counts a single run of a single core, with labels only of use to it
+    if ((options->profile && (options->config.cores > 1 || options->aot || options->batch || options->server
+                              || options->debug || options->traceFile != NULL))
+        || (options->labelFile != NULL && !options->profile)) {
+        usage();
+    }
+
+    // The debugger records a single core program of its own
+    if (options->debug && (options->config.cores > 1 || options->aot || options->batch || options->server
+                           || snapshots || positional > 1)) {
+        usage();
+    }
+
+    // A server reads its programs from its clients
+    if (options->server) {
+        if (positional > 0 || options->aot || options->batch) {
+            usage();
+        }
+        return;
+    }
+    if (options->socketPath != NULL) {
+        usage();
+    }
+    if (options->inputFile == NULL) {
+        perror("Provide at least an input file.\n");
+        exit(EXIT_FAILURE);
+    }
+}
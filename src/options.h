@@ -0,0 +1,44 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "emulator.h"
+
+// Debugger checkpoints by default, every million instructions within 256MB
+#define CHECKPOINT_INTERVAL 1000000
+#define CHECKPOINT_BUDGET (256ULL << 20)
+
+// Command Line Options
+struct Options {
+    char *inputFile;
+    char *outputFile;
+    struct EmulatorConfig config; // --engine=<name>, --cache, --tier-threshold=<n>, --memory-size=<n>[K|M|G],
+                                  // --no-fusion, --fusion-stats, --tier-stats, --no-flag-liveness, --flag-stats,
+                                  // --max-instructions=<n>, --cores=<n>, --round-robin[=<n>]
+    bool aot;                     // --aot: write a C translation to the output file instead of running
+    bool batch;                   // --batch: the input lists programs to run, the output is a directory
+    int jobs;                     // --jobs=<n>: worker threads for --batch, one per core by default
+    int lanes;                    // --lanes=<n>: programs each --batch worker runs in lockstep in place of an engine, 1 by default
+    bool server;                  // --server: run the programs clients send, see server.c
+    char *socketPath;             // --socket=<path>: serve a Unix domain socket instead of stdin and stdout
+    char *snapshotFile;           // --snapshot=<file.snap>: save a snapshot at the point below, then carry on
+    uint64_t snapshotAt;          // --snapshot-at=<n>: after this many instructions
+    uint64_t snapshotPC;          // --snapshot-pc=<addr>: when PC first reaches this address
+    bool snapshotAtPC;
+    int snapshotPoints;           // how many of the two were given
+    bool restore;                 // --restore: the input is a snapshot to resume instead of a .bin
+    char *traceFile;              // --trace=<file.trace>: record every instruction run, see trace.h
+    bool profile;                 // --profile[=<file.prof>]: count the runs of every instruction, see profile.c
+    char *profileFile;            // where the report goes, stderr if not given
+    char *labelFile;              // --labels=<file.map>: labels written by the assembler for the report
+    bool debug;                   // --debug: step the program back and forth, see debug.c
+    uint64_t checkpointInterval;  // --checkpoint-every=<n>: instructions between the debugger's checkpoints
+    uint64_t checkpointBudget;    // --checkpoint-budget=<n>[K|M|G]: bytes the checkpoints may take
+};
+
+// Prototypes
+extern void parseOptions(int argc, char **argv, struct Options *options);
+
+#endif
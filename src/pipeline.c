@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "constants.h"
+#include "datatypes_em.h"
+#include "execute.h"
+#include "flags.h"
+#include "memory_em.h"
+#include "pipeline.h"
+
+// Emulator State
+_Thread_local struct EmulatorState *state;
+
+// Utility Functions
+void updatePC(void)
+{
+    state->PC += INSTR_BYTES;
+}
+
+void initializeState(uint64_t memorySize)
+{
+    memset(state, 0, sizeof(struct EmulatorState));
+    state->pstate.Z = true;
+    initializeMemory(memorySize);
+}
+
+// Back to the registers initializeState left
+void resetRegisters(void)
+{
+    memset(state->R, 0, sizeof(state->R));
+    state->ZR = 0;
+    state->PC = 0;
+    state->SP = 0;
+    state->instructions = 0;
+    state->pstate = (struct PSTATE){.Z = true};
+    state->pendingFlags = (struct PendingFlags){.op = FLAGS_EVALUATED};
+}
+
+// Back to the state initializeState left, clearing only the pages the last run touched
+void resetState(void)
+{
+    resetRegisters();
+    resetMemory();
+}
+
+//
+// Pipeline Stages
+//
+uint32_t fetch(uint64_t addr)
+{
+    // Fetch instruction from little endian memory
+    return readMemory32(addr);
+}
+
+int execute(Instruction instruction)
+{
+    switch (instruction.instructionType) {
+        case isDPI:
+            return executeDPI(instruction);
+        case isDPR:
+            return executeDPR(instruction);
+        case isSDT:
+            return executeSDT(instruction);
+        case isB:
+            return executeB(instruction);
+        default:
+            perror("Unsupported instruction type.\n");
+            return EXIT_FAILURE;
+    }
+}
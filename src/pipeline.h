@@ -0,0 +1,23 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "datatypes_em.h"
+#include "structs.h"
+
+// Pipeline Stages
+extern void updatePC(void);
+extern void initializeState(uint64_t memorySize);
+extern void resetRegisters(void);
+extern void resetState(void);
+extern uint32_t fetch(uint64_t addr);
+extern int execute(Instruction instruction);
+
+// Whether a run has executed as many instructions as it may
+static inline bool limitReached(void) {
+    return state->instructionLimit != 0 && state->instructions >= state->instructionLimit;
+}
+
+#endif
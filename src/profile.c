@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "constants.h"
+#include "datatypes_em.h"
+#include "decoders.h"
+#include "pipeline.h"
+#include "profile.h"
+#include "structs.h"
+
+// Profiles
+// The profiler counts the runs of each instruction in a flat array with an
+// entry per word of the code window, the engine adding one to the entry of
+// every instruction it runs. The report groups the instructions that ran into
+// basic blocks, hottest first, each line showing its count and the instruction
+// decoded again from memory. A block starts after a branch, at the target of a
+// direct branch or a label, and wherever the count changes, which catches the
+// targets of register branches as well. With a label map from the assembler,
+// a file of lines "<address> <label>", every address is shown as an offset
+// from the nearest label at or before it:
+//   assemble prog.s prog.bin prog.map
+//   emulate --profile --labels=prog.map prog.bin
+// Counting costs an increment per instruction on the cached reference engine,
+// which on the loop of big.s runs within a few percent of its speed unprofiled.
+
+#define PROFILE_WORDS (MEMORY_SIZE / INSTR_BYTES)
+#define LABEL_LENGTH 256     // longest label, with its terminator, "%255s" below
+#define MAP_LINE_LENGTH 512
+#define SYMBOL_LENGTH (LABEL_LENGTH + 20)
+#define MNEMONIC_LENGTH 48
+#define REGISTER_NAME_LENGTH 8
+
+typedef struct {
+    uint64_t address;
+    char name[LABEL_LENGTH];
+} Label;
+
+typedef struct {
+    size_t first; // index of its first instruction among those that ran
+    size_t length;
+    uint64_t total;
+} ProfileBlock;
+
+// Zeroed counts for the code window, indexed by addr / INSTR_BYTES
+uint64_t *createProfile(void)
+{
+    uint64_t *counts = (uint64_t *)calloc(PROFILE_WORDS, sizeof(uint64_t));
+    if (counts == NULL) {
+        perror("Failed to allocate space for the profile.\n");
+        exit(EXIT_FAILURE);
+    }
+    return counts;
+}
+
+//
+// Labels
+//
+static int compareLabels(const void *a, const void *b)
+{
+    uint64_t x = ((const Label *)a)->address;
+    uint64_t y = ((const Label *)b)->address;
+    return (x > y) - (x < y);
+}
+
+// Read a label map into labels, sorted by address
+static int readLabels(FILE *file, Label **labels, size_t *numLabels)
+{
+    char line[MAP_LINE_LENGTH];
+    size_t capacity = 0;
+    *labels = NULL;
+    *numLabels = 0;
+
+    while (file != NULL && fgets(line, sizeof(line), file) != NULL) {
+        if (*numLabels == capacity) {
+            capacity = (capacity == 0) ? 64 : capacity * 2;
+            *labels = (Label *)realloc(*labels, capacity * sizeof(Label));
+            if (*labels == NULL) {
+                perror("Failed to allocate space for the labels.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        Label *label = &(*labels)[*numLabels];
+        char extra;
+        if (sscanf(line, "%" SCNx64 " %255s %c", &label->address, label->name, &extra) != 2) {
+            fprintf(stderr, "Not a line of a label map: %s", line);
+            free(*labels);
+            return EXIT_FAILURE;
+        }
+        (*numLabels)++;
+    }
+    qsort(*labels, *numLabels, sizeof(Label), compareLabels);
+    return EXIT_SUCCESS;
+}
+
+// The nearest label at or before addr, NULL if there is none
+static const Label *findLabel(const Label *labels, size_t numLabels, uint64_t addr)
+{
+    size_t low = 0;
+    size_t high = numLabels;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (labels[middle].address <= addr) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return (low > 0) ? &labels[low - 1] : NULL;
+}
+
+static void symbolize(char *text, const Label *labels, size_t numLabels, uint64_t addr)
+{
+    const Label *label = findLabel(labels, numLabels, addr);
+    if (label == NULL) {
+        text[0] = '\0';
+    } else if (label->address == addr) {
+        snprintf(text, SYMBOL_LENGTH, "%s", label->name);
+    } else {
+        snprintf(text, SYMBOL_LENGTH, "%s+0x%lx", label->name, (unsigned long)(addr - label->address));
+    }
+}
+
+//
+// Mnemonics
+//
+static const char *arithmeticNames[] = {"add", "adds", "sub", "subs"};
+static const char *logicalNames[] = {"and", "bic", "orr", "orn", "eor", "eon", "ands", "bics"};
+static const char *wideMoveNames[] = {"movn", "movn", "movz", "movk"};
+static const char *shiftNames[] = {"lsl", "lsr", "asr", "ror"};
+
+// Register n of width sf, 31 being the stack pointer where stackPointer is set and the zero register elsewhere
+static void registerName(char name[REGISTER_NAME_LENGTH], bool sf, uint8_t n, bool stackPointer)
+{
+    if (n != ZR_SP) {
+        snprintf(name, REGISTER_NAME_LENGTH, "%c%d", sf ? 'x' : 'w', n);
+    } else if (stackPointer) {
+        snprintf(name, REGISTER_NAME_LENGTH, "%s", sf ? "sp" : "wsp");
+    } else {
+        snprintf(name, REGISTER_NAME_LENGTH, "%s", sf ? "xzr" : "wzr");
+    }
+}
+
+static const char *conditionName(const struct B *b)
+{
+    switch (b->cond.tag) {
+        case EQ_NE_TAG:
+            return b->cond.neg ? "ne" : "eq";
+        case GE_LT_TAG:
+            return b->cond.neg ? "lt" : "ge";
+        case GT_LE_TAG:
+            return b->cond.neg ? "le" : "gt";
+        case ALWAYS_TAG:
+            return "al";
+        default:
+            return "??";
+    }
+}
+
+static void formatDPI(char *text, const struct DPI *dpi)
+{
+    char rd[REGISTER_NAME_LENGTH], rn[REGISTER_NAME_LENGTH];
+    if (dpi->opi == WIDEMOVE) {
+        registerName(rd, dpi->sf, dpi->rd, false);
+        if (dpi->hw == 0) {
+            snprintf(text, MNEMONIC_LENGTH, "%s %s, #0x%x", wideMoveNames[dpi->opc], rd, dpi->imm16);
+        } else {
+            snprintf(text, MNEMONIC_LENGTH, "%s %s, #0x%x, lsl #%d", wideMoveNames[dpi->opc], rd, dpi->imm16,
+                     dpi->hw * WIDEMOVE_SHIFT);
+        }
+        return;
+    }
+    registerName(rd, dpi->sf, dpi->rd, dpi->opc % 2 == 0); // the flag setting forms write the zero register
+    registerName(rn, dpi->sf, dpi->rn, true);
+    snprintf(text, MNEMONIC_LENGTH, "%s %s, %s, #0x%x%s", arithmeticNames[dpi->opc], rd, rn, dpi->imm12,
+             dpi->sh ? ", lsl #12" : "");
+}
+
+static void formatDPR(char *text, const struct DPR *dpr)
+{
+    char rd[REGISTER_NAME_LENGTH], rn[REGISTER_NAME_LENGTH], rm[REGISTER_NAME_LENGTH], ra[REGISTER_NAME_LENGTH];
+    registerName(rd, dpr->sf, dpr->rd, false);
+    registerName(rn, dpr->sf, dpr->rn, false);
+    registerName(rm, dpr->sf, dpr->rm, false);
+    if (dpr->m) {
+        registerName(ra, dpr->sf, dpr->ra, false);
+        snprintf(text, MNEMONIC_LENGTH, "%s %s, %s, %s, %s", dpr->x ? "msub" : "madd", rd, rn, rm, ra);
+        return;
+    }
+    const char *name = dpr->armOrLog ? arithmeticNames[dpr->opc] : logicalNames[dpr->opc * 2 + dpr->n];
+    if (dpr->operand == 0 && dpr->shift == LOGICAL_SHIFT_LEFT) {
+        snprintf(text, MNEMONIC_LENGTH, "%s %s, %s, %s", name, rd, rn, rm);
+    } else {
+        snprintf(text, MNEMONIC_LENGTH, "%s %s, %s, %s, %s #%d", name, rd, rn, rm, shiftNames[dpr->shift],
+                 dpr->operand);
+    }
+}
+
+static void formatSDT(char *text, uint64_t pc, const struct SDT *sdt)
+{
+    char rt[REGISTER_NAME_LENGTH], xn[REGISTER_NAME_LENGTH], xm[REGISTER_NAME_LENGTH];
+    registerName(rt, sdt->sf, sdt->rt, false);
+    if (sdt->mode == 0) {
+        snprintf(text, MNEMONIC_LENGTH, "ldr %s, 0x%08lx", rt, (unsigned long)(pc + (int64_t)sdt->simm19 * INSTR_BYTES));
+        return;
+    }
+    const char *name = sdt->l ? "ldr" : "str";
+    registerName(xn, true, sdt->xn, true);
+    if (sdt->u) {
+        snprintf(text, MNEMONIC_LENGTH, "%s %s, [%s, #%d]", name, rt, xn,
+                 sdt->imm12 * (sdt->sf ? MODE64_BYTES : MODE32_BYTES));
+    } else if (sdt->offmode == 0) {
+        snprintf(text, MNEMONIC_LENGTH, sdt->i ? "%s %s, [%s, #%d]!" : "%s %s, [%s], #%d", name, rt, xn, sdt->simm9);
+    } else {
+        registerName(xm, true, sdt->xm, false);
+        snprintf(text, MNEMONIC_LENGTH, "%s %s, [%s, %s]", name, rt, xn, xm);
+    }
+}
+
+static void formatB(char *text, uint64_t pc, const struct B *b)
+{
+    char xn[REGISTER_NAME_LENGTH];
+    switch (b->type) {
+        case BRANCH_UNCONDITIONAL:
+            snprintf(text, MNEMONIC_LENGTH, "b 0x%08lx", (unsigned long)(pc + (int64_t)b->simm26 * INSTR_BYTES));
+            return;
+        case BRANCH_CONDITIONAL:
+            snprintf(text, MNEMONIC_LENGTH, "b.%s 0x%08lx", conditionName(b),
+                     (unsigned long)(pc + (int64_t)b->simm19 * INSTR_BYTES));
+            return;
+        default:
+            registerName(xn, true, b->xn, false);
+            snprintf(text, MNEMONIC_LENGTH, "br %s", xn);
+    }
+}
+
+// Assembly for the instruction at pc
+static void formatInstruction(char *text, uint64_t pc, const Instruction *instruction)
+{
+    switch (instruction->instructionType) {
+        case isDPI:
+            formatDPI(text, &instruction->dpi);
+            return;
+        case isDPR:
+            formatDPR(text, &instruction->dpr);
+            return;
+        case isSDT:
+            formatSDT(text, pc, &instruction->sdt);
+            return;
+        case isB:
+            formatB(text, pc, &instruction->b);
+            return;
+    }
+}
+
+//
+// Report
+//
+static int compareBlocks(const void *a, const void *b)
+{
+    const ProfileBlock *x = (const ProfileBlock *)a;
+    const ProfileBlock *y = (const ProfileBlock *)b;
+    if (x->total != y->total) {
+        return (x->total < y->total) - (x->total > y->total);
+    }
+    return (x->first > y->first) - (x->first < y->first);
+}
+
+// Where a direct branch goes, false for anything else
+static bool directTarget(uint64_t pc, const Instruction *instruction, uint64_t *target)
+{
+    if (instruction->instructionType != isB || instruction->b.type == BRANCH_REGISTER) {
+        return false;
+    }
+    int64_t offset = (instruction->b.type == BRANCH_UNCONDITIONAL) ? instruction->b.simm26 : instruction->b.simm19;
+    *target = pc + offset * INSTR_BYTES;
+    return true;
+}
+
+// Report the counts of the guest in state, whose memory holds the instructions that ran
+int writeProfile(FILE *file, const uint64_t *counts, FILE *labelFile)
+{
+    Label *labels;
+    size_t numLabels;
+    if (readLabels(labelFile, &labels, &numLabels) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    // The instructions that ran, in address order
+    size_t numRan = 0;
+    uint64_t total = 0;
+    for (size_t word = 0; word < PROFILE_WORDS; word++) {
+        numRan += counts[word] != 0;
+        total += counts[word];
+    }
+    uint32_t *words = (uint32_t *)malloc((numRan + 1) * sizeof(uint32_t));
+    Instruction *instructions = (Instruction *)malloc((numRan + 1) * sizeof(Instruction));
+    bool *decoded = (bool *)malloc((numRan + 1) * sizeof(bool));
+    bool *leaders = (bool *)calloc(PROFILE_WORDS, sizeof(bool));
+    ProfileBlock *blocks = (ProfileBlock *)malloc((numRan + 1) * sizeof(ProfileBlock));
+    if (words == NULL || instructions == NULL || decoded == NULL || leaders == NULL || blocks == NULL) {
+        perror("Failed to allocate space for the profile report.\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t i = 0;
+    for (size_t word = 0; word < PROFILE_WORDS; word++) {
+        if (counts[word] == 0) {
+            continue;
+        }
+        uint64_t target;
+        words[i] = word;
+        decoded[i] = decodeInstructionQuietly(fetch(word * INSTR_BYTES), &instructions[i]) == EXIT_SUCCESS;
+        if (decoded[i] && directTarget(word * INSTR_BYTES, &instructions[i], &target) && target < MEMORY_SIZE) {
+            leaders[target / INSTR_BYTES] = true;
+        }
+        i++;
+    }
+    for (size_t label = 0; label < numLabels; label++) {
+        if (labels[label].address < MEMORY_SIZE) {
+            leaders[labels[label].address / INSTR_BYTES] = true;
+        }
+    }
+
+    // Split them into blocks
+    size_t numBlocks = 0;
+    for (i = 0; i < numRan; i++) {
+        bool start = i == 0 || words[i] != words[i - 1] + 1 || leaders[words[i]]
+                     || counts[words[i]] != counts[words[i - 1]]
+                     || (decoded[i - 1] && instructions[i - 1].instructionType == isB);
+        if (start) {
+            blocks[numBlocks++] = (ProfileBlock){.first = i};
+        }
+        blocks[numBlocks - 1].length++;
+        blocks[numBlocks - 1].total += counts[words[i]];
+    }
+    qsort(blocks, numBlocks, sizeof(ProfileBlock), compareBlocks);
+
+    fprintf(file, "Profile of %lu instructions, %lu addresses in %lu blocks\n", (unsigned long)total,
+            (unsigned long)numRan, (unsigned long)numBlocks);
+    for (size_t block = 0; block < numBlocks; block++) {
+        const ProfileBlock *b = &blocks[block];
+        char symbol[SYMBOL_LENGTH];
+        uint64_t start = (uint64_t)words[b->first] * INSTR_BYTES;
+        symbolize(symbol, labels, numLabels, start);
+        fprintf(file, "\nBlock 0x%08lx-0x%08lx%s%s: %lu instructions, %.2f%%, %lu entries\n", (unsigned long)start,
+                (unsigned long)(start + (b->length - 1) * INSTR_BYTES), (symbol[0] != '\0') ? " " : "", symbol,
+                (unsigned long)b->total,
+                100.0 * b->total / total, (unsigned long)counts[words[b->first]]);
+        for (i = b->first; i < b->first + b->length; i++) {
+            char mnemonic[MNEMONIC_LENGTH];
+            uint64_t addr = (uint64_t)words[i] * INSTR_BYTES;
+            if (decoded[i]) {
+                formatInstruction(mnemonic, addr, &instructions[i]);
+            } else {
+                snprintf(mnemonic, MNEMONIC_LENGTH, ".int 0x%08x", fetch(addr));
+            }
+            symbolize(symbol, labels, numLabels, addr);
+            fprintf(file, "  0x%08lx %12lu %6.2f%%  ", (unsigned long)addr, (unsigned long)counts[words[i]],
+                    100.0 * counts[words[i]] / total);
+            fprintf(file, (symbol[0] != '\0') ? "%-32s %s\n" : "%s\n", mnemonic, symbol);
+        }
+    }
+
+    free(words);
+    free(instructions);
+    free(decoded);
+    free(leaders);
+    free(blocks);
+    free(labels);
+    return ferror(file) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
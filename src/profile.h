@@ -0,0 +1,11 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Prototypes
+extern uint64_t *createProfile(void);
+extern int writeProfile(FILE *file, const uint64_t *counts, FILE *labels);
+
+#endif
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "emulator.h"
+#include "server.h"
+
+// Emulator Server
+// Runs the programs clients send on one Emulator created up front, so a
+// request costs a reset of the pages the last program touched instead of a
+// process start. Requests and responses share a line based protocol:
+//   RUN <length> <limit>\n<length bytes of image>
+//       limit is the most instructions the program may run, 0 for the server's
+//   QUIT\n, or the end of the input, ends the session
+// Each RUN is answered by one of
+//   OK <instructions> <length>\n<length bytes of final state>
+//   LIMIT <instructions> <length>\n<length bytes of state where it stopped>
+//   ERROR <reason>\n
+// where the state is in the format of the .out files.
+
+#define COMMAND_LENGTH 128
+#define BACKLOG 16
+
+typedef struct {
+    Emulator *emulator;
+    uint64_t memorySize;
+    uint64_t defaultLimit;
+    uint8_t *image; // the last request's image, kept between requests
+    size_t imageCapacity;
+    char *state; // the final state of the last request, kept between requests
+    size_t stateLength;
+    FILE *stateFile; // writes to state
+} Server;
+
+//
+// Requests
+//
+// Read exactly length bytes of image, growing the buffer if needed
+static int readRequestImage(Server *server, FILE *in, size_t length)
+{
+    if (length > server->imageCapacity) {
+        free(server->image);
+        server->imageCapacity = length;
+        server->image = (uint8_t *)malloc(server->imageCapacity);
+        if (server->image == NULL) {
+            perror("Failed to allocate space for a request image.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return (fread(server->image, 1, length, in) == length) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void writeResponse(Server *server, FILE *out, const char *status)
+{
+    rewind(server->stateFile);
+    writeEmulatorState(server->emulator, server->stateFile);
+    fflush(server->stateFile);
+    fprintf(out, "%s %lu %zu\n", status, (unsigned long)readInstructionCount(server->emulator),
+            server->stateLength);
+    fwrite(server->state, 1, server->stateLength, out);
+}
+
+static void runRequest(Server *server, FILE *out, size_t length, uint64_t limit)
+{
+    Emulator *emulator = server->emulator;
+    resetEmulator(emulator);
+    loadImage(emulator, server->image, length);
+    if (limit == 0) {
+        limit = server->defaultLimit;
+    }
+    setInstructionLimit(emulator, limit);
+
+    if (runEmulator(emulator) == EXIT_SUCCESS) {
+        writeResponse(server, out, "OK");
+    } else if (limit != 0 && readInstructionCount(emulator) >= limit) {
+        writeResponse(server, out, "LIMIT");
+    } else {
+        fprintf(out, "ERROR run failed\n");
+    }
+}
+
+// Answer requests until QUIT or the end of the input
+static void serve(Server *server, FILE *in, FILE *out)
+{
+    char command[COMMAND_LENGTH];
+    while (fgets(command, sizeof(command), in) != NULL) {
+        unsigned long long length;
+        unsigned long long limit;
+        if (!strcmp(command, "QUIT\n")) {
+            break;
+        }
+        if (sscanf(command, "RUN %llu %llu", &length, &limit) != 2 || length == 0) {
+            fprintf(out, "ERROR malformed request\n");
+            fflush(out);
+            break;
+        }
+        if (length > server->memorySize) {
+            fprintf(out, "ERROR image does not fit in memory\n");
+            fflush(out);
+            break;
+        }
+        if (readRequestImage(server, in, length) != EXIT_SUCCESS) {
+            break;
+        }
+        runRequest(server, out, length, limit);
+        fflush(out);
+    }
+}
+
+//
+// Transports
+//
+// Serve connections on a Unix domain socket one after another
+static int serveSocket(Server *server, const char *path)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return EXIT_FAILURE;
+    }
+    strcpy(address.sun_path, path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("Could not create the socket.");
+        return EXIT_FAILURE;
+    }
+    unlink(path);
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0
+        || listen(listener, BACKLOG) != 0) {
+        perror("Could not listen on the socket.");
+        close(listener);
+        return EXIT_FAILURE;
+    }
+
+    int connection;
+    while ((connection = accept(listener, NULL, NULL)) >= 0) {
+        int outFd = dup(connection);
+        FILE *in = fdopen(connection, "rb");
+        FILE *out = (outFd >= 0) ? fdopen(outFd, "wb") : NULL;
+        if (in != NULL && out != NULL) {
+            serve(server, in, out);
+        }
+        if (in != NULL) {
+            fclose(in);
+        } else {
+            close(connection);
+        }
+        if (out != NULL) {
+            fclose(out);
+        } else if (outFd >= 0) {
+            close(outFd);
+        }
+    }
+    perror("Could not accept a connection.");
+    close(listener);
+    unlink(path);
+    return EXIT_FAILURE;
+}
+
+//
+// Server
+//
+// Serve stdin and stdout, or every client of the socket at socketPath if it is not NULL
+int runServer(const char *socketPath, const struct EmulatorConfig *config)
+{
+    Server server = {.memorySize = config->memorySize, .defaultLimit = config->instructionLimit};
+    server.emulator = createEmulator(config);
+    if (server.emulator == NULL) {
+        fprintf(stderr, "Invalid emulator configuration.\n");
+        return EXIT_FAILURE;
+    }
+    server.stateFile = open_memstream(&server.state, &server.stateLength);
+    if (server.stateFile == NULL) {
+        perror("Failed to allocate space for the responses.\n");
+        exit(EXIT_FAILURE);
+    }
+    signal(SIGPIPE, SIG_IGN); // a client leaving early only ends its session
+
+    int result = EXIT_SUCCESS;
+    if (socketPath != NULL) {
+        result = serveSocket(&server, socketPath);
+    } else {
+        serve(&server, stdin, stdout);
+    }
+
+    fclose(server.stateFile);
+    free(server.state);
+    free(server.image);
+    freeEmulator(server.emulator);
+    freeEngineTables();
+    return result;
+}
@@ -0,0 +1,9 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "emulator.h"
+
+// Prototypes
+extern int runServer(const char *socketPath, const struct EmulatorConfig *config);
+
+#endif
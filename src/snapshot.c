@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "constants.h"
+#include "datatypes_em.h"
+#include "flags.h"
+#include "memory_em.h"
+#include "pipeline.h"
+#include "snapshot.h"
+
+// Snapshots
+// A snapshot holds the registers, flags and non-zero pages of the guest in
+// state, enough to resume it exactly where it was. The file holds
+//   SNAPSHOT_MAGIC, then the little-endian doublewords of the header below
+//   the number of each page, a doubleword each, in increasing order
+//   zeroes up to the next multiple of GUEST_PAGE_SIZE
+//   the pages themselves, GUEST_PAGE_SIZE bytes each
+// Keeping the pages aligned in the file lets a restore map them copy-on-write
+// rather than read them, so it costs a page table entry per page and a run
+// from it only reads in the pages it touches. Other files are read instead.
+
+#define SNAPSHOT_MAGIC "EMUSNAP1"
+#define MAGIC_LENGTH 8
+
+// Doublewords of the header
+enum SnapshotHeader {
+    HEADER_MEMORY_SIZE,
+    HEADER_INSTRUCTIONS,
+    HEADER_PC,
+    HEADER_SP,
+    HEADER_ZR,
+    HEADER_FLAGS, // NZCV in bits 3 to 0
+    HEADER_PAGES,
+    HEADER_REGISTERS, // X00-X30
+    HEADER_WORDS = HEADER_REGISTERS + NUM_OF_REGISTERS,
+};
+#define HEADER_LENGTH (MAGIC_LENGTH + HEADER_WORDS * MODE64_BYTES)
+
+// Bytes of zeroes after the header and page numbers, so the pages start on a page boundary
+static uint64_t paddingLength(uint64_t numPages)
+{
+    uint64_t used = HEADER_LENGTH + numPages * MODE64_BYTES;
+    return (GUEST_PAGE_SIZE - used % GUEST_PAGE_SIZE) % GUEST_PAGE_SIZE;
+}
+
+static int writeDoubleword(FILE *file, uint64_t value)
+{
+    uint8_t bytes[MODE64_BYTES];
+    storeLittle64(bytes, value);
+    return (fwrite(bytes, 1, sizeof(bytes), file) == sizeof(bytes)) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int writeSnapshot(FILE *file)
+{
+    evaluateFlags();
+    struct DirtyPage *pages;
+    size_t numDirty = sortDirtyPages(&pages);
+    uint64_t numPages = 0;
+    for (size_t i = 0; i < numDirty; i++) {
+        numPages += !isZeroPage(pages[i].host);
+    }
+
+    uint64_t header[HEADER_WORDS] = {
+        [HEADER_MEMORY_SIZE] = state->memory.size,
+        [HEADER_INSTRUCTIONS] = state->instructions,
+        [HEADER_PC] = state->PC,
+        [HEADER_SP] = state->SP,
+        [HEADER_ZR] = state->ZR,
+        [HEADER_FLAGS] = state->pstate.N << 3 | state->pstate.Z << 2 | state->pstate.C << 1 | state->pstate.V,
+        [HEADER_PAGES] = numPages,
+    };
+    memcpy(&header[HEADER_REGISTERS], state->R, sizeof(state->R));
+
+    int result = (fwrite(SNAPSHOT_MAGIC, 1, MAGIC_LENGTH, file) == MAGIC_LENGTH) ? EXIT_SUCCESS : EXIT_FAILURE;
+    for (int i = 0; i < HEADER_WORDS && result == EXIT_SUCCESS; i++) {
+        result = writeDoubleword(file, header[i]);
+    }
+    for (size_t i = 0; i < numDirty && result == EXIT_SUCCESS; i++) {
+        if (!isZeroPage(pages[i].host)) {
+            result = writeDoubleword(file, pages[i].page);
+        }
+    }
+    for (uint64_t i = 0; i < paddingLength(numPages) && result == EXIT_SUCCESS; i++) {
+        result = (fputc(0, file) != EOF) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < numDirty && result == EXIT_SUCCESS; i++) {
+        if (!isZeroPage(pages[i].host) && fwrite(pages[i].host, 1, GUEST_PAGE_SIZE, file) != GUEST_PAGE_SIZE) {
+            result = EXIT_FAILURE;
+        }
+    }
+    return result;
+}
+
+// Read the pages following the padding into memory, for files that cannot be mapped
+static int readPages(FILE *file, const uint64_t *pages, uint64_t numPages)
+{
+    uint8_t buffer[GUEST_PAGE_SIZE];
+    uint64_t padding = paddingLength(numPages);
+    if (fread(buffer, 1, padding, file) != padding) {
+        return EXIT_FAILURE;
+    }
+    for (uint64_t i = 0; i < numPages; i++) {
+        if (fread(buffer, 1, GUEST_PAGE_SIZE, file) != GUEST_PAGE_SIZE) {
+            return EXIT_FAILURE;
+        }
+        copyToMemory(pages[i] << GUEST_PAGE_SHIFT, buffer, GUEST_PAGE_SIZE);
+    }
+    return EXIT_SUCCESS;
+}
+
+// Replace the guest in state with a snapshot, which must have the same memory size
+int readSnapshot(FILE *file)
+{
+    uint8_t bytes[HEADER_LENGTH];
+    if (fread(bytes, 1, HEADER_LENGTH, file) != HEADER_LENGTH || memcmp(bytes, SNAPSHOT_MAGIC, MAGIC_LENGTH)) {
+        fprintf(stderr, "Not a snapshot.\n");
+        return EXIT_FAILURE;
+    }
+    uint64_t header[HEADER_WORDS];
+    for (int i = 0; i < HEADER_WORDS; i++) {
+        header[i] = loadLittle64(&bytes[MAGIC_LENGTH + i * MODE64_BYTES]);
+    }
+    uint64_t memoryPages = state->memory.size >> GUEST_PAGE_SHIFT;
+    if (header[HEADER_MEMORY_SIZE] != state->memory.size) {
+        fprintf(stderr, "The snapshot is of a %lu byte memory, not %lu.\n",
+                (unsigned long)header[HEADER_MEMORY_SIZE], (unsigned long)state->memory.size);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t numPages = (header[HEADER_PAGES] <= memoryPages) ? header[HEADER_PAGES] : 0;
+    int result = (header[HEADER_PAGES] <= memoryPages) ? EXIT_SUCCESS : EXIT_FAILURE;
+    uint64_t *pages = (uint64_t *)malloc((numPages + 1) * sizeof(uint64_t));
+    if (pages == NULL) {
+        perror("Failed to allocate space for the snapshot pages.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint64_t i = 0; i < numPages && result == EXIT_SUCCESS; i++) {
+        uint8_t page[MODE64_BYTES];
+        if (fread(page, 1, sizeof(page), file) != sizeof(page)) {
+            result = EXIT_FAILURE;
+            continue;
+        }
+        pages[i] = loadLittle64(page);
+        if (pages[i] >= memoryPages || (i > 0 && pages[i] <= pages[i - 1])) {
+            result = EXIT_FAILURE;
+        }
+    }
+
+    if (result == EXIT_SUCCESS) {
+        resetState();
+        struct stat status;
+        uint64_t offset = HEADER_LENGTH + numPages * MODE64_BYTES + paddingLength(numPages);
+        bool mapped = numPages > 0 && fstat(fileno(file), &status) == 0 && S_ISREG(status.st_mode)
+                      && (uint64_t)status.st_size >= offset + numPages * GUEST_PAGE_SIZE
+                      && mapPages(fileno(file), offset, pages, numPages) == EXIT_SUCCESS;
+        if (!mapped) {
+            result = readPages(file, pages, numPages);
+        }
+    }
+    free(pages);
+    if (result != EXIT_SUCCESS) {
+        fprintf(stderr, "The snapshot is cut short or damaged.\n");
+        resetState();
+        return EXIT_FAILURE;
+    }
+
+    memcpy(state->R, &header[HEADER_REGISTERS], sizeof(state->R));
+    state->instructions = header[HEADER_INSTRUCTIONS];
+    state->PC = header[HEADER_PC];
+    state->SP = header[HEADER_SP];
+    state->ZR = header[HEADER_ZR];
+    uint64_t flags = header[HEADER_FLAGS];
+    state->pstate = (struct PSTATE){.N = flags >> 3 & 1, .Z = flags >> 2 & 1, .C = flags >> 1 & 1, .V = flags & 1};
+    state->pendingFlags.op = FLAGS_EVALUATED;
+    return EXIT_SUCCESS;
+}
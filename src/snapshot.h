@@ -0,0 +1,10 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdio.h>
+
+// Prototypes
+extern int writeSnapshot(FILE *file);
+extern int readSnapshot(FILE *file);
+
+#endif
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "block.h"
+#include "constants.h"
+#include "datatypes_em.h"
+#include "execute.h"
+#include "flags.h"
+#include "specialize.h"
+
+// Specialized Handlers
+// The data processing handlers are instantiated once per combination of width
+// (sf), opcode and shift mode, with each of them a literal constant in the body,
+// so the compiler drops the masking, opcode and shift-mode branches that the
+// execute functions take on every instruction. selectSpecializedHandler picks
+// the variant once, when the block is built. Each variant has exactly the
+// semantics of its execute function, quirks included.
+
+#define DISPATCH(op) TAIL_CALL return (op + 1)->handler(op + 1)
+
+// Truncate to the operand width, a no-op once SF is a constant 1
+#define WIDTH(SF, value) ((SF) ? (int64_t)(value) : (int64_t)((value) & MASK32))
+
+// Same result as shift in execute.c
+static inline int64_t shiftOperand(int64_t value, int8_t amount, uint8_t mode, bool sf)
+{
+    amount %= (sf) ? MODE64 : MODE32;
+
+    switch (mode) {
+        case LOGICAL_SHIFT_LEFT:
+            return (sf) ? (value << amount)
+                        : ((int32_t)value << amount) & MASK32;
+        case LOGICAL_SHIFT_RIGHT:
+            return (sf) ? (uint64_t)value >> amount
+                        : ((uint32_t)value >> amount) & MASK32;
+        case ARITHMETIC_SHIFT_RIGHT:
+            return (sf) ? value >> amount
+                        : ((int32_t)value >> amount) & MASK32;
+        default: // ROTATE_RIGHT
+            return (sf) ? ((uint64_t)value >> amount) | value << (MODE64 - amount)
+                        : (((uint32_t)value >> amount) | value << (MODE32 - amount)) & MASK32;
+    }
+}
+
+// addOrSub in execute.c, for a constant OPC
+#define ADD_OR_SUB(OPC, SF, rd, Rd, a, b)                                        \
+    do {                                                                         \
+        bool isAdd = ((OPC) == ADD || (OPC) == ADD_SETFLAGS);                    \
+        if ((OPC) == ADD || (OPC) == SUB) {                                      \
+            *(Rd) = isAdd ? (a) + (b) : (a) - (b);                               \
+        } else {                                                                 \
+            if ((rd) != ZR_SP) {                                                 \
+                *(Rd) = isAdd ? (a) + (b) : (a) - (b);                           \
+            }                                                                    \
+            setFlagsLazily(isAdd ? FLAGS_ADD : FLAGS_SUB, (a), (b), (SF));       \
+        }                                                                        \
+    } while (0)
+
+//
+// Handler Templates
+//
+#define ARITHMETIC_IMMEDIATE_HANDLER(SF, OPC)                                    \
+    static enum BlockExit runArithmeticImmediate_##SF##_##OPC(Op *op)            \
+    {                                                                            \
+        struct DPI dpi = op->instruction.dpi;                                    \
+        int64_t *Rd = (dpi.rd == ZR_SP) ? &state->SP : &state->R[dpi.rd];          \
+        int64_t imm12 = ((int64_t)dpi.imm12) << (ARITHMETIC_SHIFT * dpi.sh);     \
+        int64_t Rn = WIDTH(SF, (dpi.rn == ZR_SP) ? state->SP : state->R[dpi.rn]);  \
+        ADD_OR_SUB(OPC, SF, dpi.rd, Rd, Rn, imm12);                              \
+        *Rd = WIDTH(SF, *Rd);                                                    \
+        state->PC += INSTR_BYTES;                                                 \
+        DISPATCH(op);                                                            \
+    }
+
+#define WIDE_MOVE_HANDLER(SF, OPC)                                               \
+    static enum BlockExit runWideMove_##SF##_##OPC(Op *op)                       \
+    {                                                                            \
+        struct DPI dpi = op->instruction.dpi;                                    \
+        int64_t *Rd = (dpi.rd == ZR_SP) ? &state->SP : &state->R[dpi.rd];          \
+        if (dpi.rd != ZR_SP) {                                                   \
+            uint64_t imm16 = ((uint64_t)dpi.imm16) << (dpi.hw * WIDEMOVE_SHIFT); \
+            if ((OPC) == MOVE_WITH_NOT) {                                        \
+                *Rd = ~imm16;                                                    \
+            } else if ((OPC) == MOVE_WITH_ZERO) {                                \
+                *Rd = imm16;                                                     \
+            } else {                                                             \
+                int64_t mask = MASK16 << (dpi.hw * 16);                          \
+                *Rd = (*Rd & ~mask) | imm16;                                     \
+            }                                                                    \
+        }                                                                        \
+        *Rd = WIDTH(SF, *Rd);                                                    \
+        state->PC += INSTR_BYTES;                                                 \
+        DISPATCH(op);                                                            \
+    }
+
+// readOperandsDPR in execute.c
+#define READ_OPERANDS_DPR(SF, dpr, Rn, Rm)                                       \
+    int64_t Rm = WIDTH(SF, ((dpr).rm != ZR_SP) ? state->R[(dpr).rm] : state->ZR);  \
+    int64_t Rn = WIDTH(SF, ((dpr).rm != ZR_SP) ? state->R[(dpr).rn] : state->ZR)
+
+#define ARITHMETIC_REGISTER_HANDLER(SF, OPC, MODE)                               \
+    static enum BlockExit runArithmeticRegister_##SF##_##OPC##_##MODE(Op *op)    \
+    {                                                                            \
+        struct DPR dpr = op->instruction.dpr;                                    \
+        int64_t *Rd = &state->R[dpr.rd];                                          \
+        READ_OPERANDS_DPR(SF, dpr, Rn, Rm);                                      \
+        int64_t op2 = shiftOperand(Rm, dpr.operand, (MODE), (SF));               \
+        ADD_OR_SUB(OPC, SF, dpr.rd, Rd, Rn, op2);                                \
+        *Rd = WIDTH(SF, *Rd);                                                    \
+        state->PC += INSTR_BYTES;                                                 \
+        DISPATCH(op);                                                            \
+    }
+
+#define LOGICAL_REGISTER_HANDLER(SF, OPC, N, MODE)                               \
+    static enum BlockExit runLogicalRegister_##SF##_##OPC##_##N##_##MODE(Op *op) \
+    {                                                                            \
+        struct DPR dpr = op->instruction.dpr;                                    \
+        int64_t *Rd = &state->R[dpr.rd];                                          \
+        READ_OPERANDS_DPR(SF, dpr, Rn, Rm);                                      \
+        int64_t op2 = shiftOperand(Rm, dpr.operand, (MODE), (SF));               \
+        if (N) {                                                                 \
+            op2 = ~op2;                                                          \
+        }                                                                        \
+        if ((OPC) == BITWISE_AND) {                                              \
+            *Rd = Rn & op2;                                                      \
+        } else if ((OPC) == BITWISE_OR) {                                        \
+            *Rd = Rn | op2;                                                      \
+        } else if ((OPC) == BITWISE_XOR) {                                       \
+            *Rd = Rn ^ op2;                                                      \
+        } else {                                                                 \
+            if (dpr.rd != ZR_SP) {                                               \
+                *Rd = Rn & op2;                                                  \
+            }                                                                    \
+            setFlagsLazily(FLAGS_AND, Rn, op2, (SF));                            \
+        }                                                                        \
+        *Rd = WIDTH(SF, *Rd);                                                    \
+        state->PC += INSTR_BYTES;                                                 \
+        DISPATCH(op);                                                            \
+    }
+
+#define MULTIPLY_HANDLER(SF, X)                                                  \
+    static enum BlockExit runMultiply_##SF##_##X(Op *op)                         \
+    {                                                                            \
+        struct DPR dpr = op->instruction.dpr;                                    \
+        int64_t *Rd = &state->R[dpr.rd];                                          \
+        READ_OPERANDS_DPR(SF, dpr, Rn, Rm);                                      \
+        if (dpr.rd != ZR_SP) {                                                   \
+            int64_t Ra = (dpr.ra != ZR_SP) ? state->R[dpr.ra] : state->ZR;         \
+            *Rd = (X) ? Ra - (Rn * Rm) : Ra + (Rn * Rm);                         \
+        }                                                                        \
+        *Rd = WIDTH(SF, *Rd);                                                    \
+        state->PC += INSTR_BYTES;                                                 \
+        DISPATCH(op);                                                            \
+    }
+
+//
+// Instantiation
+//
+// Each FOR_* macro applies M to every value of one more parameter
+#define FOR_OPCS(M, ...) M(__VA_ARGS__, 0) M(__VA_ARGS__, 1) M(__VA_ARGS__, 2) M(__VA_ARGS__, 3)
+#define FOR_MODES(M, ...) M(__VA_ARGS__, 0) M(__VA_ARGS__, 1) M(__VA_ARGS__, 2) M(__VA_ARGS__, 3)
+#define FOR_NEGATIONS(M, ...) M(__VA_ARGS__, 0) M(__VA_ARGS__, 1)
+
+#define EACH_SF_OPC(M) \
+    FOR_OPCS(M, 0) FOR_OPCS(M, 1)
+#define EACH_SF_OPC_MODE(M) \
+    EACH_SF_OPC_MODE_FOR(M, 0) EACH_SF_OPC_MODE_FOR(M, 1)
+#define EACH_SF_OPC_MODE_FOR(M, SF) \
+    FOR_MODES(M, SF, 0) FOR_MODES(M, SF, 1) FOR_MODES(M, SF, 2) FOR_MODES(M, SF, 3)
+#define EACH_SF_OPC_N_MODE(M) \
+    EACH_SF_OPC_N_MODE_FOR(M, 0) EACH_SF_OPC_N_MODE_FOR(M, 1)
+#define EACH_SF_OPC_N_MODE_FOR(M, SF) \
+    EACH_OPC_N_MODE_FOR(M, SF, 0) EACH_OPC_N_MODE_FOR(M, SF, 1) EACH_OPC_N_MODE_FOR(M, SF, 2) EACH_OPC_N_MODE_FOR(M, SF, 3)
+#define EACH_OPC_N_MODE_FOR(M, SF, OPC) \
+    FOR_MODES(M, SF, OPC, 0) FOR_MODES(M, SF, OPC, 1)
+
+EACH_SF_OPC(ARITHMETIC_IMMEDIATE_HANDLER)
+EACH_SF_OPC_MODE(ARITHMETIC_REGISTER_HANDLER)
+EACH_SF_OPC_N_MODE(LOGICAL_REGISTER_HANDLER)
+
+WIDE_MOVE_HANDLER(0, 0)
+WIDE_MOVE_HANDLER(0, 2)
+WIDE_MOVE_HANDLER(0, 3)
+WIDE_MOVE_HANDLER(1, 0)
+WIDE_MOVE_HANDLER(1, 2)
+WIDE_MOVE_HANDLER(1, 3)
+
+MULTIPLY_HANDLER(0, 0)
+MULTIPLY_HANDLER(0, 1)
+MULTIPLY_HANDLER(1, 0)
+MULTIPLY_HANDLER(1, 1)
+
+// Tables indexed by the decoded fields
+#define ARITHMETIC_IMMEDIATE_ENTRY(SF, OPC) [SF][OPC] = runArithmeticImmediate_##SF##_##OPC,
+#define ARITHMETIC_REGISTER_ENTRY(SF, OPC, MODE) [SF][OPC][MODE] = runArithmeticRegister_##SF##_##OPC##_##MODE,
+#define LOGICAL_REGISTER_ENTRY(SF, OPC, N, MODE) [SF][OPC][N][MODE] = runLogicalRegister_##SF##_##OPC##_##N##_##MODE,
+
+static const Handler arithmeticImmediateHandlers[2][4] = {
+    EACH_SF_OPC(ARITHMETIC_IMMEDIATE_ENTRY)};
+
+static const Handler arithmeticRegisterHandlers[2][4][4] = {
+    EACH_SF_OPC_MODE(ARITHMETIC_REGISTER_ENTRY)};
+
+static const Handler logicalRegisterHandlers[2][4][2][4] = {
+    EACH_SF_OPC_N_MODE(LOGICAL_REGISTER_ENTRY)};
+
+static const Handler wideMoveHandlers[2][4] = {
+    [0][MOVE_WITH_NOT] = runWideMove_0_0,
+    [0][MOVE_WITH_ZERO] = runWideMove_0_2,
+    [0][MOVE_WITH_KEEP] = runWideMove_0_3,
+    [1][MOVE_WITH_NOT] = runWideMove_1_0,
+    [1][MOVE_WITH_ZERO] = runWideMove_1_2,
+    [1][MOVE_WITH_KEEP] = runWideMove_1_3};
+
+static const Handler multiplyHandlers[2][2] = {
+    {runMultiply_0_0, runMultiply_0_1},
+    {runMultiply_1_0, runMultiply_1_1}};
+
+// Variant for a data processing instruction, NULL for everything else
+Handler selectSpecializedHandler(Instruction *instruction)
+{
+    switch (instruction->instructionType) {
+        case isDPI: {
+            struct DPI dpi = instruction->dpi;
+            switch (dpi.opi) {
+                case ARITHMETIC:
+                    return arithmeticImmediateHandlers[dpi.sf][dpi.opc];
+                case WIDEMOVE:
+                    return wideMoveHandlers[dpi.sf][dpi.opc];
+            }
+            return NULL;
+        }
+        case isDPR: {
+            struct DPR dpr = instruction->dpr;
+            if (dpr.m == 1) {
+                return multiplyHandlers[dpr.sf][dpr.x];
+            }
+            return (dpr.armOrLog == 1) ? arithmeticRegisterHandlers[dpr.sf][dpr.opc][dpr.shift]
+                                       : logicalRegisterHandlers[dpr.sf][dpr.opc][dpr.n][dpr.shift];
+        }
+        default:
+            return NULL;
+    }
+}
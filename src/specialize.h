@@ -0,0 +1,10 @@
+#ifndef SPECIALIZE_H
+#define SPECIALIZE_H
+
+#include "block.h"
+#include "structs.h"
+
+// Prototypes
+extern Handler selectSpecializedHandler(Instruction *instruction);
+
+#endif
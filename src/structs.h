@@ -1,9 +1,9 @@
+#ifndef STRUCTS_H
+#define STRUCTS_H
+
 #include <stdint.h>
 #include <stdbool.h>
 
-#define MAX_TOKEN_LENGTH 20
-#define NUM_TOKENS 5
-
 // Specific ADTs
 
 // Data Processing Immediate
@@ -109,21 +109,10 @@ typedef struct {
     };
 } Instruction;
 
-typedef struct
-{
-    enum type type;
-    int numTokens;
-    char *tokens[NUM_TOKENS];
-    char instrname[MAX_TOKEN_LENGTH];
-    char buff[BUFFER_LENGTH];
-} InstructionParse;
-
 
 // Malloc / Free Functions
 extern Instruction *initializeInstruction();
 
 extern void freeInstruction(Instruction *instruction);
 
-extern InstructionParse *initializeInstructionParse();
-
-extern void freeInstructionParse(InstructionParse *instr);
\ No newline at end of file
+#endif
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "block.h"
+#include "constants.h"
+#include "datatypes_em.h"
+#include "execute.h"
+#include "liveness.h"
+#include "pipeline.h"
+#include "specialize.h"
+#include "threaded.h"
+
+// Threaded Interpreter
+// Each op ends by tail calling the handler of the next op in its block, so the
+// instruction class is resolved once when the block is built instead of on
+// every execution, and the halt instruction is only checked between blocks.
+
+#define DISPATCH(op) TAIL_CALL return (op + 1)->handler(op + 1)
+
+// Handler for an instruction that always falls through to the next op
+#define STRAIGHT_HANDLER(name, executeFunction)                      \
+    static enum BlockExit name(Op *op)                               \
+    {                                                                \
+        if (executeFunction(op->instruction) != EXIT_SUCCESS) {      \
+            return BLOCK_ERROR;                                      \
+        }                                                            \
+        DISPATCH(op);                                                \
+    }
+
+// Handler for a branch, which always ends its block
+#define BRANCH_HANDLER(name, executeFunction)                        \
+    static enum BlockExit name(Op *op)                               \
+    {                                                                \
+        return (executeFunction(op->instruction) != EXIT_SUCCESS)    \
+               ? BLOCK_ERROR : BLOCK_NEXT;                           \
+    }
+
+STRAIGHT_HANDLER(runArithmeticImmediate, executeArithmeticImmediate)
+STRAIGHT_HANDLER(runWideMove, executeWideMove)
+STRAIGHT_HANDLER(runArithmeticRegister, executeArithmeticRegister)
+STRAIGHT_HANDLER(runLogicalRegister, executeLogicalRegister)
+STRAIGHT_HANDLER(runMultiply, executeMultiply)
+STRAIGHT_HANDLER(runInvalid, execute)
+
+BRANCH_HANDLER(runBranchUnconditional, executeBranchUnconditional)
+BRANCH_HANDLER(runBranchConditional, executeBranchConditional)
+BRANCH_HANDLER(runBranchRegister, executeBranchRegister)
+BRANCH_HANDLER(runInvalidBranch, executeB)
+
+// Loads and stores, a store into the running block ends it early
+static enum BlockExit runSDT(Op *op)
+{
+    if (executeSDT(op->instruction) != EXIT_SUCCESS) {
+        return BLOCK_ERROR;
+    }
+    if (blocksModified) {
+        return BLOCK_NEXT;
+    }
+    DISPATCH(op);
+}
+
+// Exit ops, placed after the last instruction of every block
+static enum BlockExit runEndOfBlock(Op *op)
+{
+    (void)op;
+    return BLOCK_NEXT;
+}
+
+static enum BlockExit runHalt(Op *op)
+{
+    (void)op;
+    return BLOCK_HALT;
+}
+
+// Handler built on the execute function of the instruction class
+Handler selectGenericHandler(Instruction *instruction)
+{
+    switch (instruction->instructionType) {
+        case isDPI:
+            switch (instruction->dpi.opi) {
+                case ARITHMETIC:
+                    return runArithmeticImmediate;
+                case WIDEMOVE:
+                    return runWideMove;
+            }
+            break;
+        case isDPR:
+            if (instruction->dpr.m == 1) {
+                return runMultiply;
+            }
+            return (instruction->dpr.armOrLog == 1) ? runArithmeticRegister : runLogicalRegister;
+        case isSDT:
+            return runSDT;
+        case isB:
+            switch (instruction->b.type) {
+                case BRANCH_UNCONDITIONAL:
+                    return runBranchUnconditional;
+                case BRANCH_CONDITIONAL:
+                    return runBranchConditional;
+                case BRANCH_REGISTER:
+                    return runBranchRegister;
+            }
+            return runInvalidBranch;
+    }
+    // Let the reference execute report the error when the op is reached
+    return runInvalid;
+}
+
+// Variant specialized for the width and opcode of the instruction where there is one
+Handler selectHandler(Instruction *instruction)
+{
+    Handler handler = selectSpecializedHandler(instruction);
+    return (handler != NULL) ? handler : selectGenericHandler(instruction);
+}
+
+Handler selectExitHandler(bool halts)
+{
+    return (halts) ? runHalt : runEndOfBlock;
+}
+
+// Run whole blocks until one ends at the halt instruction
+int runThreaded(void)
+{
+    Block *block;
+    enum BlockExit result = BLOCK_NEXT;
+    initializeBlocks();
+
+    while (result == BLOCK_NEXT) {
+        if (blocksModified) {
+            flushBlocks();
+        }
+        if (lookupBlock(state->PC, &block) != EXIT_SUCCESS) {
+            result = BLOCK_ERROR;
+            break;
+        }
+        if (block->length > 0 && limitReached()) {
+            result = BLOCK_ERROR;
+            break;
+        }
+        flagUpdatesEliminated += block->deadFlags;
+        state->instructions += block->length;
+        result = block->ops[0].handler(block->ops);
+    }
+
+    flushBlocks();
+    return (result == BLOCK_HALT) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
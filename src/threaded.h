@@ -0,0 +1,13 @@
+#ifndef THREADED_H
+#define THREADED_H
+
+#include "block.h"
+#include "structs.h"
+
+// Prototypes
+extern Handler selectGenericHandler(Instruction *instruction);
+extern Handler selectHandler(Instruction *instruction);
+extern Handler selectExitHandler(bool halts);
+extern int runThreaded(void);
+
+#endif
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "block.h"
+#include "constants.h"
+#include "datatypes_em.h"
+#include "decoders.h"
+#include "liveness.h"
+#include "pipeline.h"
+#include "tiered.h"
+#include "utils_em.h"
+
+// Tiered Execution
+// Every block starts out in the reference interpreter, which fetches and decodes
+// each instruction as it runs. Once a block has been entered threshold times it
+// is promoted, and from its next entry on it runs as a threaded block that was
+// decoded once. Blocks end at the same boundaries in both tiers.
+
+enum Tier {
+    TIER_INTERPRETER,
+    TIER_THREADED,
+    NUM_TIERS,
+};
+
+static const char *tierNames[] = {
+    "interpreter", "threaded"};
+
+// Work done in one tier
+struct TierCounts {
+    uint64_t blocks;
+    uint64_t instructions;
+};
+
+static _Thread_local struct TierCounts counts[NUM_TIERS];
+static _Thread_local uint32_t *hotness = NULL; // entries into the block at each word, indexed by addr / 4
+static _Thread_local uint64_t promotions = 0;
+// Words with a non-zero count, so the counters kept for the next run on the thread are cleared cheaply
+static _Thread_local uint32_t *countedWords = NULL;
+static _Thread_local size_t numCounted = 0;
+static _Thread_local size_t countedCapacity = 0;
+
+// Run the block at PC one instruction at a time
+static enum BlockExit interpretBlock(void)
+{
+    Instruction instruction;
+
+    for (int length = 0; length < MAX_BLOCK_INSTRS; length++) {
+        uint32_t instr = fetch(state->PC);
+        if (instr == HALT_INSTR) {
+            return BLOCK_HALT;
+        }
+        if (limitReached() || decodeInstruction(instr, &instruction) != EXIT_SUCCESS) {
+            return BLOCK_ERROR;
+        }
+        flagUpdatesEliminated += eliminateDeadFlags(state->PC, &instruction);
+        if (execute(instruction) != EXIT_SUCCESS) {
+            return BLOCK_ERROR;
+        }
+        counts[TIER_INTERPRETER].instructions++;
+        state->instructions++;
+        if (instruction.instructionType == isB) {
+            break;
+        }
+    }
+    return BLOCK_NEXT;
+}
+
+// Run the promoted block at PC
+static enum BlockExit runBlock(void)
+{
+    Block *block;
+    if (lookupBlock(state->PC, &block) != EXIT_SUCCESS) {
+        return BLOCK_ERROR;
+    }
+    if (block->length > 0 && limitReached()) {
+        return BLOCK_ERROR;
+    }
+    // A block cut short by a store into its own code still counts in full
+    counts[TIER_THREADED].instructions += block->length;
+    state->instructions += block->length;
+    flagUpdatesEliminated += block->deadFlags;
+    return block->ops[0].handler(block->ops);
+}
+
+void writeTierReport(FILE *file)
+{
+    fprintf(file, "%-12s %12s %14s\n", "Tier", "Blocks", "Instructions");
+    for (int tier = 0; tier < NUM_TIERS; tier++) {
+        fprintf(file, "%-12s %12lu %14lu\n", tierNames[tier],
+                (unsigned long)counts[tier].blocks,
+                (unsigned long)counts[tier].instructions);
+    }
+    fprintf(file, "Promoted blocks: %lu\n", (unsigned long)promotions);
+}
+
+static void initializeHotness(void)
+{
+    if (hotness != NULL) {
+        return;
+    }
+    hotness = (uint32_t *)calloc(MEMORY_SIZE / INSTR_BYTES, sizeof(uint32_t));
+    if (hotness == NULL) {
+        perror("Failed to allocate space for the hotness counters.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// The first entry into the block at word
+static void recordCounted(uint32_t word)
+{
+    if (numCounted == countedCapacity) {
+        countedCapacity = (countedCapacity == 0) ? 1024 : countedCapacity * 2;
+        countedWords = (uint32_t *)realloc(countedWords, countedCapacity * sizeof(uint32_t));
+        if (countedWords == NULL) {
+            perror("Failed to allocate space for the hotness counters.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    countedWords[numCounted++] = word;
+}
+
+static void resetHotness(void)
+{
+    for (size_t i = 0; i < numCounted; i++) {
+        hotness[countedWords[i]] = 0;
+    }
+    numCounted = 0;
+}
+
+// The report covers a single run
+static void resetTierCounts(void)
+{
+    memset(counts, 0, sizeof(counts));
+    promotions = 0;
+}
+
+void freeTiered(void)
+{
+    free(hotness);
+    free(countedWords);
+    hotness = NULL;
+    countedWords = NULL;
+    numCounted = 0;
+    countedCapacity = 0;
+    resetTierCounts();
+}
+
+// Run blocks in the cheapest tier their hotness allows until the halt instruction
+int runTiered(unsigned long threshold)
+{
+    enum BlockExit result = BLOCK_NEXT;
+    initializeHotness();
+    initializeBlocks();
+    resetTierCounts();
+
+    while (result == BLOCK_NEXT) {
+        if (blocksModified) {
+            flushBlocks();
+        }
+        if (!inCodeWindow(state->PC)) {
+            result = BLOCK_ERROR;
+            break;
+        }
+        uint32_t *entries = &hotness[state->PC / INSTR_BYTES];
+        enum Tier tier = (*entries < threshold) ? TIER_INTERPRETER : TIER_THREADED;
+        if (tier == TIER_INTERPRETER) {
+            if (*entries == 0) {
+                recordCounted(state->PC / INSTR_BYTES);
+            }
+            if (++*entries == threshold) {
+                promotions++;
+            }
+        }
+
+        counts[tier].blocks++;
+        result = (tier == TIER_INTERPRETER) ? interpretBlock() : runBlock();
+    }
+
+    flushBlocks();
+    resetHotness();
+    return (result == BLOCK_HALT) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
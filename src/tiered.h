@@ -0,0 +1,13 @@
+#ifndef TIERED_H
+#define TIERED_H
+
+#include <stdio.h>
+
+#define DEFAULT_TIER_THRESHOLD 100 // block entries before promotion
+
+// Prototypes
+extern int runTiered(unsigned long threshold);
+extern void freeTiered(void);
+extern void writeTierReport(FILE *file);
+
+#endif
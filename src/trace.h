@@ -0,0 +1,48 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "structs.h"
+
+// Trace Format
+// A trace starts with TRACE_MAGIC and goes on in chunks, each a header of
+//   TRACE_CHUNK_BYTES  payload length   (4 bytes)
+//   TRACE_CHUNK_COUNT  records in it    (4 bytes)
+//   TRACE_CHUNK_INDEX  instructions run before its first record (8 bytes)
+//   TRACE_CHUNK_PC     PC of its first record (8 bytes)
+// in little-endian, followed by the records, one per instruction run:
+//   varint  zigzag(PC - PC of the previous record - 4) << 2 | kind
+//   4 bytes the instruction word, little-endian
+//   kind TRACE_REGISTER: varint of the destination register afterwards
+//   kind TRACE_LOAD, TRACE_STORE: varint address, varint value transferred
+// Varints are little-endian groups of 7 bits, the top bit set on all but the
+// last. The first record of a chunk counts from the chunk's PC, so every
+// chunk decodes without the ones before it. Branches only move PC, a taken
+// one shows as a non-zero delta on the record after it.
+
+#define TRACE_MAGIC "EMUTRACE"
+#define TRACE_MAGIC_LENGTH 8
+#define TRACE_CHUNK_HEADER 24
+#define TRACE_CHUNK_BYTES 0
+#define TRACE_CHUNK_COUNT 4
+#define TRACE_CHUNK_INDEX 8
+#define TRACE_CHUNK_PC 16
+#define TRACE_MAX_RECORD 35 // longest record, three 10 byte varints and the word
+
+enum TraceKind {
+    TRACE_BRANCH,   // branches, and anything else writing no register
+    TRACE_REGISTER, // data processing
+    TRACE_LOAD,
+    TRACE_STORE,
+};
+
+typedef struct Trace Trace;
+
+// Prototypes
+extern Trace *openTrace(FILE *file);
+extern void traceInstruction(Trace *trace, uint64_t pc, uint32_t word, const Instruction *instruction);
+extern int closeTrace(Trace *trace);
+
+#endif
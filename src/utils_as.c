@@ -1,6 +1,8 @@
+#include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -13,7 +15,7 @@
 // Decode 32-bit (0) or 64-bit mode (1)
 int getMode(char *rd)
 {
-    return (*rd == 'x');
+    return (*rd == 'x' || !strcasecmp(rd, "sp"));
 }
 
 // Decode from hex or dec to int
@@ -21,7 +23,7 @@ int getInt(char *val)
 {
     // Check if value is in hex or dec and parse it
     char *endptr;
-    if (strcasechr(val, 'x') != NULL) {
+    if (strpbrk(val, "xX") != NULL) {
         return (int)strtol(val, &endptr, 16); // hex
     }
     return (int)strtol(val, &endptr, 10);     // dec
@@ -36,6 +38,9 @@ int getImmediate(char *imm)
 // Decode <register>
 int getRegister(char *rd)
 {
+    if (!strcasecmp(rd, "sp")) {
+        return ZR_SP;
+    }
     char *p = rd + 1; // remove 'w' or 'x'
     if (!strncasecmp(p, "sp", 2) || !strncasecmp(p, "zr", 2)) {
         return ZR_SP;
@@ -51,7 +56,7 @@ int getOperand(char *op, bool rOrImm)
 }
 
 // Decode <literal>
-int getLiteral(char *literal, vector *symtable)
+int getLiteral(char *literal)
 {
     // Check for immediate value
     if (*literal == '#') {
@@ -59,7 +64,7 @@ int getLiteral(char *literal, vector *symtable)
     }
 
     // Find the address of the label in the symbol table
-    for (int i = 0; i < symtable->currentSize; i++) {
+    for (size_t i = 0; i < symtable->currentSize; i++) {
         struct symbolTable *symtableEntry = getFromVector(symtable, i);
         if (strcasecmp(literal, symtableEntry->label) == 0) {
             return symtableEntry->address;
@@ -90,9 +95,10 @@ int maskBetweenBits(int upp, int low)
 }
 
 // Checks if operation includes an immediate value or register for operand
-enum dpType getOpType(char **tokens)
+// Wide moves take it as their second operand, arithmetics as their third
+enum dpType getOpType(char **tokens, int numTokens)
 {
-    if (*tokens[2] == '#') {
+    if (*tokens[1] == '#' || (numTokens > 2 && *tokens[2] == '#')) {
         return imm;
     }
     return reg;
@@ -108,7 +114,7 @@ void insertNewToken(char **tokens, char *insertingToken, int numTokens, int inde
     strcpy(tokens[index], insertingToken);
 }
 
-int getPositionInArray(char *word, const char **words, int num)
+int getPositionInArray(char *word, const char *const *words, int num)
 {
     for (int i = 0; i < num; i++) {
         if (strcasecmp(word, words[i]) == 0) {
@@ -118,7 +124,7 @@ int getPositionInArray(char *word, const char **words, int num)
     return NOT_FOUND;
 }
 
-bool checkWordInArray(char *word, const char **words, int num)
+bool checkWordInArray(char *word, const char *const *words, int num)
 {
     return (getPositionInArray(word, words, num) != NOT_FOUND);
 }
@@ -148,3 +154,37 @@ void putBits(uint32_t *instr, void *value, int start, int nbits)
         *instr |= (*(uint32_t *)value & mask) << start;
     }
 }
+
+//
+// Malloc / Free Functions
+//
+InstructionParse *initializeInstructionParse(void)
+{
+    InstructionParse *instr = (InstructionParse *)malloc(sizeof(InstructionParse));
+    if (instr == NULL) {
+        perror("Failed to allocate space for InstructionParse struct.\n");
+        exit(EXIT_FAILURE);
+    }
+    // Allocate memory for tokens
+    for (int i = 0; i < NUM_TOKENS; i++)
+    {
+        instr->tokens[i] = (char *)malloc((MAX_TOKEN_LENGTH + 1) * sizeof(char));
+        if (instr->tokens[i] == NULL)
+        {
+            perror("Failed to allocate space for tokens.\n");
+            for (int j = 0; j < i; j++) {
+                free(instr->tokens[j]);
+            }
+            exit(EXIT_FAILURE);
+        }
+    }
+    return instr;
+}
+
+void freeInstructionParse(InstructionParse *instructionParse)
+{
+    for (int i = 0; i < NUM_TOKENS; i++) {
+        free(instructionParse->tokens[i]);
+    }
+    free(instructionParse);
+}
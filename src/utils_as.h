@@ -2,7 +2,9 @@
 #define UTILS_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
+#include "datatypes_as.h"
 #include "onepass.h"
 
 #define ZR_SP 31
@@ -18,16 +20,20 @@ extern int getLiteral(char *literal);
 extern int getShift(char *shift);
 
 extern int maskBetweenBits(int upp, int low);
-extern enum dpType getOpType(char **tokens);
+extern enum dpType getOpType(char **tokens, int numTokens);
 
 extern void insertNewToken(char **tokens, char *insertingToken, int numTokens, int index);
 
-extern int getPositionInArray(char *word,const char **words, int num);
-extern bool checkWordInArray(char *word,const char **words, int num);
+extern int getPositionInArray(char *word, const char *const *words, int num);
+extern bool checkWordInArray(char *word, const char *const *words, int num);
 extern bool checkForAliases(char *instrname);
 
 extern void setOnes(uint32_t *instruction, const int *bits, int num);
+extern bool hasOpenBracket(char *token);
 
 extern void putBits(uint32_t *instr, void *value, int start, int nbits);
 
+extern InstructionParse *initializeInstructionParse(void);
+extern void freeInstructionParse(InstructionParse *instr);
+
 #endif
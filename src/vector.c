@@ -1,7 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <assert.h>
 #include "vector.h"
 
 #define	GROW_FACTOR 2
@@ -24,14 +23,15 @@ void freeVector(vector *v) {
 	free(v);
 }
 
-// Assume element is the right type to be added
+// Assume element is the right type to be added, elementSize bytes are copied from it
 void addToVector(vector *v, void *element) {
-	// Check element has compatible type
-	assert(sizeof(*element) == v->elementSize);
-
 	// Check if resizing is required
 	if (v->currentSize == v->maxSize) {
 		v->data = realloc(v->data, (v->maxSize) * (v->elementSize) * GROW_FACTOR);
+		if (v->data == NULL) {
+			perror("Couldn't grow vector.\n");
+			exit(EXIT_FAILURE);
+		}
 		v->maxSize *= GROW_FACTOR;
 	}
 	void *target = (char *)(v->data) + (v->currentSize) * (v->elementSize);
@@ -41,7 +41,7 @@ void addToVector(vector *v, void *element) {
 
 // Must cast result to the type of element retrieving - otherwise derefencing void pointer
 void *getFromVector(vector *v, size_t index) {
-	if (index >= v->currentSize || index < 0) {
+	if (index >= v->currentSize) {
 		fprintf(stderr, "Index out of bounds in vector.\n");
 		exit(EXIT_FAILURE);
 	}